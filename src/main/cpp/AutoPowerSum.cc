@@ -0,0 +1,397 @@
+#include <math.h>
+#include <time.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#include "AutoPowerSum.h"
+
+using std::endl;
+
+static const char * METHOD_NAMES[] = {
+  "faulhaber", "bernoulli", "stirling", "euler", "central", "series"
+};
+
+// Constants of the cost model calibrated on a single core x86-64 machine
+// over the grid below.
+// Times of the formulas grow with the power and the number of coefficients,
+// times of the series with the number of terms.
+static const double DEFAULT_MODEL[][4] = {
+  {9.8064, -7.9269, 10.0580, -0.0234},
+  {3.8072, 1.0870, 1.0870, 0.0145},
+  {2.9312, 1.1463, 0.9990, -0.0970},
+  {1.8665, 1.7361, 0.5699, -0.0177},
+  {3.2181, 0.9771, 0.9434, 0.0682},
+  {5.6423, 0.7676, 1.4130, -2.9547}
+};
+
+// Calibration grid, which includes numbers of terms below the power so that
+// the cost of truncated coefficients is seen.  The times of the formulas
+// bend upwards at high powers, so the grid goes up to power 1000 and 10^9
+// terms, which keeps predictions up to power 1500 within about 2.5 times
+// the measured ones.  The series is only timed up to
+// CALIBRATION_SERIES_TERMS terms.
+static const long CALIBRATION_POWERS[] = {30, 100, 300, 1000};
+static const long CALIBRATION_TERMS[] = {5, 50, 1000, 100000, 1000000000};
+static const long CALIBRATION_SERIES_TERMS = 100000;
+static const int CALIBRATION_RUNS = 3;
+// A run this long is hardly disturbed, so it is not repeated
+static const long CALIBRATION_REPEAT_NANOS = 50000000;
+
+// Weight of the ridge term, which keeps the fit solvable when the power and
+// the number of coefficients move together, as they do for Faulhaber
+static const double RIDGE = 1e-3;
+
+AutoPowerSum :: AutoPowerSum() : PowerSum() {
+  for (int m = 0; m < NUM_METHODS; m++) {
+    for (int c = 0; c < NUM_CONSTANTS; c++) {
+      model[m][c] = DEFAULT_MODEL[m][c];
+    }
+  }
+}
+
+const char * AutoPowerSum :: methodName(Method method) {
+  return METHOD_NAMES[method];
+}
+
+PowerSum & AutoPowerSum :: formula(Method method) {
+  switch (method) {
+    case METHOD_FAULHABER:
+      return fps;
+    case METHOD_BERNOULLI:
+      return bps;
+    case METHOD_STIRLING:
+      return sps;
+    case METHOD_EULER:
+      return eps;
+    default:
+      return cps;
+  }
+}
+
+/**
+ * Stirling and Euler work out min(power, n) + 1 coefficients and Central
+ * Factorial min(power/2, n) + 1, the others do not look at n
+ */
+void AutoPowerSum :: features(Method method, long power, long n,
+                              double * x) const {
+  double m = 1;
+  switch (method) {
+    case METHOD_FAULHABER:
+      m = power/2 + 1;
+      break;
+    case METHOD_BERNOULLI:
+      m = power + 1;
+      break;
+    case METHOD_STIRLING:
+    case METHOD_EULER:
+      m = std::min(power, n) + 1;
+      break;
+    case METHOD_CENTRAL:
+      m = std::min(power/2, n) + 1;
+      break;
+    default:
+      m = n + 1;
+      break;
+  }
+  x[0] = 1;
+  x[1] = log(power + 1.0);
+  x[2] = log(m);
+  x[3] = log(log2(n + 2.0));
+}
+
+double AutoPowerSum :: predictTime(Method method, long power, long n) const {
+  double x[NUM_CONSTANTS];
+  features(method, power, n, x);
+  double logTime = 0;
+  for (int c = 0; c < NUM_CONSTANTS; c++) {
+    logTime += model[method][c]*x[c];
+  }
+  return exp(logTime);
+}
+
+double AutoPowerSum :: predictMemory(Method method, long power, long n) {
+  if (method == METHOD_SERIES) {
+    return predictSeriesMemory(power, n);
+  }
+  return formula(method).predictMemory(power, n);
+}
+
+bool AutoPowerSum :: fitsMemory(Method method, long power, long n) {
+  double limit = getMemoryLimit();
+  return limit <= 0 || predictMemory(method, power, n) <= limit;
+}
+
+/**
+ * Faulhaber is left out for power 1, for which its sum is known to be wrong
+ */
+AutoPowerSum::Method AutoPowerSum :: chooseMethod(long power, long n) {
+  Method best = NUM_METHODS;
+  Method fastest = NUM_METHODS;
+  double bestTime = 0;
+  double fastestTime = 0;
+  for (int m = 0; m < NUM_METHODS; m++) {
+    if (m == METHOD_FAULHABER && power == 1) {
+      continue;
+    }
+    double time = predictTime((Method)m, power, n);
+    if (fastest == NUM_METHODS || time < fastestTime) {
+      fastest = (Method)m;
+      fastestTime = time;
+    }
+    if ((best == NUM_METHODS || time < bestTime)
+        && fitsMemory((Method)m, power, n)) {
+      best = (Method)m;
+      bestTime = time;
+    }
+  }
+  return (best == NUM_METHODS) ? fastest : best;
+}
+
+AutoPowerSum::Method AutoPowerSum :: coefficientMethod(long power) const {
+  Method best = METHOD_BERNOULLI;
+  double bestTime = predictTime(METHOD_BERNOULLI, power, power);
+  for (int m = 0; m < METHOD_SERIES; m++) {
+    if (m == METHOD_FAULHABER && power == 1) {
+      continue;
+    }
+    double time = predictTime((Method)m, power, power);
+    if (time < bestTime) {
+      best = (Method)m;
+      bestTime = time;
+    }
+  }
+  return best;
+}
+
+void AutoPowerSum :: explain(long power, long n, ostream & out) {
+  Method chosen = chooseMethod(power, n);
+  out << "Predicted times and memory for S(" << power << ", " << n << "):"
+      << endl;
+  for (int m = 0; m < NUM_METHODS; m++) {
+    out << "  " << std::left << std::setw(10) << METHOD_NAMES[m] << std::right
+        << std::setw(16) << std::fixed << std::setprecision(0)
+        << predictTime((Method)m, power, n) << " ns"
+        << std::setw(16) << predictMemory((Method)m, power, n) << " bytes"
+        << (m == chosen ? " <- chosen" : "") << endl;
+  }
+  out.unsetf(std::ios::floatfield);
+}
+
+vector<mpq_class> AutoPowerSum :: getCoefficients(long power) {
+  return formula(coefficientMethod(power)).getCoefficients(power);
+}
+
+void AutoPowerSum :: getCoefficients(long power, CoefficientArray & coeffs) {
+  formula(coefficientMethod(power)).getCoefficients(power, coeffs);
+}
+
+std::unique_ptr<CoefficientGenerator> AutoPowerSum :: createGenerator(
+                                                        long power) {
+  return formula(coefficientMethod(power)).createGenerator(power);
+}
+
+void AutoPowerSum :: printSumFormula(long power, ostream &out) {
+  formula(coefficientMethod(power)).printSumFormula(power, out);
+}
+
+mpz_class AutoPowerSum :: computeSum(long power, long n) {
+  Method method = chooseMethod(power, n);
+  if (method == METHOD_SERIES) {
+    return computeSumUsingSeries(power, n);
+  }
+  return formula(method).computeSum(power, n);
+}
+
+/**
+ * The series has no coefficients, so all of its time is summation
+ */
+mpz_class AutoPowerSum :: computeSumWithStats(long power, long n,
+                                              PowerSumStats & stats) {
+  Method method = chooseMethod(power, n);
+  if (method != METHOD_SERIES) {
+    return formula(method).computeSumWithStats(power, n, stats);
+  }
+  PowerSumStatsRecorder recorder(stats);
+  recorder.startPhase();
+  mpz_class sum = computeSumUsingSeries(power, n);
+  recorder.endPhase(stats.sum);
+  recorder.finish(sum);
+  return sum;
+}
+
+mpz_class AutoPowerSum :: computeSumUsingCoefficients(
+                             const CoefficientArray & coeffs, long power,
+                             long n) {
+  return formula(coefficientMethod(power)).computeSumUsingCoefficients(
+           coeffs, power, n);
+}
+
+double AutoPowerSum :: predictMemory(long power, long n) {
+  return predictMemory(chooseMethod(power, n), power, n);
+}
+
+void AutoPowerSum :: setMemoryLimit(double bytes) {
+  PowerSum::setMemoryLimit(bytes);
+  for (int m = 0; m < METHOD_SERIES; m++) {
+    formula((Method)m).setMemoryLimit(bytes);
+  }
+}
+
+void AutoPowerSum :: setNumThreads(int threads) {
+  PowerSum::setNumThreads(threads);
+  for (int m = 0; m < METHOD_SERIES; m++) {
+    formula((Method)m).setNumThreads(threads);
+  }
+}
+
+AutoPowerSum :: ~AutoPowerSum() {
+}
+
+/**
+ * Every method is timed at every point of the grid, taking the fastest of a
+ * few runs as the least disturbed.  The constants of a method are then the
+ * least squares fit of the log of the times, with a small ridge term:
+ * (X'X + RIDGE D)c = X'y, where D leaves the constant term free.
+ */
+void AutoPowerSum :: calibrate() {
+  struct timespec before;
+  struct timespec after;
+  size_t numPowers = sizeof(CALIBRATION_POWERS)/sizeof(CALIBRATION_POWERS[0]);
+  size_t numTerms = sizeof(CALIBRATION_TERMS)/sizeof(CALIBRATION_TERMS[0]);
+
+  for (int m = 0; m < NUM_METHODS; m++) {
+    double a[NUM_CONSTANTS][NUM_CONSTANTS + 1] = {{0}};
+    for (size_t p = 0; p < numPowers; p++) {
+      for (size_t t = 0; t < numTerms; t++) {
+        long power = CALIBRATION_POWERS[p];
+        long n = CALIBRATION_TERMS[t];
+        if (m == METHOD_SERIES && n > CALIBRATION_SERIES_TERMS) {
+          continue;
+        }
+        long best = -1;
+        for (int run = 0;
+             run < CALIBRATION_RUNS && best < CALIBRATION_REPEAT_NANOS;
+             run++) {
+          clock_gettime(CLOCK_MONOTONIC, &before);
+          if (m == METHOD_SERIES) {
+            computeSumUsingSeries(power, n);
+          } else {
+            formula((Method)m).computeSum(power, n);
+          }
+          clock_gettime(CLOCK_MONOTONIC, &after);
+          long time = elapsedNano(before, after);
+          if (best < 0 || time < best) {
+            best = time;
+          }
+        }
+        double x[NUM_CONSTANTS];
+        features((Method)m, power, n, x);
+        double y = log(std::max(best, 1L));
+        for (int i = 0; i < NUM_CONSTANTS; i++) {
+          for (int j = 0; j < NUM_CONSTANTS; j++) {
+            a[i][j] += x[i]*x[j];
+          }
+          a[i][NUM_CONSTANTS] += x[i]*y;
+        }
+      }
+    }
+    for (int i = 1; i < NUM_CONSTANTS; i++) {
+      a[i][i] += RIDGE;
+    }
+
+    // Gaussian elimination with partial pivoting
+    for (int col = 0; col < NUM_CONSTANTS; col++) {
+      int pivot = col;
+      for (int row = col + 1; row < NUM_CONSTANTS; row++) {
+        if (fabs(a[row][col]) > fabs(a[pivot][col])) {
+          pivot = row;
+        }
+      }
+      for (int j = 0; j <= NUM_CONSTANTS; j++) {
+        std::swap(a[col][j], a[pivot][j]);
+      }
+      for (int row = col + 1; row < NUM_CONSTANTS; row++) {
+        double factor = a[row][col]/a[col][col];
+        for (int j = col; j <= NUM_CONSTANTS; j++) {
+          a[row][j] -= factor*a[col][j];
+        }
+      }
+    }
+    for (int i = NUM_CONSTANTS - 1; i >= 0; i--) {
+      double value = a[i][NUM_CONSTANTS];
+      for (int j = i + 1; j < NUM_CONSTANTS; j++) {
+        value -= a[i][j]*model[m][j];
+      }
+      model[m][i] = value/a[i][i];
+    }
+  }
+}
+
+bool AutoPowerSum :: loadCostModel(const string & fileName) {
+  std::ifstream in(fileName.c_str());
+  if (!in) {
+    return false;
+  }
+  double loaded[NUM_METHODS][NUM_CONSTANTS];
+  bool found[NUM_METHODS] = {false};
+  string line;
+  while (std::getline(in, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::istringstream fields(line);
+    string name;
+    fields >> name;
+    int m = 0;
+    while (m < NUM_METHODS && name != METHOD_NAMES[m]) {
+      m++;
+    }
+    if (m == NUM_METHODS) {
+      return false;
+    }
+    for (int c = 0; c < NUM_CONSTANTS; c++) {
+      if (!(fields >> loaded[m][c])) {
+        return false;
+      }
+    }
+    found[m] = true;
+  }
+  for (int m = 0; m < NUM_METHODS; m++) {
+    if (!found[m]) {
+      return false;
+    }
+  }
+  for (int m = 0; m < NUM_METHODS; m++) {
+    for (int c = 0; c < NUM_CONSTANTS; c++) {
+      model[m][c] = loaded[m][c];
+    }
+  }
+  return true;
+}
+
+bool AutoPowerSum :: saveCostModel(const string & fileName) const {
+  std::ofstream out(fileName.c_str());
+  out << "# Cost model of AutoPowerSum, one method per line:" << endl
+      << "# ln(ns) = c0 + c1 ln(power + 1) + c2 ln(coefficients)"
+      << " + c3 ln(log2(n + 2))" << endl;
+  out << std::setprecision(10);
+  for (int m = 0; m < NUM_METHODS; m++) {
+    out << METHOD_NAMES[m];
+    for (int c = 0; c < NUM_CONSTANTS; c++) {
+      out << ' ' << model[m][c];
+    }
+    out << endl;
+  }
+  return (bool)out;
+}
+
+void AutoPowerSum :: setCostModel(const AutoPowerSum & other) {
+  for (int m = 0; m < NUM_METHODS; m++) {
+    for (int c = 0; c < NUM_CONSTANTS; c++) {
+      model[m][c] = other.model[m][c];
+    }
+  }
+}
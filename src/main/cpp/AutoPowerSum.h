@@ -0,0 +1,141 @@
+#ifndef AUTO_POWERSUM_H
+#define AUTO_POWERSUM_H
+
+#include <string>
+
+#include "BernoulliPowerSum.h"
+#include "CentralFactorialPowerSum.h"
+#include "EulerPowerSum.h"
+#include "FaulhaberPowerSum.h"
+#include "StirlingPowerSum.h"
+
+using std::string;
+
+/* Sum formula that passes every computation to whichever of the five
+ * formulas, or the series addition, a cost model predicts to be fastest for
+ * the power and number of terms.  The model predicts the wall time of a
+ * method as
+ *   ln(time) = c0 + c1 ln(power + 1) + c2 ln(m) + c3 ln(log2(n + 2))
+ * where m is the number of coefficients the method works out, which is n + 1
+ * terms for the series and less than power + 1 for the formulas that stop at
+ * n.  The constants come with defaults and can be calibrated on the host by a
+ * short benchmark and saved to a file.  Methods predicted to need more memory
+ * than the limit of setMemoryLimit are passed over.
+ *
+ * The coefficient methods (getCoefficients, computeSumUsingCoefficients ...)
+ * have no n, so they use the formula predicted fastest for n = power, which
+ * only depends on the power and therefore stays the same between calls.
+ */
+class AutoPowerSum : public PowerSum {
+  public:
+    /* Ways of computing a sum to choose from */
+    enum Method {
+      METHOD_FAULHABER,
+      METHOD_BERNOULLI,
+      METHOD_STIRLING,
+      METHOD_EULER,
+      METHOD_CENTRAL,
+      METHOD_SERIES,
+      NUM_METHODS
+    };
+
+    AutoPowerSum();
+    virtual vector<mpq_class> getCoefficients(long power);
+    virtual void getCoefficients(long power, CoefficientArray & coeffs);
+    virtual std::unique_ptr<CoefficientGenerator> createGenerator(long power);
+    virtual void printSumFormula(long power, ostream &out);
+    virtual mpz_class computeSum(long power, long n);
+    virtual mpz_class computeSumWithStats(long power, long n,
+                                          PowerSumStats & stats);
+    virtual mpz_class computeSumUsingCoefficients(
+                        const CoefficientArray & coeffs, long power,
+                        long n);
+    virtual double predictMemory(long power, long n);
+    virtual void setNumThreads(int threads);
+    virtual void setMemoryLimit(double bytes);
+    virtual ~AutoPowerSum();
+
+    /* To get the method predicted fastest of those predicted to fit in the
+     * memory limit, or of all if none fits
+     * Parameters:
+     *   power - desired power (IN)
+     *   n - number of terms (IN)
+     * Return value
+     *   method with the lowest predicted time
+     */
+    Method chooseMethod(long power, long n);
+
+    /* To get the predicted wall time of a method
+     * Parameters:
+     *   method - method (IN)
+     *   power - desired power (IN)
+     *   n - number of terms (IN)
+     * Return value
+     *   predicted time in nanoseconds
+     */
+    double predictTime(Method method, long power, long n) const;
+
+    /* To print the predicted time and memory of every method and the one
+     * chosen
+     * Parameters:
+     *   power - desired power (IN)
+     *   n - number of terms (IN)
+     *   out - output stream (IN)
+     */
+    void explain(long power, long n, ostream & out);
+
+    /* To fit the cost model to timings of every method over a small grid of
+     * powers and numbers of terms, run with the current number of threads.
+     * Takes around a second.
+     */
+    void calibrate();
+
+    /* To read a cost model saved by saveCostModel
+     * Parameters:
+     *   fileName - file to read (IN)
+     * Return value
+     *   false if the file cannot be read or is not a cost model, in which
+     *   case the model is unchanged
+     */
+    bool loadCostModel(const string & fileName);
+
+    /* To save the cost model
+     * Parameters:
+     *   fileName - file to write (IN)
+     * Return value
+     *   false if the file cannot be written
+     */
+    bool saveCostModel(const string & fileName) const;
+
+    /* To use the cost model of another automatic formula
+     * Parameters:
+     *   other - formula whose model is copied (IN)
+     */
+    void setCostModel(const AutoPowerSum & other);
+
+    /* To get the name of a method
+     * Parameters:
+     *   method - method (IN)
+     * Return value
+     *   lower-case name, as in the cost model file
+     */
+    static const char * methodName(Method method);
+
+  private:
+    static const int NUM_CONSTANTS = 4;
+
+    PowerSum & formula(Method method);
+    Method coefficientMethod(long power) const;
+    double predictMemory(Method method, long power, long n);
+    bool fitsMemory(Method method, long power, long n);
+    void features(Method method, long power, long n, double * x) const;
+
+    FaulhaberPowerSum fps;
+    BernoulliPowerSum bps;
+    StirlingPowerSum sps;
+    EulerPowerSum eps;
+    CentralFactorialPowerSum cps;
+    double model[NUM_METHODS][NUM_CONSTANTS];
+};
+
+#endif
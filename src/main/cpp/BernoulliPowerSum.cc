@@ -3,6 +3,8 @@
 using std::endl;
 
 #include "BernoulliPowerSum.h"
+#include "Trace.h"
+#include "HornerAccumulator.h"
 
 BernoulliPowerSum :: BernoulliPowerSum()
                    : PowerSum() {
@@ -14,28 +16,59 @@ BernoulliPowerSum :: BernoulliPowerSum()
  *          + ... + Binom((m + 1), (m - 1))B(m - 1))
  * where Binom(i, j) is the binomial coefficient which evaluates to:
  * i!/{(i - j)!j!}
+ * The generator hands out B(0), B(1), ..., B(power).  The recurrence needs
+ * every number before the next one, so unlike the Faulhaber generator this
+ * one keeps what it handed out.  Only the numbers that are not 0, B(0), B(1)
+ * and the even ones, are kept.
  */
-vector<mpq_class> BernoulliPowerSum :: getCoefficients(long power) {
-  vector<mpq_class> coeffs;
-
-  if (power < 0) {
-    return coeffs;
-  }
+class BernoulliPowerSum :: Generator : public CoefficientGenerator {
+  public:
+    Generator(BernoulliPowerSum & formula, long power)
+      : formula(formula), power(power), i(0) {}
 
-  // Initialize B(0)
-  coeffs.push_back(1);
-  if (power > 0) {
-    // Initialize B(1)
-    coeffs.push_back(mpq_class(-1, 2));
-
-    for (long i = 2; i <= power; i++) {
-      if (i & 1) {
+    virtual bool next(mpq_class & coeff) {
+      if (i > power) {
+        return false;
+      }
+      CancellationToken::checkCurrent();
+      if (i == 0) {
+        // Initialize B(0)
+        numbers.push_back(1);
+        coeff = numbers.back();
+      } else if (i == 1) {
+        // Initialize B(1)
+        numbers.push_back(mpq_class(-1, 2));
+        coeff = numbers.back();
+      } else if (i & 1) {
         // Odd coefficients above 1 are 0s
-        coeffs.push_back(0);
+        coeff = 0;
       } else {
-        coeffs.push_back(computeNextCoefficient(coeffs, i));
+        numbers.push_back(formula.computeNextCoefficient(numbers, i));
+        coeff = numbers.back();
       }
+      i++;
+      return true;
     }
+
+  private:
+    BernoulliPowerSum & formula;
+    long power;
+    long i;                    // Index of the next number
+    vector<mpq_class> numbers; // B(0), B(1), B(2), B(4), ... so far
+};
+
+std::unique_ptr<CoefficientGenerator> BernoulliPowerSum :: createGenerator(
+                                                             long power) {
+  return std::unique_ptr<CoefficientGenerator>(new Generator(*this, power));
+}
+
+vector<mpq_class> BernoulliPowerSum :: getCoefficients(long power) {
+  checkMemoryLimit(predictMemory(power, power));
+  vector<mpq_class> coeffs;
+  Generator generator(*this, power);
+  mpq_class coeff;
+  while (generator.next(coeff)) {
+    coeffs.push_back(coeff);
   }
   return coeffs;
 }
@@ -80,61 +113,159 @@ void BernoulliPowerSum :: printSumFormula(long power, ostream &out) {
   out << endl;
 }
 
-mpz_class BernoulliPowerSum :: computeSumWithTimeStat(long power, long n, 
-                                                      vector<long> & stat) {
-  struct timespec before;
-  struct timespec after;
-
-  mpq_class sum = 0;
-  stat.clear();
+/**
+ * The polynomial in (n + 1) is built up by Horner's rule as the Bernoulli
+ * numbers are generated.  B(i) goes with (n + 1)^(power + 1 - i), so they
+ * come highest power first.  The products with the binomials and the
+ * packed copies of evaluateSum are never made.
+ */
+mpz_class BernoulliPowerSum :: computeSumWithStats(long power, long n,
+                                                   PowerSumStats & stats) {
+  checkMemoryLimit(predictMemory(power, n));
+  PowerSumStatsRecorder recorder(stats);
+  mpz_class sum = 0;
 
   if (power < 0 || n < 0) {
-    stat.push_back(0);
-    stat.push_back(0);
-    return sum.get_num();
+    recorder.finish(sum);
+    return sum;
   }
 
-  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &before);
-  vector<mpq_class> coeffs = getCoefficients(power);
-  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &after);
-  stat.push_back(computeCpuTime(before, after));
+  recorder.startPhase();
+  Generator generator(*this, power);
+  HornerAccumulator polynomial(mpz_class(n + 1));
+  recorder.endPhase(stats.init);
 
-  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &before);
-  mpz_class pow = n + 1;
+  recorder.startPhase();
+  mpq_class coeff;
+  mpq_class term;
+  mpz_class binom = 1;
+  for (long i = 0; generator.next(coeff); i++) {
+    recorder.recordCoefficient(coeff);
+    if ((i & 1) == 0 || i == 1) {
+      mpz_mul(term.get_num_mpz_t(), binom.get_mpz_t(), coeff.get_num_mpz_t());
+      mpz_set(term.get_den_mpz_t(), coeff.get_den_mpz_t());
+      term.canonicalize();
+      stats.bigMultiplications++;
+      polynomial.add(term);
+    } else {
+      polynomial.addZero();
+    }
+    // Binom((power + 1), (i + 1))
+    binom *= (power + 1 - i);
+    mpz_divexact_ui(binom.get_mpz_t(), binom.get_mpz_t(), i + 1);
+  }
+  // The last number goes with (n + 1)^1
+  polynomial.addZero();
+  mpq_class value = polynomial.getValue();
+  value /= (power + 1);
+  value.canonicalize();
+  sum = value.get_num();
+  stats.bigMultiplications += polynomial.getMultiplications();
+  recorder.endPhase(stats.sum);
+  recorder.finish(sum);
+  return sum;
+}
+
+mpz_class BernoulliPowerSum :: computeSumUsingCoefficients(
+                                 const CoefficientArray & coeffs, long power,
+                                 long n) {
+  checkMemoryLimit(predictMemory(power, n));
+  if (power < 0 || n < 0) {
+    return 0;
+  }
+  long multiplications = 0;
+  return evaluateSum(coeffs, power, n, multiplications);
+}
+
+mpz_class BernoulliPowerSum :: evaluateSum(const CoefficientArray & coeffs,
+                                           long power, long n,
+                                           long & multiplications) {
+  // The sum is a polynomial in (n + 1) with Binom((power + 1), i)B(i) as the
+  // coefficient of (n + 1)^(power + 1 - i)
+  // The binomials are worked out from i = 0 up, so the terms are first
+  // collected by i and packed in increasing exponent afterwards
+  TraceScope trace("Bernoulli summation");
+  long numCoeffs = (long)coeffs.size();
+  vector<mpq_class> terms(numCoeffs);
   long binomN = power + 1;
   long binomR = 1;
   mpz_class binom = binomN;
 
-  // We compute the terms in reverse order to avoid an additional division
-  // operation in the loop
-  for (long i = coeffs.size() - 1; i >= 0; i--) {
+  for (long i = numCoeffs - 1; i >= 0; i--) {
+    CancellationToken::checkCurrent();
     if ((i & 1) == 0 || i == 1) {
-      sum += binom*coeffs[i]*pow;
+      mpz_mul(terms[i].get_num_mpz_t(), binom.get_mpz_t(),
+              coeffs.numerator(i));
+      multiplications++;
+      mpz_set(terms[i].get_den_mpz_t(), coeffs.denominator(i));
+      terms[i].canonicalize();
     }
-    pow *= (n + 1);
     binomN--;
     binomR++;
-    binom = binom*binomN/binomR;
+    mpz_mul_ui(binom.get_mpz_t(), binom.get_mpz_t(), binomN);
+    mpz_divexact_ui(binom.get_mpz_t(), binom.get_mpz_t(), binomR);
+  }
+  CoefficientArray poly;
+  mpz_class zero = 0;
+  for (long e = 0; e < power + 2 - numCoeffs; e++) {
+    poly.append(zero);
+  }
+  for (long i = numCoeffs - 1; i >= 0; i--) {
+    poly.append(terms[i]);
   }
+  mpq_class sum = evaluatePolynomial(poly, mpz_class(n + 1), multiplications);
   sum /= (power + 1);
   sum.canonicalize();
-  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &after);
-  stat.push_back(computeCpuTime(before, after));
   return sum.get_num();
 }
 
+/**
+ * The generator keeps the Bernoulli numbers that are not 0, while the
+ * summation holds one product with a binomial at a time, the number handed
+ * out and the value of the polynomial, which has the denominators on top of
+ * the sum
+ */
+double BernoulliPowerSum :: predictMemory(long power, long n) {
+  if (power < 0 || n < 0) {
+    return 0;
+  }
+  double numbers = 0;
+  double term = 0;
+  for (long i = 0; i <= power; i++) {
+    // Odd numbers past B(1) are 0 and not kept
+    if (i > 1 && (i & 1)) {
+      continue;
+    }
+    double denominator = numberBytes(i + 1);
+    numbers += numberBytes(log2Bernoulli(i)) + denominator;
+    double bytes = numberBytes(log2Bernoulli(i) + log2nCr(power + 1, i))
+                   + denominator;
+    if (bytes > term) {
+      term = bytes;
+    }
+  }
+  return numbers + 2*term + numberBytes(power + 1)
+         + 3*numberBytes(log2Sum(power, n) + power + 1);
+}
+
 BernoulliPowerSum :: ~BernoulliPowerSum() {
 }
 
+/**
+ * numbers holds B(0), B(1), B(2), B(4), ..., B(m - 2), so B(k) for even
+ * k > 0 is numbers[k/2 + 1]
+ */
 mpq_class BernoulliPowerSum :: computeNextCoefficient(
-                                       vector<mpq_class> & current, long m) {
+                                       vector<mpq_class> & numbers, long m) {
+  TraceScope trace("Bernoulli number");
   mpz_class binom = 1;
   mpq_class coeff = 0;
 
   for (long k = 0; k < m; k++) {
-    if (((k & 1) == 0) || k == 1) {
-      // Even coefficient or the first odd one
-      coeff += current[k]*binom;
+    if (k < 2) {
+      coeff += numbers[k]*binom;
+    } else if ((k & 1) == 0) {
+      coeff += numbers[k/2 + 1]*binom;
     }
     binom *= (m + 1 - k);
     binom /= (k + 1);
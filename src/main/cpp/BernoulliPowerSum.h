@@ -7,13 +7,26 @@ class BernoulliPowerSum : public PowerSum {
   public:
     BernoulliPowerSum();
     virtual vector<mpq_class> getCoefficients(long power);
+    using PowerSum::getCoefficients;
+    virtual std::unique_ptr<CoefficientGenerator> createGenerator(long power);
     virtual void printSumFormula(long power, ostream &out);
-    virtual mpz_class computeSumWithTimeStat(long power, long n,
-                                             vector<long> & stat);
+    virtual mpz_class computeSumWithStats(long power, long n,
+                                          PowerSumStats & stats);
+    virtual mpz_class computeSumUsingCoefficients(
+                        const CoefficientArray & coeffs, long power,
+                        long n);
+    virtual double predictMemory(long power, long n);
     virtual ~BernoulliPowerSum();
 
+  protected:
+    // Kernel, timed on its own by KernelBench
+    mpq_class computeNextCoefficient(vector<mpq_class> & numbers, long m);
+
   private:
-    mpq_class computeNextCoefficient(vector<mpq_class> & current, long m);
+    class Generator;
+
+    mpz_class evaluateSum(const CoefficientArray & coeffs, long power,
+                          long n, long & multiplications);
 
 };
 
@@ -0,0 +1,58 @@
+#include "CancellationToken.h"
+
+static thread_local CancellationToken * currentToken = NULL;
+
+ComputationCancelled :: ComputationCancelled()
+                      : std::runtime_error("Computation cancelled") {
+}
+
+CancellationToken :: CancellationToken()
+                   : cancelled(false), hasDeadline(false), deadline(0) {
+}
+
+void CancellationToken :: cancel() {
+  cancelled = true;
+}
+
+void CancellationToken :: setDeadline(Clock::time_point when) {
+  deadline = when.time_since_epoch().count();
+  hasDeadline = true;
+}
+
+void CancellationToken :: setTimeout(long milliseconds) {
+  setDeadline(Clock::now() + std::chrono::milliseconds(milliseconds));
+}
+
+/**
+ * Once the deadline has passed the token stays cancelled, so the clock is
+ * not read again by later checks
+ */
+bool CancellationToken :: isCancelled() {
+  if (cancelled) {
+    return true;
+  }
+  if (hasDeadline && Clock::now().time_since_epoch().count() >= deadline) {
+    cancelled = true;
+    return true;
+  }
+  return false;
+}
+
+CancellationToken * CancellationToken :: current() {
+  return currentToken;
+}
+
+void CancellationToken :: checkCurrent() {
+  if (currentToken != NULL && currentToken->isCancelled()) {
+    throw ComputationCancelled();
+  }
+}
+
+CancellationScope :: CancellationScope(CancellationToken * token)
+                   : previous(currentToken) {
+  currentToken = token;
+}
+
+CancellationScope :: ~CancellationScope() {
+  currentToken = previous;
+}
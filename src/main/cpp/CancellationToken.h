@@ -0,0 +1,84 @@
+#ifndef CANCELLATION_TOKEN_H
+#define CANCELLATION_TOKEN_H
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+
+/* Thrown by a computation that finds its token cancelled */
+class ComputationCancelled : public std::runtime_error {
+  public:
+    ComputationCancelled();
+};
+
+/* Lets a computation be stopped from another thread.  Long loops of the
+ * formulas check the token of the thread they run on once per iteration and
+ * throw ComputationCancelled when it is cancelled or past its deadline.
+ */
+class CancellationToken {
+  public:
+    typedef std::chrono::steady_clock Clock;
+
+    CancellationToken();
+
+    /* To request that computations using the token stop as soon as they
+     * check it.  May be called from any thread.
+     */
+    void cancel();
+
+    /* To cancel the token automatically once a point in time has passed
+     * Parameters:
+     *   deadline - point in time after which the token is cancelled (IN)
+     */
+    void setDeadline(Clock::time_point deadline);
+
+    /* To cancel the token automatically after a duration from now
+     * Parameters:
+     *   milliseconds - time allowed from now (IN)
+     */
+    void setTimeout(long milliseconds);
+
+    /* To find out if the token has been cancelled or its deadline has passed
+     * Return value
+     *   true if computations using the token are to stop
+     */
+    bool isCancelled();
+
+    /* To get the token of the calling thread
+     * Return value
+     *   token installed by a CancellationScope or NULL if none
+     */
+    static CancellationToken * current();
+
+    /* To stop a computation if the token of the calling thread is cancelled.
+     * Does nothing if the thread has no token.
+     */
+    static void checkCurrent();
+
+  private:
+    CancellationToken(const CancellationToken &);
+    CancellationToken & operator=(const CancellationToken &);
+
+    std::atomic<bool> cancelled;
+    std::atomic<bool> hasDeadline;
+    std::atomic<Clock::rep> deadline; // Ticks since the epoch of Clock
+};
+
+/* Installs a token as the token of the calling thread for the lifetime of
+ * the scope, restoring the previous one at the end.  Threads of a pool
+ * working on behalf of a computation install the token of the computation
+ * the same way.
+ */
+class CancellationScope {
+  public:
+    CancellationScope(CancellationToken * token);
+    ~CancellationScope();
+
+  private:
+    CancellationScope(const CancellationScope &);
+    CancellationScope & operator=(const CancellationScope &);
+
+    CancellationToken * previous;
+};
+
+#endif
@@ -1,27 +1,34 @@
+#include <math.h>
+
+#include <algorithm>
 #include <iostream>
 
 using std::endl;
 
 #include "CentralFactorialPowerSum.h"
+#include "Trace.h"
 
 CentralFactorialPowerSum :: CentralFactorialPowerSum()
                           : PowerSum() {
 }
 
 vector<mpq_class> CentralFactorialPowerSum :: getCoefficients(long power) {
-  vector<mpq_class> outCoeffs;
+  checkMemoryLimit(predictMemory(power, power));
   vector<mpz_class> coeffs = getCoefficients(power, power);
+  return moveToRationals(coeffs);
+}
 
-  for (size_t i = 0; i < coeffs.size(); i++) {
-    outCoeffs.push_back(mpq_class(coeffs[i]));
-  }
-  return outCoeffs;
+void CentralFactorialPowerSum :: getCoefficients(long power,
+                                                 CoefficientArray & coeffs) {
+  checkMemoryLimit(predictMemory(power, power));
+  packCoefficients(getCoefficients(power, power), power + 1, coeffs);
 }
 
 void CentralFactorialPowerSum :: printSumFormula(long power, ostream &out) {
   if (power < 0) {
     return;
   }
+  checkMemoryLimit(predictMemory(power, power));
 
   bool evenPower = ((power & 1) == 0);
 
@@ -54,50 +61,108 @@ void CentralFactorialPowerSum :: printSumFormula(long power, ostream &out) {
   out << endl;
 }
 
-mpz_class CentralFactorialPowerSum :: computeSumWithTimeStat(long power,
-                                             long n, vector<long> & stat) {
-  struct timespec before;
-  struct timespec after;
-
+mpz_class CentralFactorialPowerSum :: computeSumWithStats(long power,
+                                             long n, PowerSumStats & stats) {
+  checkMemoryLimit(predictMemory(power, n));
+  PowerSumStatsRecorder recorder(stats);
   mpz_class sum = 0;
-  stat.clear();
 
   if (power < 0 || n < 0) {
-    stat.push_back(0);
-    stat.push_back(0);
+    recorder.finish(sum);
     return sum;
   }
 
   if (power > 0) {
-    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &before);
-    vector<mpz_class> coeffs = getCoefficients(power, n);
-    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &after);
-    stat.push_back(computeCpuTime(before, after));
-
-    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &before);
-    bool evenPower = ((power & 1) == 0);
-    long numCoeffs = coeffs.size();
-    mpz_class fallingFactorial = 1;
-
-    // Coefficient 0 is always 0 - so we start the loop at index 1
-    for (long k = 1; k < numCoeffs; k++) {
-      fallingFactorial *= (n + k)*(n - k + 1);
-      if (evenPower) {
-        sum += (coeffs[k]*fallingFactorial*(2*n + 1))/(2*(2*k + 1));
-      } else {
-        sum += coeffs[k]*fallingFactorial/(2*k);
-      }
-    }
+    recorder.startPhase();
+    CoefficientArray coeffs;
+    packCoefficients(getCoefficients(power, n), power + 1, coeffs);
+    recorder.endPhase(stats.init);
+    recorder.recordCoefficients(coeffs);
+
+    recorder.startPhase();
+    sum = evaluateSum(coeffs, power, n, stats.bigMultiplications);
   } else {
     // Special case - not handled by the formula
-    stat.push_back(0);
-    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &before);
+    recorder.startPhase();
     sum = n + 1;
   }
-  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &after);
-  stat.push_back(computeCpuTime(before, after));
+  recorder.endPhase(stats.sum);
+  recorder.finish(sum);
   return sum;
+}
 
+mpz_class CentralFactorialPowerSum :: computeSumUsingCoefficients(
+                                        const CoefficientArray & coeffs,
+                                        long power, long n) {
+  checkMemoryLimit(predictMemory(power, n));
+  if (power < 0 || n < 0) {
+    return 0;
+  }
+  if (power == 0) {
+    return n + 1;
+  }
+  long multiplications = 0;
+  return evaluateSum(coeffs, power, n, multiplications);
+}
+
+/**
+ * Add up the terms of the sum formula for power > 0
+ */
+mpz_class CentralFactorialPowerSum :: evaluateSum(
+                                        const CoefficientArray & coeffs,
+                                        long power, long n,
+                                        long & multiplications) {
+  TraceScope trace("Central Factorial summation");
+  mpz_class sum = 0;
+  mpz_class term;
+  bool evenPower = ((power & 1) == 0);
+  long numCoeffs = coeffs.size();
+  mpz_class fallingFactorial = 1;
+  // Falling factorials past n + 1 are 0
+  if (numCoeffs > n + 1) {
+    numCoeffs = n + 1;
+  }
+
+  // Coefficient 0 is always 0 - so we start the loop at index 1
+  for (long k = 1; k < numCoeffs; k++) {
+    CancellationToken::checkCurrent();
+    fallingFactorial *= (n + k)*(n - k + 1);
+    mpz_mul(term.get_mpz_t(), coeffs.numerator(k),
+            fallingFactorial.get_mpz_t());
+    multiplications++;
+    if (evenPower) {
+      term *= (2*n + 1);
+      mpz_tdiv_q_ui(term.get_mpz_t(), term.get_mpz_t(), 2*(2*k + 1));
+    } else {
+      mpz_tdiv_q_ui(term.get_mpz_t(), term.get_mpz_t(), 2*k);
+    }
+    sum += term;
+  }
+  return sum;
+}
+
+/**
+ * The coefficients take the room getCoefficients reserves for them and are
+ * packed once more for the summation, which also holds a product of up to
+ * 2(n + 1) factors of at most n + m, a term and the sum
+ */
+double CentralFactorialPowerSum :: predictMemory(long power, long n) {
+  if (power < 0 || n < 0) {
+    return 0;
+  }
+  long m = (power >> 1) + (power & 1);
+  long numCoefficients = (n < m) ? n + 1 : m + 1;
+  double coefficients = numCoefficients*numberBytes(0);
+  double maxBits = 0;
+  for (long k = 1; k < numCoefficients; k++) {
+    double bits = log2nCr(m - 1, k - 1) + 2*(m - k)*log2((double)k);
+    coefficients += numberBytes(bits);
+    maxBits = std::max(maxBits, bits);
+  }
+  double factorialBits = 2*numCoefficients*log2(n + m + 1.0);
+  return 2*coefficients + numberBytes(factorialBits)
+         + numberBytes(factorialBits + maxBits)
+         + numberBytes(log2Sum(power, n));
 }
 
 CentralFactorialPowerSum :: ~CentralFactorialPowerSum() {
@@ -111,14 +176,13 @@ CentralFactorialPowerSum :: ~CentralFactorialPowerSum() {
  */
 vector<mpz_class> CentralFactorialPowerSum :: getCoefficients(long power,
                                                               long maxN) {
+  TraceScope trace("Central Factorial recurrence");
   vector<mpz_class> coeffs;
 
   if (power < 0) {
     return coeffs;
   }
 
-  mpz_class T_2_2 = 0;
-  mpz_class temp;
   long i;
   long k;
 
@@ -140,22 +204,31 @@ vector<mpz_class> CentralFactorialPowerSum :: getCoefficients(long power,
     coeffs.push_back(0);
   }
 
+  // Make room for the final values so that the coefficients are never
+  // reallocated as they grow.  T(2m, 2k) <= Binom((m - 1), (k - 1))k^(2(m - k))
+  for (k = 1; k < maxNumCoefficients; k++) {
+    reserveBits(coeffs[k], log2nCr(m - 1, k - 1) + 2*(m - k)*log2((double)k));
+  }
+
   for (i = 0; i <= m; i++) {
-    for (k = 0; k < maxNumCoefficients; k++) {
+    CancellationToken::checkCurrent();
+    // T(2*i, 2*k) is 0 for k > i, so only the entries up to the diagonal are
+    // updated
+    long kMax = (i < maxNumCoefficients) ? i : maxNumCoefficients - 1;
+    for (k = kMax; k >= 1; k--) {
       if (i == k) {
         coeffs[k] = 1;
-      } else if (i > 0 && k > 0) {
-        // Calculate T(2*i, 2*k) = T(2*i-2,2*k-2) + k*k*T(2*i-2, 2*k)
-        // Use the previous values in coeffs[k] for all the computation before
-        // setting the new value.
-        temp = coeffs[k]*k*k + T_2_2;
-        T_2_2 = coeffs[k];
-        coeffs[k] = temp;
       } else {
-        coeffs[k] = 0;
+        // Calculate T(2*i, 2*k) = T(2*i-2,2*k-2) + k*k*T(2*i-2, 2*k) in
+        // place.  Going down the row, coeffs[k - 1] still holds
+        // T(2*i-2, 2*k-2) when it is needed.
+        mpz_mul_ui(coeffs[k].get_mpz_t(), coeffs[k].get_mpz_t(),
+                   (unsigned long)k*k);
+        mpz_add(coeffs[k].get_mpz_t(), coeffs[k].get_mpz_t(),
+                coeffs[k - 1].get_mpz_t());
       }
     }
-    T_2_2 = coeffs[0];
+    coeffs[0] = (i == 0) ? 1 : 0;
   }
   return coeffs;
 }
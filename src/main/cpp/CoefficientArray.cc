@@ -0,0 +1,167 @@
+#include <utility>
+
+#include "CoefficientArray.h"
+
+// Denominator of all coefficients of an integer array
+static const mp_limb_t ONE = 1;
+
+CoefficientArray :: CoefficientArray()
+                  : numBase(NULL), denBase(NULL) {
+}
+
+/**
+ * The views of a copy point into the buffers of the copy
+ */
+CoefficientArray :: CoefficientArray(const CoefficientArray & other)
+                  : numLimbs(other.numLimbs), numOffsets(other.numOffsets),
+                    numSizes(other.numSizes), denLimbs(other.denLimbs),
+                    denOffsets(other.denOffsets), denSizes(other.denSizes),
+                    views(other.views.size()) {
+  refreshViews();
+}
+
+CoefficientArray & CoefficientArray :: operator=(
+                                         const CoefficientArray & other) {
+  if (this != &other) {
+    CoefficientArray copy(other);
+    swap(copy);
+  }
+  return *this;
+}
+
+void CoefficientArray :: swap(CoefficientArray & other) {
+  numLimbs.swap(other.numLimbs);
+  numOffsets.swap(other.numOffsets);
+  numSizes.swap(other.numSizes);
+  denLimbs.swap(other.denLimbs);
+  denOffsets.swap(other.denOffsets);
+  denSizes.swap(other.denSizes);
+  views.swap(other.views);
+  std::swap(numBase, other.numBase);
+  std::swap(denBase, other.denBase);
+}
+
+void CoefficientArray :: clear() {
+  numLimbs.clear();
+  numOffsets.clear();
+  numSizes.clear();
+  denLimbs.clear();
+  denOffsets.clear();
+  denSizes.clear();
+  views.clear();
+}
+
+void CoefficientArray :: reserve(size_t count, size_t limbs) {
+  numLimbs.reserve(limbs);
+  numOffsets.reserve(count);
+  numSizes.reserve(count);
+  views.reserve(count);
+  refreshViews();
+}
+
+void CoefficientArray :: append(mpz_srcptr value) {
+  appendLimbs(numLimbs, numOffsets, numSizes, value);
+  if (!denSizes.empty()) {
+    appendOne();
+  }
+  views.push_back(__mpq_struct());
+  if (numLimbs.data() != numBase || denLimbs.data() != denBase) {
+    refreshViews();
+  } else {
+    refreshView(views.size() - 1);
+  }
+}
+
+void CoefficientArray :: append(const mpz_class & value) {
+  append(value.get_mpz_t());
+}
+
+/**
+ * The denominator segment is only created with the first coefficient that
+ * is not an integer.  Denominators of 1 are then filled in for the
+ * coefficients before it.
+ */
+void CoefficientArray :: append(mpq_srcptr value) {
+  bool integer = (mpz_cmp_ui(mpq_denref(value), 1) == 0);
+  if (integer && denSizes.empty()) {
+    append(mpq_numref(value));
+    return;
+  }
+  if (denSizes.empty()) {
+    for (size_t i = 0; i < numSizes.size(); i++) {
+      appendOne();
+    }
+  }
+  appendLimbs(numLimbs, numOffsets, numSizes, mpq_numref(value));
+  appendLimbs(denLimbs, denOffsets, denSizes, mpq_denref(value));
+  views.push_back(__mpq_struct());
+  if (numLimbs.data() != numBase || denLimbs.data() != denBase) {
+    refreshViews();
+  } else {
+    refreshView(views.size() - 1);
+  }
+}
+
+void CoefficientArray :: append(const mpq_class & value) {
+  append(value.get_mpq_t());
+}
+
+size_t CoefficientArray :: size() const {
+  return numSizes.size();
+}
+
+bool CoefficientArray :: isInteger() const {
+  return denSizes.empty();
+}
+
+mpq_srcptr CoefficientArray :: rational(size_t i) const {
+  return &views[i];
+}
+
+mpz_srcptr CoefficientArray :: numerator(size_t i) const {
+  return mpq_numref(&views[i]);
+}
+
+mpz_srcptr CoefficientArray :: denominator(size_t i) const {
+  return mpq_denref(&views[i]);
+}
+
+mpq_class CoefficientArray :: get(size_t i) const {
+  return mpq_class(rational(i));
+}
+
+void CoefficientArray :: appendLimbs(LimbBuffer & buffer,
+                                     OffsetBuffer & offsets,
+                                     SizeBuffer & sizes,
+                                     mpz_srcptr value) {
+  size_t numLimbsInValue = mpz_size(value);
+  const mp_limb_t * limbs = mpz_limbs_read(value);
+  offsets.push_back(buffer.size());
+  buffer.insert(buffer.end(), limbs, limbs + numLimbsInValue);
+  mp_size_t size = (mp_size_t)numLimbsInValue;
+  sizes.push_back(mpz_sgn(value) < 0 ? -size : size);
+}
+
+void CoefficientArray :: appendOne() {
+  denOffsets.push_back(denLimbs.size());
+  denSizes.push_back(1);
+  denLimbs.push_back(1);
+}
+
+void CoefficientArray :: refreshViews() {
+  numBase = numLimbs.data();
+  denBase = denLimbs.data();
+  for (size_t i = 0; i < views.size(); i++) {
+    refreshView(i);
+  }
+}
+
+void CoefficientArray :: refreshView(size_t i) {
+  mpz_roinit_n(mpq_numref(&views[i]), numBase + numOffsets[i], numSizes[i]);
+  if (denSizes.empty()) {
+    mpz_roinit_n(mpq_denref(&views[i]), &ONE, 1);
+  } else {
+    mpz_roinit_n(mpq_denref(&views[i]), denBase + denOffsets[i],
+                 denSizes[i]);
+  }
+}
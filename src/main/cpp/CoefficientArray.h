@@ -0,0 +1,111 @@
+#ifndef COEFFICIENT_ARRAY_H
+#define COEFFICIENT_ARRAY_H
+
+#include <gmpxx.h>
+
+#include <vector>
+
+using std::vector;
+
+#include "GmpAllocator.h"
+
+/* Coefficients of a sum formula stored one after another in a single limb
+ * buffer instead of one heap block per number.  Numerators go to one buffer
+ * and denominators, if any coefficient is not an integer, to a second one.
+ * Entries are read through read-only GMP views into the buffers, so a loop
+ * over the coefficients streams through contiguous memory.  Views stay valid
+ * until the array is changed.
+ */
+class CoefficientArray {
+  public:
+    CoefficientArray();
+    CoefficientArray(const CoefficientArray & other);
+    CoefficientArray & operator=(const CoefficientArray & other);
+
+    /* To exchange the coefficients of two arrays without copying them.  The
+     * views move along with the coefficients.
+     * Parameters:
+     *   other - array to exchange with (IN/OUT)
+     */
+    void swap(CoefficientArray & other);
+
+    /* To remove all coefficients, keeping the memory for reuse */
+    void clear();
+
+    /* To make room for coefficients in advance
+     * Parameters:
+     *   count - number of coefficients (IN)
+     *   limbs - total number of limbs of the numerators (IN)
+     */
+    void reserve(size_t count, size_t limbs);
+
+    /* To add an integer coefficient at the end
+     * Parameters:
+     *   value - coefficient (IN)
+     */
+    void append(mpz_srcptr value);
+    void append(const mpz_class & value);
+
+    /* To add a rational coefficient at the end.  The fraction is expected
+     * to be in canonical form.
+     * Parameters:
+     *   value - coefficient (IN)
+     */
+    void append(mpq_srcptr value);
+    void append(const mpq_class & value);
+
+    /* To get the number of coefficients
+     * Return value
+     *   number of coefficients
+     */
+    size_t size() const;
+
+    /* To find out if all coefficients are integers
+     * Return value
+     *   true if no coefficient has a denominator other than 1
+     */
+    bool isInteger() const;
+
+    /* To get a coefficient or its parts as read-only GMP numbers
+     * Parameters:
+     *   i - index of the coefficient (IN)
+     * Return value
+     *   view of the coefficient, its numerator or its denominator
+     */
+    mpq_srcptr rational(size_t i) const;
+    mpz_srcptr numerator(size_t i) const;
+    mpz_srcptr denominator(size_t i) const;
+
+    /* To get a copy of a coefficient
+     * Parameters:
+     *   i - index of the coefficient (IN)
+     * Return value
+     *   coefficient
+     */
+    mpq_class get(size_t i) const;
+
+  private:
+    // The buffers count toward the GMP peak like the numbers they copy
+    typedef vector<mp_limb_t, GmpTrackedAllocator<mp_limb_t> > LimbBuffer;
+    typedef vector<size_t, GmpTrackedAllocator<size_t> > OffsetBuffer;
+    typedef vector<mp_size_t, GmpTrackedAllocator<mp_size_t> > SizeBuffer;
+
+    void appendLimbs(LimbBuffer & buffer, OffsetBuffer & offsets,
+                     SizeBuffer & sizes, mpz_srcptr value);
+    void appendOne();
+    void refreshViews();
+    void refreshView(size_t i);
+
+    LimbBuffer numLimbs;
+    OffsetBuffer numOffsets;
+    SizeBuffer numSizes;  // Signed number of limbs as in mpz_t
+    LimbBuffer denLimbs;
+    OffsetBuffer denOffsets;
+    SizeBuffer denSizes;  // Empty while all coefficients are integers
+    vector<__mpq_struct, GmpTrackedAllocator<__mpq_struct> > views;
+    // Buffers the views point into.  The views are rebuilt when they move.
+    const mp_limb_t * numBase;
+    const mp_limb_t * denBase;
+};
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef COEFFICIENT_GENERATOR_H
+#define COEFFICIENT_GENERATOR_H
+
+#include <gmpxx.h>
+
+/* Source of the coefficients of a sum formula, one at a time and in the
+ * order getCoefficients returns them.  Formulas that produce a coefficient
+ * per step hand it out as soon as it is known, so the sum can be built up
+ * without keeping all coefficients.
+ */
+class CoefficientGenerator {
+  public:
+    /* To get the next coefficient
+     * Parameters:
+     *   coeff - next coefficient (OUT)
+     * Return value
+     *   false if all coefficients have been handed out, in which case coeff
+     *   is left unchanged
+     */
+    virtual bool next(mpq_class & coeff) = 0;
+
+    virtual ~CoefficientGenerator() {}
+};
+
+#endif
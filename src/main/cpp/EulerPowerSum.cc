@@ -1,27 +1,33 @@
+#include <math.h>
+
+#include <algorithm>
 #include <iostream>
 
 using std::endl;
 
 #include "EulerPowerSum.h"
+#include "Trace.h"
 
 EulerPowerSum :: EulerPowerSum()
                   : PowerSum() {
 }
 
 vector<mpq_class> EulerPowerSum :: getCoefficients(long power) {
-  vector<mpq_class> outCoeffs;
+  checkMemoryLimit(predictMemory(power, power));
   vector<mpz_class> coeffs = getCoefficients(power, power);
+  return moveToRationals(coeffs);
+}
 
-  for (size_t i = 0; i < coeffs.size(); i++) {
-    outCoeffs.push_back(mpq_class(coeffs[i]));
-  }
-  return outCoeffs;
+void EulerPowerSum :: getCoefficients(long power, CoefficientArray & coeffs) {
+  checkMemoryLimit(predictMemory(power, power));
+  packCoefficients(getCoefficients(power, power), power + 1, coeffs);
 }
 
 void EulerPowerSum :: printSumFormula(long power, ostream &out) {
   if (power < 0) {
     return;
   }
+  checkMemoryLimit(predictMemory(power, power));
 
   vector<mpz_class> coeffs = getCoefficients(power, power);
   mpz_class powerFactorial;
@@ -52,48 +58,94 @@ void EulerPowerSum :: printSumFormula(long power, ostream &out) {
   out << endl;
 }
 
-mpz_class EulerPowerSum :: computeSumWithTimeStat(long power, long n, 
-                                                  vector<long> & stat) {
-  struct timespec before;
-  struct timespec after;
-
+mpz_class EulerPowerSum :: computeSumWithStats(long power, long n,
+                                               PowerSumStats & stats) {
+  checkMemoryLimit(predictMemory(power, n));
+  PowerSumStatsRecorder recorder(stats);
   mpz_class sum = 0;
-  stat.clear();
 
   if (power < 0 || n < 0) {
-    stat.push_back(0);
-    stat.push_back(0);
+    recorder.finish(sum);
     return sum;
   }
 
-  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &before);
-  vector<mpz_class> coeffs = getCoefficients(power, n);
-  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &after);
-  stat.push_back(computeCpuTime(before, after));
+  recorder.startPhase();
+  CoefficientArray coeffs;
+  packCoefficients(getCoefficients(power, n), power + 1, coeffs);
+  recorder.endPhase(stats.init);
+  // The summation starts at the first term with n + j >= power
+  recorder.recordCoefficients(coeffs, (power > n) ? power - n : 0);
+
+  recorder.startPhase();
+  sum = evaluateSum(coeffs, power, n, stats.bigMultiplications);
+  recorder.endPhase(stats.sum);
+  recorder.finish(sum);
+  return sum;
+}
 
-  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &before);
+mpz_class EulerPowerSum :: computeSumUsingCoefficients(
+                             const CoefficientArray & coeffs, long power,
+                             long n) {
+  checkMemoryLimit(predictMemory(power, n));
+  if (power < 0 || n < 0) {
+    return 0;
+  }
+  long multiplications = 0;
+  return evaluateSum(coeffs, power, n, multiplications);
+}
+
+/**
+ * Add up coeffs[j]Binom((n + j + 1), (power + 1)) for j = 0, 1, ...
+ */
+mpz_class EulerPowerSum :: evaluateSum(const CoefficientArray & coeffs,
+                                       long power, long n,
+                                       long & multiplications) {
+  TraceScope trace("Euler summation");
+  mpz_class sum = 0;
   mpz_class temp;
 
   bool firstTime = true;
   long numCoeffs = (long)coeffs.size();
   for (long j = 0; j < numCoeffs; j++) {
+    CancellationToken::checkCurrent();
     if (n + j >= power) {
       if (firstTime) {
         firstTime = false;
         temp = nCr(n + j + 1, power + 1);
       } else {
         temp *= (n + j + 1);
-        temp /= (n + j - power);
+        mpz_divexact_ui(temp.get_mpz_t(), temp.get_mpz_t(), n + j - power);
       }
-      sum += coeffs[j]*temp;
+      mpz_addmul(sum.get_mpz_t(), coeffs.numerator(j), temp.get_mpz_t());
+      multiplications++;
     }
   }
-
-  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &after);
-  stat.push_back(computeCpuTime(before, after));
   return sum;
 }
 
+/**
+ * getCoefficients reserves room for all the coefficients whatever n is.  They
+ * are packed once more for the summation, which also holds a binomial of up
+ * to Binom((n + power + 1), (power + 1)), its product with a coefficient and
+ * the sum.
+ */
+double EulerPowerSum :: predictMemory(long power, long n) {
+  if (power < 0 || n < 0) {
+    return 0;
+  }
+  double coefficients = (power + 1)*numberBytes(0);
+  double maxBits = 0;
+  for (long k = 1; k < power; k++) {
+    long base = (k + 1 < power - k) ? k + 1 : power - k;
+    double bits = power*log2((double)base);
+    coefficients += numberBytes(bits);
+    maxBits = std::max(maxBits, bits);
+  }
+  double binomialBits = log2nCr(n + power + 1, power + 1);
+  return 2*coefficients + numberBytes(binomialBits)
+         + numberBytes(binomialBits + maxBits) + numberBytes(log2Sum(power, n));
+}
+
 EulerPowerSum :: ~EulerPowerSum() {
 }
 
@@ -104,15 +156,13 @@ EulerPowerSum :: ~EulerPowerSum() {
  */
 vector<mpz_class> EulerPowerSum :: getCoefficients(long power,
                                                    long maxNumCoefficients) {
+  TraceScope trace("Euler recurrence");
   vector<mpz_class> coeffs;
 
   if (power < 0) {
     return coeffs;
   }
 
-  mpz_class temp;
-  mpz_class E_i_1_j_1;
-
   long k;
   long j;
 
@@ -120,8 +170,16 @@ vector<mpz_class> EulerPowerSum :: getCoefficients(long power,
   for (k = 1; k < power + 1; k++) {
     coeffs.push_back(0);
   }
+  // Make room for the final values so that the coefficients are never
+  // reallocated as they grow.  E(m, j) <= (j + 1)^m and the coefficients are
+  // symmetric
+  for (k = 1; k < power; k++) {
+    long base = (k + 1 < power - k) ? k + 1 : power - k;
+    reserveBits(coeffs[k], power*log2((double)base));
+  }
 
   for (long i = 1; i <= power; i++) {
+    CancellationToken::checkCurrent();
     bool oddPower = ((i & 1) == 1);
     long halfI = i >> 1;
     long halfLimit = oddPower ? halfI : (halfI - 1);
@@ -132,15 +190,12 @@ vector<mpz_class> EulerPowerSum :: getCoefficients(long power,
       limit = maxNumCoefficients;
     }
 
-    for (j = 0; j <= limit; j++) {
-      if (j == 0) {
-        E_i_1_j_1 = coeffs[j];
-        coeffs[j] = 1;
-      } else {
-        temp = (j + 1)*coeffs[j] + (i - j)*E_i_1_j_1;
-        E_i_1_j_1 = coeffs[j];
-        coeffs[j] = temp;
-      }
+    // Update the coefficients in place.  Going down the row, coeffs[j - 1]
+    // still holds E(i - 1, j - 1) when it is needed, so no temporaries are
+    // involved.  coeffs[0] is always 1.
+    for (j = limit; j >= 1; j--) {
+      mpz_mul_ui(coeffs[j].get_mpz_t(), coeffs[j].get_mpz_t(), j + 1);
+      mpz_addmul_ui(coeffs[j].get_mpz_t(), coeffs[j - 1].get_mpz_t(), i - j);
     }
     j = halfLimit;
     // Since coefficients are mirror reflection w.r.t. the central point,
@@ -1,8 +1,17 @@
+#include <math.h>
+
+#include <algorithm>
 #include <iostream>
 
 using std::endl;
 
 #include "FaulhaberPowerSum.h"
+#include "Trace.h"
+#include "HornerAccumulator.h"
+
+// Rows with fewer columns to eliminate than this are not worth splitting
+// between threads
+static const size_t PARALLEL_MIN_COLUMNS = 64;
 
 FaulhaberPowerSum :: FaulhaberPowerSum()
                   : PowerSum() {
@@ -24,21 +33,51 @@ FaulhaberPowerSum :: FaulhaberPowerSum()
  * time.  There is no need to hold the entire matrix in memory thus reducing
  * the storage requirement to O(m).  The time complexity is also brought down
  * to O(m^2).
+ * The generator carries out the transformation one row per coefficient.
  */
-vector<mpq_class> FaulhaberPowerSum :: getCoefficients(long power) {
-  vector<mpq_class> coefficients;
+class FaulhaberPowerSum :: Generator : public CoefficientGenerator {
+  public:
+    Generator(FaulhaberPowerSum & formula, long power);
+    virtual bool next(mpq_class & coeff);
+    virtual ~Generator();
 
-  if (power < 0) {
-    return coefficients;
-  }
+  private:
+    void createRowInPool(long rowNum, int slot);
+    void finish();
 
-  vector<mpz_class> firstRow;
-  vector<mpz_class> nextRow;
-  mpz_class scaleBy;
-  mpz_class nextScaleBy;
+    FaulhaberPowerSum & formula;
+    bool oddPower;
+    long nLimit;
+    long rowNum;     // Row eliminated by the next call of next
+    long pivotIndex;
+    bool started;
+    bool finished;
+    vector<mpz_class> firstRow;
+    vector<mpz_class> nextRow;
+    mpz_class scaleBy;
+    mpz_class nextScaleBy;
+    // With a thread pool, the row after the next is created on a thread of
+    // the pool while the next row is being eliminated.  The two rows
+    // alternate between rows[0] and rows[1].
+    ThreadPool * pool;
+    vector<mpz_class> rows[2];
+    mpz_class rowScaleBy[2];
+    future<void> rowCreated;
+    int current;
+    CancellationToken * token;
+};
 
-  long nLimit;
-  bool oddPower = false;
+FaulhaberPowerSum :: Generator :: Generator(FaulhaberPowerSum & formula,
+                                            long power)
+                                : formula(formula), oddPower(false),
+                                  nLimit(0), rowNum(0), pivotIndex(1),
+                                  started(false), finished(false),
+                                  pool(NULL), current(0),
+                                  token(CancellationToken::current()) {
+  if (power < 0) {
+    finished = true;
+    return;
+  }
   if (power & 1) {
     oddPower = true;
     nLimit = (power + 1)/2;
@@ -47,47 +86,131 @@ vector<mpq_class> FaulhaberPowerSum :: getCoefficients(long power) {
   }
   // Create the first row.  Each row is created with an augmented column entry
   // of 1
-  if (oddPower) {
-    scaleBy = createRowForOddPower(nLimit, nLimit, firstRow);
-  } else {
-    scaleBy = createRowForEvenPower(nLimit, nLimit, firstRow);
-  }
-
-  coefficients.push_back(mpq_class(firstRow.back(), scaleBy));
-  long pivotIndex = 1;
-  // Create subsequent rows and generate one coefficient at a time
-  for (long i = nLimit - 1; i >= 1; i --) {
-    // Reinitialize the augmented column
-    firstRow.back() = 0;
-    mpz_class pivotInFirst = firstRow[pivotIndex];
-    if (pivotInFirst == 0) {
-      // Once we reach a 0, all other columns will be zero.  This means all
-      // other coefficients will be zero
-      break;
+  scaleBy = formula.createRow(oddPower, nLimit, nLimit, firstRow);
+  rowNum = nLimit - 1;
+  pool = formula.getThreadPool();
+  if (pool != NULL && rowNum >= 1) {
+    createRowInPool(rowNum, 0);
+  }
+}
+
+void FaulhaberPowerSum :: Generator :: createRowInPool(long rowNum, int slot) {
+  rows[slot].clear();
+  rowCreated = pool->submit([this, rowNum, slot]() {
+    CancellationScope scope(token);
+    rowScaleBy[slot]
+      = formula.createRow(oddPower, nLimit, rowNum, rows[slot]);
+  });
+}
+
+/**
+ * The first coefficient comes from the first row.  Each later one takes
+ * the next row, eliminates its pivot column from the first row and reads the
+ * coefficient off the augmented column.
+ */
+bool FaulhaberPowerSum :: Generator :: next(mpq_class & coeff) {
+  if (finished) {
+    return false;
+  }
+  if (!started) {
+    started = true;
+    coeff = mpq_class(firstRow.back(), scaleBy);
+    return true;
+  }
+  if (rowNum < 1) {
+    finish();
+    return false;
+  }
+  CancellationToken::checkCurrent();
+  // Reinitialize the augmented column
+  firstRow.back() = 0;
+  mpz_class pivotInFirst = firstRow[pivotIndex];
+  if (pivotInFirst == 0) {
+    // Once we reach a 0, all other columns will be zero.  This means all
+    // other coefficients will be zero
+    finish();
+    return false;
+  }
+  if (pool != NULL) {
+    rowCreated.get();
+    nextRow.swap(rows[current]);
+    nextScaleBy = rowScaleBy[current];
+    if (rowNum > 1) {
+      current = 1 - current;
+      createRowInPool(rowNum - 1, current);
     }
+  } else {
     nextRow.clear();
-    if (oddPower) {
-      nextScaleBy = createRowForOddPower(nLimit, i, nextRow);
-    } else {
-      nextScaleBy = createRowForEvenPower(nLimit, i, nextRow);
-    }
-    scaleBy *= nextScaleBy;
+    nextScaleBy = formula.createRow(oddPower, nLimit, rowNum, nextRow);
+  }
+  scaleBy *= nextScaleBy;
+  TraceScope trace("Faulhaber elimination");
+
+  // Get the value in the pivot column in the next row
+  mpz_class pivotInNext = nextRow[pivotIndex];
 
-    // Get the value in the pivot column in the next row
-    mpz_class pivotInNext = nextRow[pivotIndex];
- 
-    // Multiply rest of the columns that follow the pivot in the first row by
-    // next pivot column and the next row by pivot and subtract from first
+  // Multiply rest of the columns that follow the pivot in the first row by
+  // next pivot column and the next row by pivot and subtract from first
+  size_t numColumns = nextRow.size() - pivotIndex - 1;
+  if (pool != NULL && numColumns >= PARALLEL_MIN_COLUMNS) {
+    long grain = numColumns/(4*pool->size()) + 1;
+    pool->parallelFor(pivotIndex + 1, nextRow.size(), grain,
+                      [&](long begin, long end) {
+      // Runs on the threads of the pool, which stop at the token too
+      CancellationScope scope(token);
+      CancellationToken::checkCurrent();
+      for (long j = begin; j < end; j++) {
+        firstRow[j] *= pivotInNext;
+        firstRow[j] -= pivotInFirst*nextRow[j];
+      }
+    });
+  } else {
     for (size_t j = pivotIndex + 1; j < nextRow.size(); j++) {
       firstRow[j] *= pivotInNext;
       firstRow[j] -= pivotInFirst*nextRow[j];
     }
-    mpq_class coeff = mpq_class(firstRow.back(), scaleBy);
+  }
+  coeff = mpq_class(firstRow.back(), scaleBy);
+  {
+    TraceScope canonicalizeTrace("Faulhaber canonicalization");
     coeff.canonicalize();
-    coefficients.push_back(coeff);
-    pivotIndex++;
   }
+  pivotIndex++;
+  rowNum--;
+  return true;
+}
+
+void FaulhaberPowerSum :: Generator :: finish() {
+  finished = true;
+  // A row may still be in the making if the elimination ended early
+  if (rowCreated.valid()) {
+    rowCreated.wait();
+  }
+}
+
+/**
+ * The row in the making refers to the members, so it has to be done before
+ * they go, also when next was left by an exception
+ */
+FaulhaberPowerSum :: Generator :: ~Generator() {
+  if (rowCreated.valid()) {
+    rowCreated.wait();
+  }
+}
 
+std::unique_ptr<CoefficientGenerator> FaulhaberPowerSum :: createGenerator(
+                                                             long power) {
+  return std::unique_ptr<CoefficientGenerator>(new Generator(*this, power));
+}
+
+vector<mpq_class> FaulhaberPowerSum :: getCoefficients(long power) {
+  checkMemoryLimit(predictMemory(power, power));
+  vector<mpq_class> coefficients;
+  Generator generator(*this, power);
+  mpq_class coeff;
+  while (generator.next(coeff)) {
+    coefficients.push_back(coeff);
+  }
   return coefficients;
 }
 
@@ -118,59 +241,145 @@ void FaulhaberPowerSum :: printSumFormula(long power, ostream &out) {
   }
 }
 
-mpz_class FaulhaberPowerSum :: computeSumWithTimeStat(long power, long n, 
-                                                      vector<long> & stat) {
-  struct timespec before;
-  struct timespec after;
-
-  stat.clear();
-  mpq_class sum = 0;
+/**
+ * The polynomial in N is built up by Horner's rule as the generator hands
+ * out the coefficients, highest power of N first, so the coefficients are
+ * never all held at once
+ */
+mpz_class FaulhaberPowerSum :: computeSumWithStats(long power, long n,
+                                                   PowerSumStats & stats) {
+  checkMemoryLimit(predictMemory(power, n));
+  PowerSumStatsRecorder recorder(stats);
+  mpz_class sum = 0;
 
   if (power < 0 || n < 0) {
-    stat.push_back(0);
-    stat.push_back(0);
-    return sum.get_num();
+    recorder.finish(sum);
+    return sum;
   }
 
   if (power > 0) {
-    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &before);
-    vector<mpq_class> coeffs = getCoefficients(power);
-    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &after);
-    stat.push_back(computeCpuTime(before, after));
-    if (n > 0) {
-      clock_gettime(CLOCK_THREAD_CPUTIME_ID, &before);
-      mpz_class N = n;
-      N *= (n + 1); // To avoid overflow in long, do the multiplication in mpz
-      mpz_class NPow = N;
-      // For odd powers, the first term starts with N^2.  There is no N term
-      if ((power & 1) == 1) {
-        NPow *= N;
-      }
-      long coeffSize = (long)coeffs.size();
-      for (long i = coeffSize - 1; i >= 0; i--) {
-        sum += coeffs[i]*NPow;
-        NPow *= N;
-      }
-      sum /= 2;
-      if ((power & 1) == 0) {
-        sum *= (2*n + 1);
-      }
+    recorder.startPhase();
+    mpz_class N = n;
+    N *= (n + 1); // To avoid overflow in long, do the multiplication in mpz
+    HornerAccumulator polynomial(N);
+    Generator generator(*this, power);
+    recorder.endPhase(stats.init);
 
+    recorder.startPhase();
+    mpq_class coeff;
+    while (generator.next(coeff)) {
+      recorder.recordCoefficient(coeff);
+      polynomial.add(coeff);
+    }
+    // The last coefficient goes with N^2 for odd powers and N otherwise
+    polynomial.addZero();
+    if ((power & 1) == 1) {
+      polynomial.addZero();
+    }
+    mpq_class value = polynomial.getValue();
+    value /= 2;
+    if ((power & 1) == 0) {
+      value *= (2*n + 1);
     }
-      
+    sum = value.get_num();
+    stats.bigMultiplications += polynomial.getMultiplications();
   } else {
-    stat.push_back(0);
-    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &before);
+    recorder.startPhase();
     sum = n + 1;
   }
-  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &after);
-  stat.push_back(computeCpuTime(before, after));
+  recorder.endPhase(stats.sum);
+  recorder.finish(sum);
+  return sum;
+}
+
+mpz_class FaulhaberPowerSum :: computeSumUsingCoefficients(
+                                 const CoefficientArray & coeffs, long power,
+                                 long n) {
+  checkMemoryLimit(predictMemory(power, n));
+  if (power < 0 || n < 0) {
+    return 0;
+  }
+  if (power == 0) {
+    return n + 1;
+  }
+  if (n == 0) {
+    return 0;
+  }
+  long multiplications = 0;
+  return evaluateSum(coeffs, power, n, multiplications);
+}
+
+/**
+ * Evaluate the sum formula for power > 0 and n > 0
+ */
+mpz_class FaulhaberPowerSum :: evaluateSum(const CoefficientArray & coeffs,
+                                           long power, long n,
+                                           long & multiplications) {
+  TraceScope trace("Faulhaber summation");
+  mpz_class N = n;
+  N *= (n + 1); // To avoid overflow in long, do the multiplication in mpz
+  // The sum is a polynomial in N.  For odd powers, the first term starts
+  // with N^2.  There is no N term
+  long firstExponent = ((power & 1) == 1) ? 2 : 1;
+  long coeffSize = (long)coeffs.size();
+  CoefficientArray poly;
+  mpz_class zero = 0;
+  for (long e = 0; e < firstExponent; e++) {
+    poly.append(zero);
+  }
+  for (long i = coeffSize - 1; i >= 0; i--) {
+    poly.append(coeffs.rational(i));
+  }
+  mpq_class sum = evaluatePolynomial(poly, N, multiplications);
+  sum /= 2;
+  if ((power & 1) == 0) {
+    sum *= (2*n + 1);
+  }
   return sum.get_num();
 }
 
+/**
+ * The generator holds the first row, whose entries start as binomials below
+ * 2^power and gain the bits of a pivot, at most log2(power + 1), with every
+ * row eliminated, and up to three rows in the making.  The summation holds
+ * one coefficient at a time, bounded like Binom((power + 1), 2j)B(2j), and
+ * its copy in the generator, along with the value of the polynomial.
+ */
+double FaulhaberPowerSum :: predictMemory(long power, long n) {
+  if (power <= 0 || n < 0) {
+    return 0;
+  }
+  long nLimit = (power & 1) ? (power + 1)/2 : power/2 + 1;
+  double pivotBits = log2(power + 1.0);
+  double elimination = (nLimit + 1)*(numberBytes(power + nLimit*pivotBits)
+                                     + 3*numberBytes(power))
+                       + numberBytes(nLimit*pivotBits);
+  double coefficient = 0;
+  for (long j = 0; j <= nLimit; j++) {
+    double bytes = numberBytes(log2Bernoulli(2*j) + log2nCr(power + 1, 2*j))
+                   + numberBytes(2*j + 1);
+    if (bytes > coefficient) {
+      coefficient = bytes;
+    }
+  }
+  double sumBits = log2Sum(power, n) + 2*nLimit + 1;
+  return elimination + 2*coefficient + 3*numberBytes(sumBits);
+}
+
 FaulhaberPowerSum :: ~FaulhaberPowerSum() {
 }
 
+mpz_class FaulhaberPowerSum :: createRow(bool oddPower, long nLimit,
+                                         long rowNum,
+                                         vector<mpz_class> & row) {
+  CancellationToken::checkCurrent();
+  TraceScope trace("Faulhaber row");
+  if (oddPower) {
+    return createRowForOddPower(nLimit, rowNum, row);
+  }
+  return createRowForEvenPower(nLimit, rowNum, row);
+}
+
 /**
  * Reverse the row and return the first non-zero column value
  */
@@ -7,17 +7,32 @@ class FaulhaberPowerSum : public PowerSum {
   public:
     FaulhaberPowerSum();
     virtual vector<mpq_class> getCoefficients(long power);
+    using PowerSum::getCoefficients;
+    virtual std::unique_ptr<CoefficientGenerator> createGenerator(long power);
     virtual void printSumFormula(long power, ostream &out);
-    virtual mpz_class computeSumWithTimeStat(long power, long n,
-                                             vector<long> & stat);
+    virtual mpz_class computeSumWithStats(long power, long n,
+                                          PowerSumStats & stats);
+    virtual mpz_class computeSumUsingCoefficients(
+                        const CoefficientArray & coeffs, long power,
+                        long n);
+    virtual double predictMemory(long power, long n);
     virtual ~FaulhaberPowerSum();
 
-  private:
+  protected:
+    // Kernels, timed on their own by KernelBench
     mpz_class postProcessRow(vector<mpz_class> & row);
     mpz_class createRowForEvenPower(long nLimit, long rowNum,
                                     vector<mpz_class> & row);
     mpz_class createRowForOddPower(long nLimit, long rowNum,
                                    vector<mpz_class> & row);
+
+  private:
+    class Generator;
+
+    mpz_class evaluateSum(const CoefficientArray & coeffs, long power,
+                          long n, long & multiplications);
+    mpz_class createRow(bool oddPower, long nLimit, long rowNum,
+                        vector<mpz_class> & row);
 };
 
 #endif
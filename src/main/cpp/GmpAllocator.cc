@@ -0,0 +1,342 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gmp.h>
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "GmpAllocator.h"
+
+using std::atomic;
+using std::memory_order_relaxed;
+using std::mutex;
+using std::unique_lock;
+using std::vector;
+
+// Smallest block handed out.  Size class c holds blocks of
+// MIN_BLOCK_SIZE << c bytes
+static const size_t MIN_BLOCK_SIZE = 16;
+static const int NUM_SIZE_CLASSES = 13; // Up to 64 KB
+static const size_t MAX_POOLED_SIZE = MIN_BLOCK_SIZE << (NUM_SIZE_CLASSES - 1);
+
+// Bytes of free blocks a thread keeps in one size class.  Blocks freed
+// beyond this go back to malloc.
+static const size_t MAX_POOL_BYTES = 1 << 20;
+
+static atomic<bool> installed(false);
+
+// False if the counting allocator was installed, in which case every block
+// goes to malloc.  Set before GMP numbers exist and never changed.
+static bool pooling = true;
+
+// Bytes held by live GMP numbers of all threads and the most held at once
+static atomic<long> totalInUse(0);
+static atomic<long> peakInUse(0);
+
+// Peaks followed from the start of a tracker.  A slot is claimed before its
+// start and peak are set and only followed once it is active.
+struct PeakTracker {
+  atomic<bool> claimed;
+  atomic<bool> active;
+  atomic<long> start;
+  atomic<long> peak;
+};
+static const int MAX_PEAK_TRACKERS = 64;
+static PeakTracker peakTrackers[MAX_PEAK_TRACKERS];
+static atomic<int> numPeakTrackers(0);
+
+static void raisePeak(atomic<long> & peak, long value) {
+  long current = peak.load(memory_order_relaxed);
+  while (value > current
+         && !peak.compare_exchange_weak(current, value,
+                                        memory_order_relaxed)) {
+  }
+}
+
+// Size class of a block or NUM_SIZE_CLASSES if it is not pooled
+static int sizeClass(size_t size) {
+  if (size > MAX_POOLED_SIZE) {
+    return NUM_SIZE_CLASSES;
+  }
+  int c = 0;
+  while ((MIN_BLOCK_SIZE << c) < size) {
+    c++;
+  }
+  return c;
+}
+
+// Counters of one thread.  Only the thread itself updates them, so relaxed
+// atomics are enough to let getStats read them from another thread.
+struct ThreadCounters {
+  atomic<long> allocations;
+  atomic<long> reallocations;
+  atomic<long> frees;
+  atomic<long> poolHits;
+  atomic<long> bytesAllocated;
+  atomic<long> bytesInUse;
+
+  ThreadCounters() : allocations(0), reallocations(0), frees(0), poolHits(0),
+                     bytesAllocated(0), bytesInUse(0) {}
+};
+
+static void add(atomic<long> & counter, long value) {
+  counter.store(counter.load(memory_order_relaxed) + value,
+                memory_order_relaxed);
+}
+
+static void trackInUse(long change) {
+  long inUse = totalInUse.fetch_add(change, memory_order_relaxed) + change;
+  if (change <= 0) {
+    return;
+  }
+  raisePeak(peakInUse, inUse);
+  if (numPeakTrackers.load(memory_order_relaxed) == 0) {
+    return;
+  }
+  for (int t = 0; t < MAX_PEAK_TRACKERS; t++) {
+    if (peakTrackers[t].active.load(memory_order_relaxed)) {
+      raisePeak(peakTrackers[t].peak, inUse);
+    }
+  }
+}
+
+// Pools and counters of the threads alive and the counts of threads gone
+static mutex registryLock;
+static vector<ThreadCounters *> liveCounters;
+static GmpAllocatorStats retiredStats;
+
+struct ThreadPools {
+  vector<void *> blocks[NUM_SIZE_CLASSES];
+  ThreadCounters counters;
+
+  ThreadPools();
+  ~ThreadPools();
+};
+
+// 0 before the pools of the thread are created, 1 while they exist and 2
+// once they are destroyed.  GMP numbers freed by destructors of other
+// thread locals may come after the pools are gone.
+static thread_local int poolState = 0;
+static thread_local ThreadPools * threadPools = NULL;
+
+ThreadPools :: ThreadPools() {
+  unique_lock<mutex> guard(registryLock);
+  liveCounters.push_back(&counters);
+}
+
+ThreadPools :: ~ThreadPools() {
+  for (int c = 0; c < NUM_SIZE_CLASSES; c++) {
+    for (size_t i = 0; i < blocks[c].size(); i++) {
+      free(blocks[c][i]);
+    }
+  }
+  poolState = 2;
+  threadPools = NULL;
+
+  unique_lock<mutex> guard(registryLock);
+  for (size_t i = 0; i < liveCounters.size(); i++) {
+    if (liveCounters[i] == &counters) {
+      liveCounters.erase(liveCounters.begin() + i);
+      break;
+    }
+  }
+  retiredStats.allocations += counters.allocations;
+  retiredStats.reallocations += counters.reallocations;
+  retiredStats.frees += counters.frees;
+  retiredStats.poolHits += counters.poolHits;
+  retiredStats.bytesAllocated += counters.bytesAllocated;
+  retiredStats.bytesInUse += counters.bytesInUse;
+}
+
+static ThreadPools * getPools() {
+  if (poolState == 0) {
+    // Constructed on first use and destroyed when the thread exits
+    static thread_local ThreadPools pools;
+    threadPools = &pools;
+    poolState = 1;
+  }
+  return threadPools;
+}
+
+static void * allocateBlock(size_t size) {
+  void * block = malloc(size);
+  if (block == NULL) {
+    // GMP has no way to recover from running out of memory
+    fprintf(stderr, "GMP allocation of %lu bytes failed\n",
+            (unsigned long)size);
+    abort();
+  }
+  return block;
+}
+
+static void * reallocateBlock(void * block, size_t newSize) {
+  void * moved = realloc(block, newSize);
+  if (moved == NULL) {
+    fprintf(stderr, "GMP reallocation to %lu bytes failed\n",
+            (unsigned long)newSize);
+    abort();
+  }
+  return moved;
+}
+
+static void * allocate(size_t size) {
+  ThreadPools * pools = getPools();
+  int c = pooling ? sizeClass(size) : NUM_SIZE_CLASSES;
+  if (pools == NULL) {
+    return allocateBlock(c < NUM_SIZE_CLASSES ? MIN_BLOCK_SIZE << c : size);
+  }
+
+  add(pools->counters.allocations, 1);
+  add(pools->counters.bytesAllocated, (long)size);
+  add(pools->counters.bytesInUse, (long)size);
+  trackInUse((long)size);
+  if (c == NUM_SIZE_CLASSES) {
+    return allocateBlock(size);
+  }
+  if (!pools->blocks[c].empty()) {
+    void * block = pools->blocks[c].back();
+    pools->blocks[c].pop_back();
+    add(pools->counters.poolHits, 1);
+    return block;
+  }
+  return allocateBlock(MIN_BLOCK_SIZE << c);
+}
+
+static void deallocate(void * block, size_t size) {
+  ThreadPools * pools = getPools();
+  int c = pooling ? sizeClass(size) : NUM_SIZE_CLASSES;
+  if (pools == NULL) {
+    free(block);
+    return;
+  }
+
+  add(pools->counters.frees, 1);
+  add(pools->counters.bytesInUse, -(long)size);
+  trackInUse(-(long)size);
+  if (c < NUM_SIZE_CLASSES
+      && pools->blocks[c].size() < MAX_POOL_BYTES/(MIN_BLOCK_SIZE << c)) {
+    pools->blocks[c].push_back(block);
+  } else {
+    free(block);
+  }
+}
+
+/**
+ * A block that stays in its size class is already big enough, which is the
+ * common case of a number growing by a limb or two
+ */
+static void * reallocate(void * block, size_t oldSize, size_t newSize) {
+  int oldClass = pooling ? sizeClass(oldSize) : NUM_SIZE_CLASSES;
+  int newClass = pooling ? sizeClass(newSize) : NUM_SIZE_CLASSES;
+  ThreadPools * pools = getPools();
+  if (pools != NULL) {
+    add(pools->counters.reallocations, 1);
+    if (newSize > oldSize) {
+      add(pools->counters.bytesAllocated, (long)(newSize - oldSize));
+    }
+    add(pools->counters.bytesInUse, (long)newSize - (long)oldSize);
+    trackInUse((long)newSize - (long)oldSize);
+  }
+
+  if (oldClass == newClass && oldClass < NUM_SIZE_CLASSES) {
+    return block;
+  }
+  if (oldClass == NUM_SIZE_CLASSES && newClass == NUM_SIZE_CLASSES) {
+    return reallocateBlock(block, newSize);
+  }
+
+  // Moving between classes.  The counts were updated above, so the copy is
+  // made with the counters of a block that is neither allocated nor freed.
+  void * moved;
+  if (newClass < NUM_SIZE_CLASSES && pools != NULL
+      && !pools->blocks[newClass].empty()) {
+    moved = pools->blocks[newClass].back();
+    pools->blocks[newClass].pop_back();
+    add(pools->counters.poolHits, 1);
+  } else {
+    moved = allocateBlock(newClass < NUM_SIZE_CLASSES ?
+                          MIN_BLOCK_SIZE << newClass : newSize);
+  }
+  memcpy(moved, block, oldSize < newSize ? oldSize : newSize);
+  if (oldClass < NUM_SIZE_CLASSES && pools != NULL
+      && pools->blocks[oldClass].size()
+         < MAX_POOL_BYTES/(MIN_BLOCK_SIZE << oldClass)) {
+    pools->blocks[oldClass].push_back(block);
+  } else {
+    free(block);
+  }
+  return moved;
+}
+
+void GmpAllocator :: install() {
+  if (installed.exchange(true)) {
+    return;
+  }
+  mp_set_memory_functions(allocate, reallocate, deallocate);
+}
+
+void GmpAllocator :: installCounting() {
+  if (installed.exchange(true)) {
+    return;
+  }
+  pooling = false;
+  mp_set_memory_functions(allocate, reallocate, deallocate);
+}
+
+bool GmpAllocator :: isInstalled() {
+  return installed;
+}
+
+GmpAllocatorStats GmpAllocator :: getStats() {
+  unique_lock<mutex> guard(registryLock);
+  GmpAllocatorStats stats = retiredStats;
+  for (size_t i = 0; i < liveCounters.size(); i++) {
+    stats.allocations += liveCounters[i]->allocations;
+    stats.reallocations += liveCounters[i]->reallocations;
+    stats.frees += liveCounters[i]->frees;
+    stats.poolHits += liveCounters[i]->poolHits;
+    stats.bytesAllocated += liveCounters[i]->bytesAllocated;
+    stats.bytesInUse += liveCounters[i]->bytesInUse;
+  }
+  stats.peakBytesInUse = peakInUse.load(memory_order_relaxed);
+  return stats;
+}
+
+void GmpAllocator :: trackBytes(long change) {
+  if (installed) {
+    trackInUse(change);
+  }
+}
+
+int GmpAllocator :: startPeakTracking() {
+  if (!installed) {
+    return -1;
+  }
+  for (int t = 0; t < MAX_PEAK_TRACKERS; t++) {
+    bool unclaimed = false;
+    if (peakTrackers[t].claimed.compare_exchange_strong(unclaimed, true)) {
+      long inUse = totalInUse.load();
+      peakTrackers[t].start = inUse;
+      peakTrackers[t].peak = inUse;
+      numPeakTrackers++;
+      peakTrackers[t].active = true;
+      return t;
+    }
+  }
+  return -1;
+}
+
+long GmpAllocator :: stopPeakTracking(int tracker) {
+  if (tracker < 0 || tracker >= MAX_PEAK_TRACKERS) {
+    return -1;
+  }
+  PeakTracker & t = peakTrackers[tracker];
+  t.active = false;
+  numPeakTrackers--;
+  long peak = t.peak - t.start;
+  t.claimed = false;
+  return peak;
+}
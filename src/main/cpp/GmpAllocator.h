@@ -0,0 +1,125 @@
+#ifndef GMP_ALLOCATOR_H
+#define GMP_ALLOCATOR_H
+
+#include <stddef.h>
+
+#include <new>
+
+/* Counts of the calls GMP made to the allocator */
+struct GmpAllocatorStats {
+  long allocations;    // Calls to allocate
+  long reallocations;  // Calls to reallocate
+  long frees;          // Calls to free
+  long poolHits;       // Blocks handed out again from a pool of a thread
+  long bytesAllocated; // Total bytes asked for by allocations and growth
+  long bytesInUse;     // Bytes held by live GMP numbers
+  long peakBytesInUse; // Most bytes held at once by GMP numbers and the
+                       // buffers counted by trackBytes
+};
+
+/* Memory functions for GMP that keep freed blocks in pools of the thread
+ * that freed them instead of handing them back to malloc.  Blocks are
+ * rounded up to a power of two (size classes from 16 bytes to 64 KB) so that
+ * a block freed by one number fits the next number of the same class, and a
+ * number growing within its class is reallocated in place.  Larger blocks go
+ * straight to malloc.  A thread only touches its own pools, so threads never
+ * wait for one another.  Pools are released when their thread exits.  The
+ * bytes held by all threads are also added up in one shared counter to
+ * follow their peak, which peak trackers follow from their own start.
+ */
+class GmpAllocator {
+  public:
+    /* To make GMP use the allocator.  Must be called before any GMP number
+     * is created since blocks allocated by malloc cannot be told apart from
+     * pooled blocks when they are freed.  Cannot be undone.  Does nothing if
+     * already installed.
+     */
+    static void install();
+
+    /* To make GMP use malloc through functions that only count the calls
+     * and the bytes held, for getStats, without keeping pools.  Must be
+     * called before any GMP number is created.  Does nothing if either
+     * allocator is already installed.
+     */
+    static void installCounting();
+
+    /* To find out if the allocator is in use
+     * Return value
+     *   true if install has been called
+     */
+    static bool isInstalled();
+
+    /* To get the counts of allocator calls made so far by all threads
+     * Return value
+     *   counts summed over all threads, including threads that have exited
+     */
+    static GmpAllocatorStats getStats();
+
+    /* To count memory that holds numbers outside of GMP, such as packed
+     * coefficients, in the bytes held and their peaks.  Does nothing if the
+     * allocator is not installed.
+     * Parameters:
+     *   change - bytes allocated, or freed if negative (IN)
+     */
+    static void trackBytes(long change);
+
+    /* To start following the most bytes held from now on.  Trackers are
+     * independent of each other, but each sees the bytes held by all
+     * threads, so computations running at the same time add to each
+     * other's peaks.
+     * Return value
+     *   tracker to pass to stopPeakTracking, or -1 if the allocator is not
+     *   installed or too many trackers are in use
+     */
+    static int startPeakTracking();
+
+    /* To stop a tracker
+     * Parameters:
+     *   tracker - tracker returned by startPeakTracking (IN)
+     * Return value
+     *   most bytes held at once since the start above those held at the
+     *   start, or -1 for tracker -1
+     */
+    static long stopPeakTracking(int tracker);
+
+  private:
+    GmpAllocator();
+};
+
+/* Allocator for standard containers whose bytes are counted by
+ * GmpAllocator::trackBytes
+ */
+template<class T>
+class GmpTrackedAllocator {
+  public:
+    typedef T value_type;
+
+    GmpTrackedAllocator() {}
+    template<class U>
+    GmpTrackedAllocator(const GmpTrackedAllocator<U> &) {}
+
+    T * allocate(size_t count) {
+      T * block = static_cast<T *>(::operator new(count*sizeof(T)));
+      GmpAllocator::trackBytes((long)(count*sizeof(T)));
+      return block;
+    }
+
+    void deallocate(T * block, size_t count) {
+      GmpAllocator::trackBytes(-(long)(count*sizeof(T)));
+      ::operator delete(block);
+    }
+};
+
+template<class T, class U>
+bool operator==(const GmpTrackedAllocator<T> &,
+                const GmpTrackedAllocator<U> &) {
+  return true;
+}
+
+template<class T, class U>
+bool operator!=(const GmpTrackedAllocator<T> &,
+                const GmpTrackedAllocator<U> &) {
+  return false;
+}
+
+#endif
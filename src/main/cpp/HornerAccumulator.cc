@@ -0,0 +1,51 @@
+#include "HornerAccumulator.h"
+#include "Trace.h"
+
+HornerAccumulator :: HornerAccumulator(const mpz_class & x)
+                   : x(x), numerator(0), denominator(1),
+                     multiplications(0) {
+}
+
+/**
+ * With a/d the value so far and p/q the coefficient, the common denominator
+ * becomes d' = lcm(d, q) and the numerator a*x*(d'/d) + p*(d'/q).  Most
+ * denominators of the formulas divide the common one already, so d' = d.
+ */
+void HornerAccumulator :: add(const mpq_class & coeff) {
+  TraceScope trace("Horner step");
+  mpz_srcptr q = coeff.get_den_mpz_t();
+  mpz_ptr a = numerator.get_mpz_t();
+  mpz_ptr d = denominator.get_mpz_t();
+  mpz_ptr s = scale.get_mpz_t();
+
+  mpz_mul(a, a, x.get_mpz_t());
+  if (mpz_divisible_p(d, q)) {
+    mpz_divexact(s, d, q);
+  } else {
+    // Raise d to lcm(d, q) = d*(q/gcd(d, q)) and the numerator with it
+    mpz_gcd(s, d, q);
+    mpz_divexact(s, q, s);
+    mpz_mul(a, a, s);
+    mpz_mul(d, d, s);
+    mpz_divexact(s, d, q);
+    multiplications += 2;
+  }
+  mpz_addmul(a, coeff.get_num_mpz_t(), s);
+  multiplications += 2;
+}
+
+void HornerAccumulator :: addZero() {
+  numerator *= x;
+  multiplications++;
+}
+
+long HornerAccumulator :: getMultiplications() const {
+  return multiplications;
+}
+
+mpq_class HornerAccumulator :: getValue() {
+  TraceScope trace("Horner canonicalization");
+  mpq_class value(numerator, denominator);
+  value.canonicalize();
+  return value;
+}
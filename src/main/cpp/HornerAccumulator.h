@@ -0,0 +1,50 @@
+#ifndef HORNER_ACCUMULATOR_H
+#define HORNER_ACCUMULATOR_H
+
+#include <gmpxx.h>
+
+/* Evaluates a polynomial at a point by Horner's rule while its coefficients
+ * arrive, highest power first.  The value is kept as an integer over the
+ * least common multiple of the denominators seen so far, so each step is an
+ * integer multiply-add.  Only small denominators are multiplied into the
+ * common one, and the fraction is reduced once at the end.
+ */
+class HornerAccumulator {
+  public:
+    /* To start a polynomial with value 0
+     * Parameters:
+     *   x - point at which the polynomial is evaluated (IN)
+     */
+    HornerAccumulator(const mpz_class & x);
+
+    /* To add the next coefficient: value = value*x + coeff
+     * Parameters:
+     *   coeff - coefficient of the next lower power (IN)
+     */
+    void add(const mpq_class & coeff);
+
+    /* To add a coefficient of 0: value = value*x */
+    void addZero();
+
+    /* To get the value of the polynomial
+     * Return value
+     *   value in canonical form
+     */
+    mpq_class getValue();
+
+    /* To get the number of multiplications of two multi-precision numbers
+     * done so far
+     * Return value
+     *   number of multiplications
+     */
+    long getMultiplications() const;
+
+  private:
+    mpz_class x;
+    mpz_class numerator;
+    mpz_class denominator;
+    mpz_class scale;
+    long multiplications;
+};
+
+#endif
@@ -0,0 +1,538 @@
+/* Benchmark of the kernels the formulas are built from, each timed on its
+ * own: nCr, the rows of the Faulhaber matrix and their post-processing, the
+ * next Bernoulli number and the recurrences of the Stirling, Euler and
+ * Central Factorial numbers.  Every kernel is run over a sweep of sizes, the
+ * power for the formulas and n of nCr(n, n/2).
+ *
+ * A sample runs a kernel enough times back to back to last at least the
+ * minimum sample time, so that the clock resolution does not matter for fast
+ * kernels.  After the warm-up samples, the measured samples outside the
+ * Tukey fences [Q1 - 1.5 IQR, Q3 + 1.5 IQR] are rejected as outliers and the
+ * rest summarized as thread CPU time per call in nanoseconds.  The process
+ * can be pinned to one CPU to keep it from migrating between samples.
+ *
+ * Usage: KernelBench [<options>]
+ */
+#include <math.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include <algorithm>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "BernoulliPowerSum.h"
+#include "CentralFactorialPowerSum.h"
+#include "EulerPowerSum.h"
+#include "FaulhaberPowerSum.h"
+#include "StirlingPowerSum.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::function;
+using std::invalid_argument;
+using std::istringstream;
+using std::setw;
+using std::stol;
+using std::string;
+using std::vector;
+
+static const long DEFAULT_SIZES[] = {100, 250, 500, 1000, 2000, 4000};
+
+// Samples are not made longer by running a kernel more often than this
+static const long MAX_CALLS_PER_SAMPLE = 1000000;
+
+enum OutputFormat {
+  FORMAT_TEXT,
+  FORMAT_CSV,
+  FORMAT_JSON
+};
+
+// A kernel is run as run(calls) after prepare(size, calls) has set up the
+// input of that many calls.  Only run is timed.
+struct Kernel {
+  const char * name;
+  function<void(long, long)> prepare;
+  function<void(long)> run;
+};
+
+// Statistics of the samples left after rejecting outliers, per call
+struct Summary {
+  double median;
+  double mean;
+  double stddev;
+  double min;
+  double max;
+  size_t kept;
+  size_t rejected;
+};
+
+// The formulas keep their kernels protected.  These make them public.
+class FaulhaberKernels : public FaulhaberPowerSum {
+  public:
+    using PowerSum::nCr;
+    using FaulhaberPowerSum::createRowForEvenPower;
+    using FaulhaberPowerSum::createRowForOddPower;
+    using FaulhaberPowerSum::postProcessRow;
+};
+
+class BernoulliKernels : public BernoulliPowerSum {
+  public:
+    using BernoulliPowerSum::computeNextCoefficient;
+};
+
+class StirlingKernels : public StirlingPowerSum {
+  public:
+    using StirlingPowerSum::getCoefficients;
+};
+
+class EulerKernels : public EulerPowerSum {
+  public:
+    using EulerPowerSum::getCoefficients;
+};
+
+class CentralFactorialKernels : public CentralFactorialPowerSum {
+  public:
+    using CentralFactorialPowerSum::getCoefficients;
+};
+
+// Kernels of the formulas
+class KernelBench {
+  public:
+    KernelBench();
+
+    vector<Kernel> kernels;
+
+  private:
+    void prepareFaulhaberRows(long power, long calls);
+
+    FaulhaberKernels fps;
+    BernoulliKernels bps;
+    StirlingKernels sps;
+    EulerKernels eps;
+    CentralFactorialKernels cps;
+
+    long size;
+    long nLimit;
+    vector<vector<mpz_class> > rows;  // Input or output row of each call
+    long bernoulliSize;
+    vector<mpq_class> bernoulli;      // B(0) ... B(size - 1)
+    mpz_class result;
+    mpq_class rationalResult;
+};
+
+static void usage(const string & commandName) {
+  cerr << "Usage: " << commandName << " [<options>]" << endl << endl
+  << "Options:" << endl
+  << "--kernels <name>[,<name>...]" << endl
+  << "    Kernels to run (default all): nCr, faulhaber-even-row,"
+  << endl
+  << "    faulhaber-odd-row, faulhaber-postprocess, bernoulli-next,"
+  << endl
+  << "    stirling-recurrence, euler-recurrence, central-recurrence" << endl
+  << "--sizes <size>[,<size>...]" << endl
+  << "    Powers, or n of nCr(n, n/2) (default 100,250,500,1000,2000,4000)"
+  << endl
+  << "--repetitions <count>" << endl
+  << "    Measured samples per kernel and size (default 11)" << endl
+  << "--warmup <count>" << endl
+  << "    Samples per kernel and size before measuring (default 2)" << endl
+  << "--min-time <microseconds>" << endl
+  << "    Minimum time of a sample (default 1000)" << endl
+  << "--cpu <number>" << endl
+  << "    Pin the benchmark to this CPU (default not pinned)" << endl
+  << "--format (text|csv|json)" << endl
+  << "    Output format (default text)" << endl;
+}
+
+static void error(const string & commandName, const string & message) {
+  cerr << message << endl;
+  usage(commandName);
+  exit(EXIT_FAILURE);
+}
+
+static vector<long> parseSizes(const string & commandName,
+                               const string & value) {
+  vector<long> list;
+  istringstream in(value);
+  string item;
+  while (std::getline(in, item, ',')) {
+    try {
+      size_t used;
+      long number = stol(item, &used);
+      if (used != item.size() || number < 2) {
+        throw invalid_argument("");
+      }
+      list.push_back(number);
+    } catch(...) {
+      error(commandName, "Invalid list: " + value);
+    }
+  }
+  if (list.empty()) {
+    error(commandName, "Invalid list: " + value);
+  }
+  return list;
+}
+
+static bool pinToCpu(int cpu) {
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+  return false;
+#endif
+}
+
+/**
+ * The kernels that make a Faulhaber row take the largest row of the matrix
+ * for the power, which is the first one the generator creates
+ */
+void KernelBench :: prepareFaulhaberRows(long power, long calls) {
+  nLimit = (power & 1) ? (power + 1)/2 : power/2 + 1;
+  rows.assign(calls, vector<mpz_class>());
+}
+
+KernelBench :: KernelBench() : size(0), nLimit(0),
+                               bernoulliSize(-1) {
+  Kernel nCr = {"nCr",
+    [this](long n, long) { size = n; },
+    [this](long calls) {
+      for (long c = 0; c < calls; c++) {
+        result = fps.nCr(size, size/2);
+      }
+    }};
+  kernels.push_back(nCr);
+
+  Kernel evenRow = {"faulhaber-even-row",
+    [this](long power, long calls) {
+      prepareFaulhaberRows(power & ~1L, calls);
+    },
+    [this](long calls) {
+      for (long c = 0; c < calls; c++) {
+        result = fps.createRowForEvenPower(nLimit, nLimit, rows[c]);
+      }
+    }};
+  kernels.push_back(evenRow);
+
+  Kernel oddRow = {"faulhaber-odd-row",
+    [this](long power, long calls) {
+      prepareFaulhaberRows(power | 1, calls);
+    },
+    [this](long calls) {
+      for (long c = 0; c < calls; c++) {
+        result = fps.createRowForOddPower(nLimit, nLimit, rows[c]);
+      }
+    }};
+  kernels.push_back(oddRow);
+
+  // postProcessRow reverses the row and appends the augmented column, so
+  // undoing that gives back its input
+  Kernel postProcess = {"faulhaber-postprocess",
+    [this](long power, long calls) {
+      prepareFaulhaberRows(power & ~1L, 1);
+      fps.createRowForEvenPower(nLimit, nLimit, rows[0]);
+      rows[0].pop_back();
+      std::reverse(rows[0].begin(), rows[0].end());
+      rows.resize(calls, rows[0]);
+    },
+    [this](long calls) {
+      for (long c = 0; c < calls; c++) {
+        result = fps.postProcessRow(rows[c]);
+      }
+    }};
+  kernels.push_back(postProcess);
+
+  // B(size) from all the numbers before it, which are worked out once for
+  // every size
+  Kernel bernoulliNext = {"bernoulli-next",
+    [this](long power, long) {
+      size = power & ~1L;
+      if (bernoulliSize != size) {
+        // Only the numbers that are not 0 are passed, as the generator does
+        vector<mpq_class> numbers = bps.getCoefficients(size - 1);
+        bernoulli.clear();
+        for (long i = 0; i < (long)numbers.size(); i++) {
+          if (i < 2 || (i & 1) == 0) {
+            bernoulli.push_back(numbers[i]);
+          }
+        }
+        bernoulliSize = size;
+      }
+    },
+    [this](long calls) {
+      for (long c = 0; c < calls; c++) {
+        rationalResult = bps.computeNextCoefficient(bernoulli, size);
+      }
+    }};
+  kernels.push_back(bernoulliNext);
+
+  Kernel stirling = {"stirling-recurrence",
+    [this](long power, long) { size = power; },
+    [this](long calls) {
+      for (long c = 0; c < calls; c++) {
+        sps.getCoefficients(size, size + 1);
+      }
+    }};
+  kernels.push_back(stirling);
+
+  Kernel euler = {"euler-recurrence",
+    [this](long power, long) { size = power; },
+    [this](long calls) {
+      for (long c = 0; c < calls; c++) {
+        eps.getCoefficients(size, size);
+      }
+    }};
+  kernels.push_back(euler);
+
+  Kernel central = {"central-recurrence",
+    [this](long power, long) { size = power; },
+    [this](long calls) {
+      for (long c = 0; c < calls; c++) {
+        cps.getCoefficients(size, size);
+      }
+    }};
+  kernels.push_back(central);
+}
+
+static long timeSample(Kernel & kernel, long size, long calls) {
+  struct timespec before;
+  struct timespec after;
+  kernel.prepare(size, calls);
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &before);
+  kernel.run(calls);
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &after);
+  return elapsedNano(before, after);
+}
+
+/**
+ * The quartiles are taken by linear interpolation between the closest ranks
+ */
+static double quantile(const vector<double> & sorted, double q) {
+  double position = q*(sorted.size() - 1);
+  size_t below = (size_t)position;
+  if (below + 1 >= sorted.size()) {
+    return sorted.back();
+  }
+  return sorted[below] + (position - below)*(sorted[below + 1] - sorted[below]);
+}
+
+static Summary summarize(vector<double> samples) {
+  std::sort(samples.begin(), samples.end());
+  double q1 = quantile(samples, 0.25);
+  double q3 = quantile(samples, 0.75);
+  double low = q1 - 1.5*(q3 - q1);
+  double high = q3 + 1.5*(q3 - q1);
+  vector<double> kept;
+  for (size_t i = 0; i < samples.size(); i++) {
+    if (samples[i] >= low && samples[i] <= high) {
+      kept.push_back(samples[i]);
+    }
+  }
+
+  Summary summary;
+  size_t count = kept.size();
+  summary.kept = count;
+  summary.rejected = samples.size() - count;
+  summary.min = kept.front();
+  summary.max = kept.back();
+  summary.median = (count & 1) ? kept[count/2]
+                               : (kept[count/2 - 1] + kept[count/2])/2;
+  double sum = 0;
+  for (size_t i = 0; i < count; i++) {
+    sum += kept[i];
+  }
+  summary.mean = sum/count;
+  double squares = 0;
+  for (size_t i = 0; i < count; i++) {
+    squares += (kept[i] - summary.mean)*(kept[i] - summary.mean);
+  }
+  summary.stddev = (count > 1) ? sqrt(squares/(count - 1)) : 0;
+  return summary;
+}
+
+static void printHeader(OutputFormat format, int repetitions, int warmup,
+                        long minTime, int cpu) {
+  if (format == FORMAT_CSV) {
+    cout << "kernel,size,calls_per_sample,kept,rejected,median_ns,mean_ns,"
+         << "stddev_ns,min_ns,max_ns" << endl;
+  } else if (format == FORMAT_JSON) {
+    cout << "{" << endl
+         << "  \"repetitions\": " << repetitions << "," << endl
+         << "  \"warmup\": " << warmup << "," << endl
+         << "  \"min_time_us\": " << minTime << "," << endl
+         << "  \"cpu\": " << cpu << "," << endl
+         << "  \"results\": [";
+  } else {
+    cout << "Repetitions = " << repetitions << ", warm-up = " << warmup
+         << ", min time = " << minTime << " us, cpu = "
+         << (cpu < 0 ? string("any") : std::to_string(cpu))
+         << " (times in ns per call)" << endl
+         << setw(22) << "Kernel" << setw(7) << "Size" << setw(9) << "Calls"
+         << setw(6) << "Out" << setw(15) << "Median" << setw(15) << "Stddev"
+         << setw(15) << "Min" << endl;
+  }
+}
+
+static void printResult(OutputFormat format, bool first, const char * name,
+                        long size, long calls, const Summary & s) {
+  std::ostringstream values[5];
+  double numbers[] = {s.median, s.mean, s.stddev, s.min, s.max};
+  for (int i = 0; i < 5; i++) {
+    values[i] << std::fixed << std::setprecision(1) << numbers[i];
+  }
+  if (format == FORMAT_CSV) {
+    cout << name << ',' << size << ',' << calls << ',' << s.kept << ','
+         << s.rejected;
+    for (int i = 0; i < 5; i++) {
+      cout << ',' << values[i].str();
+    }
+    cout << endl;
+  } else if (format == FORMAT_JSON) {
+    cout << (first ? "" : ",") << endl
+         << "    {\"kernel\": \"" << name << "\", \"size\": " << size
+         << ", \"calls_per_sample\": " << calls << ", \"kept\": " << s.kept
+         << ", \"rejected\": " << s.rejected << ", \"median_ns\": "
+         << values[0].str() << ", \"mean_ns\": " << values[1].str()
+         << ", \"stddev_ns\": " << values[2].str() << ", \"min_ns\": "
+         << values[3].str() << ", \"max_ns\": " << values[4].str() << "}";
+  } else {
+    cout << setw(22) << name << setw(7) << size << setw(9) << calls
+         << setw(6) << s.rejected << setw(15) << values[0].str()
+         << setw(15) << values[2].str() << setw(15) << values[3].str()
+         << endl;
+  }
+}
+
+/**
+ * The number of calls in a sample is found by running the kernel once and
+ * then scaling the number up, at most ten times at a step, until a sample
+ * takes the minimum time.  These samples also warm up the caches.
+ */
+static void benchmark(Kernel & kernel, long size, int warmup,
+                      int repetitions, long minTime, OutputFormat format,
+                      bool first) {
+  long target = minTime*1000;
+  long calls = 1;
+  long time = timeSample(kernel, size, calls);
+  while (time < target && calls < MAX_CALLS_PER_SAMPLE) {
+    long next = (time > 0) ? calls*target/time + 1 : 10*calls;
+    calls = std::min(std::min(next, 10*calls), MAX_CALLS_PER_SAMPLE);
+    time = timeSample(kernel, size, calls);
+  }
+  for (int run = 0; run < warmup; run++) {
+    timeSample(kernel, size, calls);
+  }
+  vector<double> samples;
+  for (int run = 0; run < repetitions; run++) {
+    samples.push_back((double)timeSample(kernel, size, calls)/calls);
+  }
+  printResult(format, first, kernel.name, size, calls, summarize(samples));
+}
+
+int main(int argc, char ** argv) {
+  string commandName = argv[0];
+  vector<long> sizes(DEFAULT_SIZES, DEFAULT_SIZES
+                     + sizeof(DEFAULT_SIZES)/sizeof(DEFAULT_SIZES[0]));
+  vector<string> selected;
+  int repetitions = 11;
+  int warmup = 2;
+  long minTime = 1000;
+  int cpu = -1;
+  OutputFormat format = FORMAT_TEXT;
+
+  for (int i = 1; i < argc; i++) {
+    string option = argv[i];
+    if (option == "-h" || option == "--help") {
+      usage(commandName);
+      return EXIT_SUCCESS;
+    }
+    if (i + 1 >= argc) {
+      error(commandName, "Missing value for option: " + option);
+    }
+    string value = argv[++i];
+    if (option == "--kernels") {
+      istringstream in(value);
+      string name;
+      while (std::getline(in, name, ',')) {
+        selected.push_back(name);
+      }
+    } else if (option == "--sizes") {
+      sizes = parseSizes(commandName, value);
+    } else if (option == "--repetitions" || option == "--warmup"
+               || option == "--min-time" || option == "--cpu") {
+      long count = 0;
+      try {
+        count = stol(value);
+        if (count < (option == "--repetitions" ? 1 : 0)) {
+          throw invalid_argument("");
+        }
+      } catch(...) {
+        error(commandName, "Invalid value: " + value);
+      }
+      if (option == "--repetitions") {
+        repetitions = (int)count;
+      } else if (option == "--warmup") {
+        warmup = (int)count;
+      } else if (option == "--min-time") {
+        minTime = count;
+      } else {
+        cpu = (int)count;
+      }
+    } else if (option == "--format") {
+      if (value == "text") {
+        format = FORMAT_TEXT;
+      } else if (value == "csv") {
+        format = FORMAT_CSV;
+      } else if (value == "json") {
+        format = FORMAT_JSON;
+      } else {
+        error(commandName, "Invalid format: " + value);
+      }
+    } else {
+      error(commandName, "Invalid option: " + option);
+    }
+  }
+
+  KernelBench bench;
+  vector<Kernel *> kernels;
+  for (size_t k = 0; k < bench.kernels.size(); k++) {
+    if (selected.empty() || std::find(selected.begin(), selected.end(),
+                                      bench.kernels[k].name)
+                            != selected.end()) {
+      kernels.push_back(&bench.kernels[k]);
+    }
+  }
+  if (kernels.size() < std::max(selected.size(), (size_t)1)) {
+    error(commandName, "Invalid kernel list");
+  }
+  if (cpu >= 0 && !pinToCpu(cpu)) {
+    cerr << "Cannot pin to CPU " << cpu << endl;
+    return EXIT_FAILURE;
+  }
+
+  printHeader(format, repetitions, warmup, minTime, cpu);
+  bool first = true;
+  for (size_t k = 0; k < kernels.size(); k++) {
+    for (size_t s = 0; s < sizes.size(); s++) {
+      benchmark(*kernels[k], sizes[s], warmup, repetitions, minTime, format,
+                first);
+      first = false;
+    }
+  }
+  if (format == FORMAT_JSON) {
+    cout << endl << "  ]" << endl << "}" << endl;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,449 @@
+#include <math.h>
+#include <stdint.h>
+
+#include <gmpxx.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MODULAR_SERIES_X86 1
+#include <immintrin.h>
+#endif
+
+#include "ModularSeriesSum.h"
+
+/**
+ * All kernels work with Montgomery representation x*R mod p where R = 2^32.
+ * The product of two such values is reduced with REDC which only needs
+ * multiplications and shifts, so it maps onto the 32x32->64 bit lane
+ * multiplications of AVX2 and AVX-512.  Primes are below 2^31, so every
+ * intermediate value stays below 2^64 and a sum of two residues is below
+ * 2^32.  Since the exponent is the same for every term, all lanes follow the
+ * same square-and-multiply sequence.
+ */
+struct Montgomery {
+  uint32_t p;    // Prime
+  uint32_t pinv; // -1/p mod R
+  uint32_t one;  // R mod p, which represents 1
+  uint32_t r2;   // R^2 mod p, which converts to Montgomery representation
+};
+
+static Montgomery createMontgomery(uint32_t p) {
+  Montgomery mont;
+  uint32_t inv = p;
+  // Newton's iteration doubles the number of correct bits each time
+  for (int i = 0; i < 5; i++) {
+    inv *= 2 - p*inv;
+  }
+  mont.p = p;
+  mont.pinv = -inv;
+  mont.one = (uint32_t)((((uint64_t)1) << 32)%p);
+  mont.r2 = (uint32_t)(((uint64_t)mont.one*mont.one)%p);
+  return mont;
+}
+
+static inline uint32_t reduce(uint64_t t, const Montgomery & mont) {
+  uint32_t m = (uint32_t)t*mont.pinv;
+  uint64_t u = (t + (uint64_t)m*mont.p) >> 32;
+  return (uint32_t)(u >= mont.p ? u - mont.p : u);
+}
+
+static inline uint32_t multiply(uint32_t a, uint32_t b,
+                                const Montgomery & mont) {
+  return reduce((uint64_t)a*b, mont);
+}
+
+static inline uint32_t add(uint32_t a, uint32_t b, const Montgomery & mont) {
+  uint32_t s = a + b;
+  return s >= mont.p ? s - mont.p : s;
+}
+
+static inline uint32_t toMontgomery(uint32_t a, const Montgomery & mont) {
+  return multiply(a%mont.p, mont.r2, mont);
+}
+
+// Index of the highest set bit of the exponent or -1 for 0
+static int highestBit(unsigned long e) {
+  int bit = -1;
+  while (e != 0) {
+    bit++;
+    e >>= 1;
+  }
+  return bit;
+}
+
+static inline uint32_t power(uint32_t x, unsigned long e, int topBit,
+                             const Montgomery & mont) {
+  uint32_t result = mont.one;
+  for (int bit = topBit; bit >= 0; bit--) {
+    result = multiply(result, result, mont);
+    if ((e >> bit) & 1) {
+      result = multiply(result, x, mont);
+    }
+  }
+  return result;
+}
+
+/**
+ * Add k^e for k = first, first + 1, ..., first + count - 1 in Montgomery
+ * representation where first is given in Montgomery representation
+ */
+static uint32_t sumScalar(uint32_t first, uint32_t count, unsigned long e,
+                          const Montgomery & mont) {
+  uint32_t sum = 0;
+  uint32_t k = first;
+  int topBit = highestBit(e);
+  for (uint32_t i = 0; i < count; i++) {
+    sum = add(sum, power(k, e, topBit, mont), mont);
+    k = add(k, mont.one, mont);
+  }
+  return sum;
+}
+
+#ifdef MODULAR_SERIES_X86
+// Each 64 bit lane holds one residue in its lower half
+#define AVX2_TARGET __attribute__((target("avx2")))
+#define AVX512_TARGET __attribute__((target("avx512f")))
+
+static inline AVX2_TARGET __m256i multiplyAvx2(__m256i a, __m256i b,
+                                               __m256i p, __m256i pinv) {
+  __m256i t = _mm256_mul_epu32(a, b);
+  __m256i m = _mm256_mul_epu32(t, pinv);
+  __m256i u = _mm256_srli_epi64(_mm256_add_epi64(t, _mm256_mul_epu32(m, p)),
+                                32);
+  // u < 2p: the unsigned minimum of u and u - p is the reduced value and the
+  // upper halves stay 0
+  return _mm256_min_epu32(u, _mm256_sub_epi32(u, p));
+}
+
+static inline AVX2_TARGET __m256i addAvx2(__m256i a, __m256i b, __m256i p) {
+  __m256i s = _mm256_add_epi32(a, b);
+  return _mm256_min_epu32(s, _mm256_sub_epi32(s, p));
+}
+
+static AVX2_TARGET uint32_t sumAvx2(uint32_t first, uint32_t count,
+                                    unsigned long e, const Montgomery & mont) {
+  const int LANES = 4;
+  __m256i p = _mm256_set1_epi64x(mont.p);
+  __m256i pinv = _mm256_set1_epi64x(mont.pinv);
+  __m256i one = _mm256_set1_epi64x(mont.one);
+  __m256i step = _mm256_set1_epi64x(toMontgomery(LANES, mont));
+  int topBit = highestBit(e);
+  uint64_t lane[LANES];
+  lane[0] = first;
+  for (int i = 1; i < LANES; i++) {
+    lane[i] = add((uint32_t)lane[i - 1], mont.one, mont);
+  }
+  __m256i k = _mm256_loadu_si256((const __m256i *)lane);
+  __m256i sum = _mm256_setzero_si256();
+  uint32_t blocks = count/LANES;
+  for (uint32_t b = 0; b < blocks; b++) {
+    __m256i result = one;
+    for (int bit = topBit; bit >= 0; bit--) {
+      result = multiplyAvx2(result, result, p, pinv);
+      if ((e >> bit) & 1) {
+        result = multiplyAvx2(result, k, p, pinv);
+      }
+    }
+    sum = addAvx2(sum, result, p);
+    k = addAvx2(k, step, p);
+  }
+
+  uint64_t out[LANES];
+  _mm256_storeu_si256((__m256i *)out, sum);
+  _mm256_storeu_si256((__m256i *)lane, k);
+  uint32_t total = 0;
+  for (int i = 0; i < LANES; i++) {
+    total = add(total, (uint32_t)out[i], mont);
+  }
+  // lane[0] now holds the next term after the last full block
+  return add(total, sumScalar((uint32_t)lane[0], count%LANES, e, mont),
+             mont);
+}
+
+// The AVX-512 intrinsics initialize their unused pass-through operand from
+// itself, which GCC reports once they are inlined into the kernel
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+static inline AVX512_TARGET __m512i multiplyAvx512(__m512i a, __m512i b,
+                                                   __m512i p, __m512i pinv) {
+  __m512i t = _mm512_mul_epu32(a, b);
+  __m512i m = _mm512_mul_epu32(t, pinv);
+  __m512i u = _mm512_srli_epi64(_mm512_add_epi64(t, _mm512_mul_epu32(m, p)),
+                                32);
+  return _mm512_min_epu32(u, _mm512_sub_epi32(u, p));
+}
+
+static inline AVX512_TARGET __m512i addAvx512(__m512i a, __m512i b,
+                                              __m512i p) {
+  __m512i s = _mm512_add_epi32(a, b);
+  return _mm512_min_epu32(s, _mm512_sub_epi32(s, p));
+}
+
+static AVX512_TARGET uint32_t sumAvx512(uint32_t first, uint32_t count,
+                                        unsigned long e,
+                                        const Montgomery & mont) {
+  const int LANES = 8;
+  __m512i p = _mm512_set1_epi64(mont.p);
+  __m512i pinv = _mm512_set1_epi64(mont.pinv);
+  __m512i one = _mm512_set1_epi64(mont.one);
+  __m512i step = _mm512_set1_epi64(toMontgomery(LANES, mont));
+  int topBit = highestBit(e);
+  uint64_t lane[LANES];
+  lane[0] = first;
+  for (int i = 1; i < LANES; i++) {
+    lane[i] = add((uint32_t)lane[i - 1], mont.one, mont);
+  }
+  __m512i k = _mm512_loadu_si512(lane);
+  __m512i sum = _mm512_setzero_si512();
+  uint32_t blocks = count/LANES;
+  for (uint32_t b = 0; b < blocks; b++) {
+    __m512i result = one;
+    for (int bit = topBit; bit >= 0; bit--) {
+      result = multiplyAvx512(result, result, p, pinv);
+      if ((e >> bit) & 1) {
+        result = multiplyAvx512(result, k, p, pinv);
+      }
+    }
+    sum = addAvx512(sum, result, p);
+    k = addAvx512(k, step, p);
+  }
+
+  uint64_t out[LANES];
+  _mm512_storeu_si512(out, sum);
+  _mm512_storeu_si512(lane, k);
+  uint32_t total = 0;
+  for (int i = 0; i < LANES; i++) {
+    total = add(total, (uint32_t)out[i], mont);
+  }
+  return add(total, sumScalar((uint32_t)lane[0], count%LANES, e, mont),
+             mont);
+}
+#pragma GCC diagnostic pop
+#endif
+
+static ModularSeriesSum::Kernel bestKernel(ModularSeriesSum::Kernel limit) {
+#ifdef MODULAR_SERIES_X86
+  __builtin_cpu_init();
+  if ((limit == ModularSeriesSum::KERNEL_AUTO
+       || limit == ModularSeriesSum::KERNEL_AVX512)
+      && __builtin_cpu_supports("avx512f")) {
+    return ModularSeriesSum::KERNEL_AVX512;
+  }
+  if (limit != ModularSeriesSum::KERNEL_SCALAR
+      && __builtin_cpu_supports("avx2")) {
+    return ModularSeriesSum::KERNEL_AVX2;
+  }
+#else
+  (void)limit;
+#endif
+  return ModularSeriesSum::KERNEL_SCALAR;
+}
+
+ModularSeriesSum :: ModularSeriesSum()
+                  : kernel(bestKernel(KERNEL_AUTO)) {
+}
+
+/**
+ * Since k^m mod p depends only on k mod p, n + 1 terms are q = (n + 1)/p full
+ * periods followed by (n + 1) mod p terms.  By Fermat's little theorem the sum
+ * over a full period is p - 1 when p - 1 divides m > 0 and 0 otherwise.
+ */
+unsigned long ModularSeriesSum :: computeSum(long power, long n,
+                                             unsigned long prime) {
+  if (power < 0 || n < 0) {
+    return 0;
+  }
+  Montgomery mont = createMontgomery((uint32_t)prime);
+  unsigned long e = (unsigned long)power;
+  unsigned long terms = (unsigned long)n + 1;
+  unsigned long periods = terms/prime;
+  uint32_t count = (uint32_t)(terms%prime);
+
+  uint32_t sum = 0;
+  if (periods > 0 && e > 0 && e%(prime - 1) == 0) {
+    sum = toMontgomery((uint32_t)((periods%prime)*(prime - 1)%prime), mont);
+  }
+  switch (kernel) {
+#ifdef MODULAR_SERIES_X86
+    case KERNEL_AVX512:
+      sum = add(sum, sumAvx512(0, count, e, mont), mont);
+      break;
+    case KERNEL_AVX2:
+      sum = add(sum, sumAvx2(0, count, e, mont), mont);
+      break;
+#endif
+    default:
+      sum = add(sum, sumScalar(0, count, e, mont), mont);
+      break;
+  }
+  return reduce(sum, mont);
+}
+
+void ModularSeriesSum :: setKernel(Kernel kernel) {
+  this->kernel = bestKernel(kernel);
+}
+
+ModularSeriesSum::Kernel ModularSeriesSum :: getKernel() {
+  return kernel;
+}
+
+string ModularSeriesSum :: kernelName(Kernel kernel) {
+  switch (kernel) {
+    case KERNEL_AVX512:
+      return "avx512";
+    case KERNEL_AVX2:
+      return "avx2";
+    case KERNEL_SCALAR:
+      return "scalar";
+    default:
+      return "auto";
+  }
+}
+
+#ifdef __SIZEOF_INT128__
+__extension__ typedef unsigned __int128 uint128_t;
+
+static inline uint64_t multiplyMod(uint64_t a, uint64_t b, uint64_t p) {
+  return (uint64_t)(((uint128_t)a*b)%p);
+}
+#else
+static inline uint64_t multiplyMod(uint64_t a, uint64_t b, uint64_t p) {
+  uint64_t result = 0;
+  a %= p;
+  while (b != 0) {
+    if (b & 1) {
+      result = (result >= p - a) ? result - (p - a) : result + a;
+    }
+    a = (a >= p - a) ? a - (p - a) : a + a;
+    b >>= 1;
+  }
+  return result;
+}
+#endif
+
+static uint64_t powerMod(uint64_t x, unsigned long e, uint64_t p) {
+  uint64_t result = 1%p;
+  x %= p;
+  while (e != 0) {
+    if (e & 1) {
+      result = multiplyMod(result, x, p);
+    }
+    x = multiplyMod(x, x, p);
+    e >>= 1;
+  }
+  return result;
+}
+
+/**
+ * The values y(x) = 0^m + ... + x^m for x = 0 .. d where d = m + 1 use the
+ * smallest prime factor of every x so that only primes are exponentiated.
+ * Then with Lagrange's formula
+ * y(n) = sum over i of y(i) prod over j != i of (n - j)/(i - j)
+ * where the products are prefix and suffix products of (n - j) and
+ * prod over j != i of (i - j) = (-1)^(d - i) i!(d - i)!.
+ */
+unsigned long ModularSeriesSum :: interpolateSum(long power, long n,
+                                                 unsigned long prime) {
+  if (power < 0 || n < 0) {
+    return 0;
+  }
+  uint64_t p = prime;
+  long d = power + 1;
+  long last = (n < d) ? n : d;
+
+  vector<long> smallestFactor(last + 1, 0);
+  vector<uint64_t> y(last + 1);
+  uint64_t termPower = powerMod(0, (unsigned long)power, p);
+  y[0] = termPower;
+  for (long x = 1; x <= last; x++) {
+    if (x > 1 && smallestFactor[x] == 0) {
+      for (long j = x; j <= last; j += x) {
+        if (smallestFactor[j] == 0) {
+          smallestFactor[j] = x;
+        }
+      }
+    }
+    long factor = smallestFactor[x];
+    if (x == 1 || factor == x) {
+      termPower = powerMod(x, (unsigned long)power, p);
+    } else {
+      // Both the factor and the cofactor are less than x, so the power of x
+      // is the product of their powers which are differences of y
+      uint64_t a = (y[factor] + p - y[factor - 1])%p;
+      uint64_t b = (y[x/factor] + p - y[x/factor - 1])%p;
+      termPower = multiplyMod(a, b, p);
+    }
+    y[x] = (y[x - 1] + termPower)%p;
+  }
+  if (n <= d) {
+    return y[n];
+  }
+
+  uint64_t x = (uint64_t)n%p;
+  vector<uint64_t> suffix(d + 2);
+  suffix[d + 1] = 1;
+  for (long j = d; j >= 0; j--) {
+    suffix[j] = multiplyMod(suffix[j + 1], (x + p - (uint64_t)j%p)%p, p);
+  }
+  vector<uint64_t> inverseFactorial(d + 1);
+  uint64_t factorial = 1;
+  for (long j = 2; j <= d; j++) {
+    factorial = multiplyMod(factorial, j, p);
+  }
+  inverseFactorial[d] = powerMod(factorial, p - 2, p);
+  for (long j = d; j >= 1; j--) {
+    inverseFactorial[j - 1] = multiplyMod(inverseFactorial[j], j, p);
+  }
+
+  uint64_t sum = 0;
+  uint64_t prefix = 1;
+  for (long i = 0; i <= d; i++) {
+    uint64_t term = multiplyMod(y[i], multiplyMod(prefix, suffix[i + 1], p),
+                                p);
+    term = multiplyMod(term, multiplyMod(inverseFactorial[i],
+                                         inverseFactorial[d - i], p), p);
+    if ((d - i) & 1) {
+      term = (p - term)%p;
+    }
+    sum = (sum + term)%p;
+    prefix = multiplyMod(prefix, (x + p - (uint64_t)i%p)%p, p);
+  }
+  return sum;
+}
+
+vector<unsigned long> ModularSeriesSum :: randomPrimes(size_t count,
+                                                       unsigned long seed) {
+  vector<unsigned long> primes;
+  gmp_randclass random(gmp_randinit_default);
+  random.seed(seed);
+  mpz_class low = mpz_class(1) << 60;
+  mpz_class prime;
+  while (primes.size() < count) {
+    mpz_class start = low + random.get_z_bits(60);
+    mpz_nextprime(prime.get_mpz_t(), start.get_mpz_t());
+    if (mpz_sizeinbase(prime.get_mpz_t(), 2) != 61) {
+      continue;
+    }
+    unsigned long candidate = mpz_get_ui(prime.get_mpz_t());
+    bool seen = false;
+    for (size_t i = 0; i < primes.size(); i++) {
+      if (primes[i] == candidate) {
+        seen = true;
+      }
+    }
+    if (!seen) {
+      primes.push_back(candidate);
+    }
+  }
+  return primes;
+}
+
+double ModularSeriesSum :: falsePositiveBound(size_t bits, size_t count) {
+  double numPrimes = ldexp(1.0, 60)/(61*log(2.0));
+  double divisors = (double)(bits/60 + 1);
+  double bound = 1;
+  for (size_t i = 0; i < count; i++) {
+    bound *= divisors/(numPrimes - i);
+  }
+  return bound < 1 ? bound : 1;
+}
@@ -0,0 +1,94 @@
+#ifndef MODULAR_SERIES_SUM_H
+#define MODULAR_SERIES_SUM_H
+
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+class ModularSeriesSum {
+  public:
+    /* Implementations of the summation loop */
+    enum Kernel {
+      KERNEL_AUTO,   // Best kernel supported by the processor
+      KERNEL_SCALAR, // One term at a time
+      KERNEL_AVX2,   // 4 terms at a time using AVX2
+      KERNEL_AVX512  // 8 terms at a time using AVX-512
+    };
+
+    ModularSeriesSum();
+
+    /* To compute the sum of the series modulo a prime
+     * Parameters:
+     *   power - desired power (IN)
+     *   n - number of terms (IN)
+     *   prime - odd prime less than 2^31 (IN)
+     * Return value
+     *   (0^power + 1^power + ... + n^power) mod prime
+     */
+    unsigned long computeSum(long power, long n, unsigned long prime);
+
+    /* To compute the sum of the series modulo a large prime without going
+     * through all the terms.  The sum is a polynomial of degree power + 1 in
+     * n, so it is interpolated from its values at n = 0, 1, ..., power + 1
+     * which are obtained by adding up the series.  The time taken does not
+     * depend on n.
+     * Parameters:
+     *   power - desired power (IN)
+     *   n - number of terms (IN)
+     *   prime - prime greater than power + 1 and less than 2^62 (IN)
+     * Return value
+     *   (0^power + 1^power + ... + n^power) mod prime
+     */
+    static unsigned long interpolateSum(long power, long n,
+                                        unsigned long prime);
+
+    /* To pick distinct random primes in [2^60, 2^61)
+     * Parameters:
+     *   count - number of primes needed (IN)
+     *   seed - seed for the random number generator (IN)
+     * Return value
+     *   primes picked
+     */
+    static vector<unsigned long> randomPrimes(size_t count,
+                                              unsigned long seed);
+
+    /* To get an upper bound on the probability that a wrong sum has the same
+     * residues as the right one modulo count random primes from
+     * randomPrimes.  The difference of the two sums has at most bits/60 prime
+     * factors of 61 bits out of about 2^60/ln(2^61) such primes.
+     * Parameters:
+     *   bits - number of bits in the larger of the two sums (IN)
+     *   count - number of primes (IN)
+     * Return value
+     *   probability bound
+     */
+    static double falsePositiveBound(size_t bits, size_t count);
+
+    /* To select the kernel used by computeSum.  If the processor does not
+     * support the kernel, the best supported kernel below it is used.
+     * Parameters:
+     *   kernel - desired kernel (IN)
+     */
+    void setKernel(Kernel kernel);
+
+    /* To get the kernel used by computeSum
+     * Return value
+     *   kernel actually used (never KERNEL_AUTO)
+     */
+    Kernel getKernel();
+
+    /* To get a printable name of a kernel
+     * Parameters:
+     *   kernel - kernel (IN)
+     * Return value
+     *   name of the kernel
+     */
+    static string kernelName(Kernel kernel);
+
+  private:
+    Kernel kernel;
+};
+
+#endif
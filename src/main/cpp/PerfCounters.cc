@@ -0,0 +1,153 @@
+#include <string.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <atomic>
+
+#include "PerfCounters.h"
+
+static std::atomic<bool> enabled(false);
+
+static void clearValues(PerfCounterValues & values) {
+  values.cycles = -1;
+  values.instructions = -1;
+  values.cacheReferences = -1;
+  values.cacheMisses = -1;
+  values.branches = -1;
+  values.branchMisses = -1;
+}
+
+#ifdef __linux__
+
+// Events in the order of the fields of PerfCounterValues.  The first one
+// leads the group.
+static const uint64_t EVENTS[] = {
+  PERF_COUNT_HW_CPU_CYCLES,
+  PERF_COUNT_HW_INSTRUCTIONS,
+  PERF_COUNT_HW_CACHE_REFERENCES,
+  PERF_COUNT_HW_CACHE_MISSES,
+  PERF_COUNT_HW_BRANCH_INSTRUCTIONS,
+  PERF_COUNT_HW_BRANCH_MISSES
+};
+
+static int openEvent(uint64_t config, int groupFd) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED
+                     | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  // The leader starts disabled and switches the whole group
+  attr.disabled = (groupFd == -1) ? 1 : 0;
+  // User space only, which is allowed with perf_event_paranoid up to 2
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return (int)syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0);
+}
+
+PerfCounterGroup :: PerfCounterGroup() : numOpen(0) {
+  for (int e = 0; e < NUM_EVENTS; e++) {
+    fds[e] = -1;
+  }
+  if (!enabled) {
+    return;
+  }
+  fds[0] = openEvent(EVENTS[0], -1);
+  if (fds[0] == -1) {
+    return;
+  }
+  numOpen = 1;
+  // Events the processor does not have are left out of the group
+  for (int e = 1; e < NUM_EVENTS; e++) {
+    fds[e] = openEvent(EVENTS[e], fds[0]);
+    if (fds[e] != -1) {
+      numOpen++;
+    }
+  }
+}
+
+PerfCounterGroup :: ~PerfCounterGroup() {
+  for (int e = NUM_EVENTS - 1; e >= 0; e--) {
+    if (fds[e] != -1) {
+      close(fds[e]);
+    }
+  }
+}
+
+void PerfCounterGroup :: start() {
+  if (fds[0] == -1) {
+    return;
+  }
+  ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+/**
+ * A group read returns the number of events, the times the group was
+ * enabled and running and then one count per event in the order they were
+ * opened
+ */
+void PerfCounterGroup :: stop(PerfCounterValues & values) {
+  clearValues(values);
+  if (fds[0] == -1) {
+    return;
+  }
+  ioctl(fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+  uint64_t buffer[3 + NUM_EVENTS];
+  ssize_t size = read(fds[0], buffer, sizeof(buffer));
+  if (size < (ssize_t)(3*sizeof(uint64_t)) || buffer[0] != (uint64_t)numOpen
+      || buffer[2] == 0) {
+    return;
+  }
+  double scale = (double)buffer[1]/buffer[2];
+  long * fields[NUM_EVENTS] = {
+    &values.cycles, &values.instructions, &values.cacheReferences,
+    &values.cacheMisses, &values.branches, &values.branchMisses
+  };
+  int next = 3;
+  for (int e = 0; e < NUM_EVENTS; e++) {
+    if (fds[e] != -1) {
+      *fields[e] = (long)(buffer[next++]*scale + 0.5);
+    }
+  }
+}
+
+#else
+
+PerfCounterGroup :: PerfCounterGroup() : numOpen(0) {
+  for (int e = 0; e < NUM_EVENTS; e++) {
+    fds[e] = -1;
+  }
+}
+
+PerfCounterGroup :: ~PerfCounterGroup() {
+}
+
+void PerfCounterGroup :: start() {
+}
+
+void PerfCounterGroup :: stop(PerfCounterValues & values) {
+  clearValues(values);
+}
+
+#endif
+
+void PerfCounterGroup :: setEnabled(bool value) {
+  enabled = value;
+}
+
+bool PerfCounterGroup :: isEnabled() {
+  return enabled;
+}
+
+bool PerfCounterGroup :: isAvailable() const {
+  return fds[0] != -1;
+}
@@ -0,0 +1,68 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+/* Hardware event counts over one phase of a computation.  A count that
+ * could not be measured is -1.  Counts are scaled up if the kernel had to
+ * share the counters with other users for part of the phase.
+ */
+struct PerfCounterValues {
+  long cycles;
+  long instructions;
+  long cacheReferences;
+  long cacheMisses;
+  long branches;
+  long branchMisses;
+};
+
+/* Group of hardware counters of the calling thread, read with the Linux
+ * perf_event_open interface.  Counting is off unless enabled with
+ * setEnabled.  When the counters cannot be opened (not Linux, no PMU access
+ * in a virtual machine or a perf_event_paranoid setting that does not allow
+ * it), the group is unavailable and all counts are -1.  Work done by other
+ * threads, such as the threads of a pool, is not counted.
+ */
+class PerfCounterGroup {
+  public:
+    /* To open the counters for the calling thread if counting is enabled */
+    PerfCounterGroup();
+
+    /* To turn counting on or off for groups created afterwards
+     * Parameters:
+     *   enabled - true to count (IN)
+     */
+    static void setEnabled(bool enabled);
+
+    /* To find out if counting is on
+     * Return value
+     *   true if setEnabled(true) was called
+     */
+    static bool isEnabled();
+
+    /* To find out if the counters could be opened
+     * Return value
+     *   true if at least the cycle counter is counting
+     */
+    bool isAvailable() const;
+
+    /* To reset the counters and start counting */
+    void start();
+
+    /* To stop counting and read the counts since start
+     * Parameters:
+     *   values - counts (OUT)
+     */
+    void stop(PerfCounterValues & values);
+
+    ~PerfCounterGroup();
+
+  private:
+    PerfCounterGroup(const PerfCounterGroup &);
+    PerfCounterGroup & operator=(const PerfCounterGroup &);
+
+    static const int NUM_EVENTS = 6;
+
+    int fds[NUM_EVENTS];  // -1 for events that could not be opened
+    int numOpen;
+};
+
+#endif
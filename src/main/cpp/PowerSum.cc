@@ -1,31 +1,488 @@
+#include <math.h>
+
+#include <algorithm>
+#include <sstream>
+
 #include "PowerSum.h"
+#include "Trace.h"
+
+// Number of terms added with one difference table before it is seeded again
+// from direct powers.  Each seed costs (power + 1) exponentiations.
+static const long DIFFERENCE_CHUNK_SIZE = 8192;
+
+// Number of candidate primes sieved at a time.  The segment is a byte per
+// candidate and is sized to stay in the L2 cache.
+static const long SIEVE_SEGMENT_SIZE = 131072;
+
+// Units of about equal work the sieve is split into per thread.  Threads
+// take the next unit as they finish one, which evens out the estimate.
+static const long SIEVE_UNITS_PER_THREAD = 16;
+
+// Work of exponentiating a prime in multiplications for composites
+static const double SIEVE_PRIME_COST = 2;
+
+// Steps in ln(x) over which the work of the sieve is added up
+static const int SIEVE_WORK_STEPS = 1024;
+
+// The difference table needs (power + 1) additions per term while the sieve
+// needs one multiplication per composite, so the table only wins for small
+// powers (measured crossover with the sieve is between 5 and 6)
+static const long DIFFERENCE_POWER_LIMIT = 5;
+
+// The series loops check for cancellation once every
+// CANCELLATION_CHECK_MASK + 1 terms
+static const long CANCELLATION_CHECK_MASK = 4095;
+
+// Polynomials with fewer coefficients than this are evaluated in one block
+static const long PARALLEL_MIN_COEFFICIENTS = 64;
+
+/**
+ * Pairwise tree reduction.  The shape of the tree depends only on the
+ * number of parts, so partial sums are always combined in the same order
+ * and with operands of similar size.
+ */
+static mpz_class reducePartialSums(vector<mpz_class> & partial) {
+  TraceScope trace("series reduction");
+  long numParts = (long)partial.size();
+  for (long stride = 1; stride < numParts; stride *= 2) {
+    for (long part = 0; part + stride < numParts; part += 2*stride) {
+      partial[part] += partial[part + stride];
+    }
+  }
+  return partial[0];
+}
+
+/**
+ * Dickman's function, the share of the numbers up to x^u with no prime
+ * factor above x, to within a few percent where it matters
+ */
+static double dickmanRho(double u) {
+  if (u <= 1) {
+    return 1;
+  }
+  if (u <= 2) {
+    return 1 - log(u);
+  }
+  return pow(u, -u);
+}
+
+/**
+ * Split the roots 2 ... n of the sieve into at most numUnits ranges of about
+ * equal work and return the last root of each.  The tree of a root prime q
+ * holds the k <= n whose largest prime factor is q, about
+ * (n/q)rho(ln(n/q)/ln q) of them, each one multiplication, and q itself
+ * costs an exponentiation.  Primes being ln q apart, the work per unit of
+ * t = ln q is n rho((ln n - t)/t)/t + SIEVE_PRIME_COST e^t/t, which is added
+ * up in steps of t.
+ */
+static vector<long> sieveUnitEnds(long n, long numUnits) {
+  double first = log(2.0);
+  double step = (log((double)n) - first)/SIEVE_WORK_STEPS;
+  vector<double> work(SIEVE_WORK_STEPS + 1, 0);
+  for (int i = 1; i <= SIEVE_WORK_STEPS; i++) {
+    double t = first + (i - 0.5)*step;
+    double density = n*dickmanRho((log((double)n) - t)/t)/t
+                     + SIEVE_PRIME_COST*exp(t)/t;
+    work[i] = work[i - 1] + density*step;
+  }
+
+  vector<long> ends;
+  int i = 1;
+  for (long unit = 1; unit < numUnits; unit++) {
+    double target = work[SIEVE_WORK_STEPS]*unit/numUnits;
+    while (work[i] < target) {
+      i++;
+    }
+    double fraction = (target - work[i - 1])/(work[i] - work[i - 1]);
+    long end = (long)exp(first + (i - 1 + fraction)*step);
+    if (end < n && (ends.empty() || end > ends.back())) {
+      ends.push_back(end);
+    }
+  }
+  ends.push_back(n);
+  return ends;
+}
+
+static std::string memoryMessage(double predictedBytes, double limitBytes) {
+  std::ostringstream message;
+  message << "Predicted memory of " << (long)predictedBytes
+          << " bytes exceeds the limit of " << (long)limitBytes << " bytes";
+  return message.str();
+}
+
+MemoryLimitExceeded :: MemoryLimitExceeded(double predictedBytes,
+                                           double limitBytes)
+                     : std::runtime_error(memoryMessage(predictedBytes,
+                                                        limitBytes)),
+                       predictedBytes(predictedBytes),
+                       limitBytes(limitBytes) {
+}
 
 mpz_class PowerSum :: computeSumUsingSeries(long power, long n) {
   mpz_class sum = 0;
   if (power < 0 || n < 0) {
     return sum;
   }
+  checkMemoryLimit(predictSeriesMemory(power, n));
 
-  for (long count = 0; count <= n; count++) {
-    mpz_class base = count;
-    mpz_class result;
-    mpz_pow_ui(result.get_mpz_t(), base.get_mpz_t(), (unsigned long)power);
-    sum += result;
+  SeriesMethod method = resolveSeriesMethod(power);
+  if (method == SERIES_SIEVE) {
+    return addPowersUsingSieve(power, n);
+  }
+  long numParts = numThreads;
+  if (numParts > n + 1) {
+    numParts = n + 1;
+  }
+  if (numParts <= 1) {
+    addSeriesPart(method, power, n, 0, 1, sum);
+    return sum;
+  }
+
+  // Each thread adds up its own part of the series into its own accumulator
+  vector<mpz_class> partial(numParts);
+  CancellationToken * token = CancellationToken::current();
+  getThreadPool()->parallelFor(0, numParts, 1, [&](long begin, long end) {
+    CancellationScope scope(token);
+    for (long part = begin; part < end; part++) {
+      addSeriesPart(method, power, n, part, numParts, partial[part]);
+    }
+  });
+
+  return reducePartialSums(partial);
+}
+
+/**
+ * The token is shared with the thread, which installs it for the whole
+ * computation, so that the caller may drop its copy at any time
+ */
+future<mpz_class> PowerSum :: computeSumAsync(long power, long n,
+                                      shared_ptr<CancellationToken> token) {
+  return std::async(std::launch::async, [this, power, n, token]() {
+    CancellationScope scope(token.get());
+    return computeSum(power, n);
+  });
+}
+
+future<vector<mpq_class> > PowerSum :: getCoefficientsAsync(long power,
+                                      shared_ptr<CancellationToken> token) {
+  return std::async(std::launch::async, [this, power, token]() {
+    CancellationScope scope(token.get());
+    return getCoefficients(power);
+  });
+}
+
+void PowerSum :: setSeriesMethod(SeriesMethod method) {
+  seriesMethod = method;
+}
+
+void PowerSum :: setNumThreads(int threads) {
+  std::lock_guard<std::mutex> guard(threadPoolLock);
+  numThreads = (threads < 1) ? 1 : threads;
+  threadPool.reset();
+}
+
+/**
+ * The pool is not created here, as a pool that does not exist yet has taken
+ * no time.  setNumThreads replaces the pool, which starts again at 0.
+ */
+long PowerSum :: getHelperCpuTime() {
+  std::lock_guard<std::mutex> guard(threadPoolLock);
+  return threadPool ? threadPool->getCpuTime() : 0;
+}
+
+/**
+ * Each part of the series has its sum and the numbers of its method: one
+ * power, the difference table and its packed copy, or the powers of the
+ * primes up to sqrt(n) (fewer than 1.26 x/ln x of them), a value per level
+ * of the tree of multiples and the segment being sieved
+ */
+double PowerSum :: predictSeriesMemory(long power, long n) {
+  if (power < 0 || n < 0) {
+    return 0;
+  }
+  long numParts = (numThreads > n + 1) ? n + 1 : numThreads;
+  double termBits = power*log2(n + 1.0);
+  double sumBytes = numberBytes(log2Sum(power, n));
+  double partBytes = sumBytes;
+  switch (resolveSeriesMethod(power)) {
+    case SERIES_POWER:
+      partBytes += numberBytes(termBits);
+      break;
+    case SERIES_DIFFERENCE:
+      partBytes += 2*(power + 1)*numberBytes(termBits + power);
+      break;
+    default: {
+      // The small primes and their powers are shared by all threads, each
+      // thread walks a tree in a segment of its own and every unit keeps
+      // its partial sum until the reduction
+      double root = sqrt((double)n);
+      double numPrimes = (root > 2) ? 1.26*root/log(root) : 1;
+      double shared = numPrimes*numberBytes(power*log2(root + 1)) + root + 1;
+      double workspace = (log2(n + 1.0) + 2)*numberBytes(termBits)
+                         + SIEVE_SEGMENT_SIZE;
+      double numUnits = (numParts > 1) ? numParts*SIEVE_UNITS_PER_THREAD : 1;
+      return shared + numParts*workspace + numUnits*sumBytes;
+    }
+  }
+  return numParts*partBytes;
+}
+
+void PowerSum :: setMemoryLimit(double bytes) {
+  memoryLimit = (bytes < 0) ? 0 : bytes;
+}
+
+double PowerSum :: getMemoryLimit() {
+  return memoryLimit;
+}
+
+void PowerSum :: checkMemoryLimit(double predictedBytes) {
+  if (memoryLimit > 0 && predictedBytes > memoryLimit) {
+    throw MemoryLimitExceeded(predictedBytes, memoryLimit);
+  }
+}
+
+/**
+ * The pool is created on first use so that single threaded computations and
+ * objects that are never used do not start any threads.  Returns NULL when
+ * only one thread is to be used.
+ */
+ThreadPool * PowerSum :: getThreadPool() {
+  std::lock_guard<std::mutex> guard(threadPoolLock);
+  if (numThreads <= 1) {
+    return NULL;
+  }
+  if (!threadPool) {
+    threadPool.reset(new ThreadPool(numThreads));
+  }
+  return threadPool.get();
+}
+
+/**
+ * Evaluate coeffs[0] + coeffs[1]x + ... + coeffs[d]x^d.  Evaluating the terms
+ * in order makes a serial chain since every term needs the previous power of
+ * x.  Instead, the coefficients are split into blocks of s, one or more per
+ * thread.  Block b only needs x^0 ... x^(s - 1) to compute its local value
+ * L(b) = coeffs[bs] + coeffs[bs + 1]x + ... + coeffs[bs + s - 1]x^(s - 1),
+ * so the blocks are evaluated independently and with much smaller powers.
+ * The polynomial is then L(0) + L(1)X + L(2)X^2 + ... where X = x^s, which is
+ * combined pairwise: at each level, L(i) += L(i + stride)X^stride, and X is
+ * squared for the next level.  The pairs of a level are independent too.
+ * Without a thread pool there is a single block and this is the usual
+ * term-by-term evaluation.
+ */
+mpq_class PowerSum :: evaluatePolynomial(const CoefficientArray & coeffs,
+                                         const mpz_class & x,
+                                         long & multiplications) {
+  long numCoeffs = (long)coeffs.size();
+  if (numCoeffs == 0) {
+    return 0;
+  }
+  TraceScope trace("polynomial");
+
+  ThreadPool * pool = getThreadPool();
+  long numBlocks = 1;
+  if (pool != NULL && numCoeffs >= PARALLEL_MIN_COEFFICIENTS) {
+    numBlocks = 4*pool->size();
+  }
+  long blockSize = (numCoeffs + numBlocks - 1)/numBlocks;
+  numBlocks = (numCoeffs + blockSize - 1)/blockSize;
+
+  vector<mpq_class> blockValue(numBlocks);
+  // Counted per block since blocks may run on different threads
+  vector<long> blockMultiplications(numBlocks, 0);
+  CancellationToken * token = CancellationToken::current();
+  function<void(long, long)> evaluateBlocks = [&](long begin, long end) {
+    CancellationScope scope(token);
+    mpz_class pow;
+    mpq_class term;
+    for (long b = begin; b < end; b++) {
+      long first = b*blockSize;
+      long last = (numCoeffs - first < blockSize) ?
+                  numCoeffs : first + blockSize;
+      pow = 1;
+      for (long i = first; i < last; i++) {
+        CancellationToken::checkCurrent();
+        if (mpz_sgn(coeffs.numerator(i)) != 0) {
+          mpz_mul(term.get_num_mpz_t(), coeffs.numerator(i), pow.get_mpz_t());
+          mpz_set(term.get_den_mpz_t(), coeffs.denominator(i));
+          term.canonicalize();
+          blockValue[b] += term;
+          blockMultiplications[b]++;
+        }
+        if (i + 1 < last) {
+          pow *= x;
+          blockMultiplications[b]++;
+        }
+      }
+    }
+  };
+  if (pool != NULL) {
+    pool->parallelFor(0, numBlocks, 1, evaluateBlocks);
+  } else {
+    evaluateBlocks(0, numBlocks);
+  }
+
+  for (long b = 0; b < numBlocks; b++) {
+    multiplications += blockMultiplications[b];
+  }
+
+  mpz_class shift;
+  mpz_pow_ui(shift.get_mpz_t(), x.get_mpz_t(), (unsigned long)blockSize);
+  multiplications++;
+  for (long stride = 1; stride < numBlocks; stride *= 2) {
+    long numPairs = (numBlocks - stride + 2*stride - 1)/(2*stride);
+    function<void(long, long)> combinePairs = [&](long begin, long end) {
+      CancellationScope scope(token);
+      for (long pair = begin; pair < end; pair++) {
+        CancellationToken::checkCurrent();
+        long b = pair*2*stride;
+        blockValue[b] += blockValue[b + stride]*shift;
+      }
+    };
+    if (pool != NULL) {
+      pool->parallelFor(0, numPairs, 1, combinePairs);
+    } else {
+      combinePairs(0, numPairs);
+    }
+    multiplications += numPairs;
+    if (2*stride < numBlocks) {
+      shift *= shift;
+      multiplications++;
+    }
+  }
+  return blockValue[0];
+}
+
+/**
+ * Formulas with integer coefficients override this to pack their integers
+ * without going through mpq_class
+ */
+void PowerSum :: getCoefficients(long power, CoefficientArray & coeffs) {
+  vector<mpq_class> generated = getCoefficients(power);
+  packCoefficients(generated, generated.size(), coeffs);
+}
+
+/**
+ * The lock is not held while the coefficients are generated, so two threads
+ * asking for a new power at the same time may both generate them.  The view
+ * is only replaced, never changed, so holders of an older view are not
+ * affected.
+ */
+shared_ptr<const CoefficientArray> PowerSum :: getCoefficientView(long power) {
+  {
+    std::lock_guard<std::mutex> guard(viewLock);
+    if (view && viewPower == power) {
+      return view;
+    }
+  }
+  shared_ptr<CoefficientArray> coeffs = std::make_shared<CoefficientArray>();
+  getCoefficients(power, *coeffs);
+  std::lock_guard<std::mutex> guard(viewLock);
+  view = coeffs;
+  viewPower = power;
+  return view;
+}
+
+// Generator handing out the coefficients of getCoefficients
+class StoredCoefficientGenerator : public CoefficientGenerator {
+  public:
+    StoredCoefficientGenerator(PowerSum & formula, long power)
+      : formula(formula), power(power), generated(false), index(0) {}
+
+    virtual bool next(mpq_class & coeff) {
+      if (!generated) {
+        coeffs = formula.getCoefficients(power);
+        generated = true;
+      }
+      if (index >= coeffs.size()) {
+        return false;
+      }
+      coeff = coeffs[index++];
+      return true;
+    }
+
+  private:
+    PowerSum & formula;
+    long power;
+    bool generated;
+    vector<mpq_class> coeffs;
+    size_t index;
+};
+
+std::unique_ptr<CoefficientGenerator> PowerSum :: createGenerator(long power) {
+  return std::unique_ptr<CoefficientGenerator>(
+           new StoredCoefficientGenerator(*this, power));
+}
+
+/**
+ * The integers are swapped into the numerators, whose denominators are
+ * already 1, so no number is copied.  The integers are left 0.
+ */
+vector<mpq_class> PowerSum :: moveToRationals(vector<mpz_class> & coeffs) {
+  vector<mpq_class> rationals(coeffs.size());
+  for (size_t i = 0; i < coeffs.size(); i++) {
+    mpz_swap(rationals[i].get_num_mpz_t(), coeffs[i].get_mpz_t());
+  }
+  return rationals;
+}
+
+/**
+ * Copy the first count coefficients into one contiguous array
+ */
+void PowerSum :: packCoefficients(const vector<mpz_class> & coeffs,
+                                  size_t count, CoefficientArray & packed) {
+  TraceScope trace("pack coefficients");
+  if (count > coeffs.size()) {
+    count = coeffs.size();
+  }
+  size_t limbs = 0;
+  for (size_t i = 0; i < count; i++) {
+    limbs += mpz_size(coeffs[i].get_mpz_t());
+  }
+  packed.clear();
+  packed.reserve(count, limbs);
+  for (size_t i = 0; i < count; i++) {
+    packed.append(coeffs[i]);
+  }
+}
+
+void PowerSum :: packCoefficients(const vector<mpq_class> & coeffs,
+                                  size_t count, CoefficientArray & packed) {
+  TraceScope trace("pack coefficients");
+  if (count > coeffs.size()) {
+    count = coeffs.size();
+  }
+  size_t limbs = 0;
+  for (size_t i = 0; i < count; i++) {
+    limbs += mpz_size(coeffs[i].get_num_mpz_t());
+  }
+  packed.clear();
+  packed.reserve(count, limbs);
+  for (size_t i = 0; i < count; i++) {
+    packed.append(coeffs[i]);
   }
-  return sum;
 }
 
 mpz_class PowerSum :: computeSum(long power, long n) {
-  vector<long> stat;
-  return(computeSumWithTimeStat(power, n, stat));
+  PowerSumStats stats;
+  return(computeSumWithStats(power, n, stats));
 }
 
-long PowerSum :: computeCpuTime(struct timespec & before,
-                                struct timespec & after) {
-  return((after.tv_sec - before.tv_sec)*1000000000L
-         + after.tv_nsec - before.tv_nsec);
+/**
+ * The times are the CPU times of the calling thread, as they were before the
+ * formulas used helper threads
+ */
+mpz_class PowerSum :: computeSumWithTimeStat(long power, long n,
+                                             vector<long> & stat) {
+  PowerSumStats stats;
+  mpz_class sum = computeSumWithStats(power, n, stats);
+  stat.clear();
+  stat.push_back(stats.init.cpuTime);
+  stat.push_back(stats.sum.cpuTime);
+  return sum;
 }
 
+
 mpz_class PowerSum :: nCr(long n, long r) {
   long num = n;
   long i;
@@ -47,3 +504,344 @@ mpz_class PowerSum :: nCr(long n, long r) {
   }
   return(result);
 }
+
+/**
+ * log2 of Binom(n, r) from the log gamma function, good for size bounds
+ */
+double PowerSum :: log2nCr(long n, long r) {
+  if (r < 0 || r > n) {
+    return 0;
+  }
+  return (lgamma(n + 1.0) - lgamma(r + 1.0) - lgamma(n - r + 1.0))/M_LN2;
+}
+
+/**
+ * Bound on the bits of the numerator of the Bernoulli number B(i).  For even
+ * i, |B(i)| = 2i!zeta(i)/(2pi)^i <= 4i!/(2pi)^i and 2(2^i - 1)B(i) is an
+ * integer, so the denominator has at most i + 1 bits.
+ */
+double PowerSum :: log2Bernoulli(long i) {
+  if (i < 2) {
+    return 1;
+  }
+  if (i & 1) {
+    return 0;
+  }
+  return 2 + lgamma(i + 1.0)/M_LN2 - i*log2(2*M_PI) + i + 1;
+}
+
+/**
+ * The sum is at most (n + 1)n^power
+ */
+double PowerSum :: log2Sum(long power, long n) {
+  return (power + 1)*log2(n + 1.0) + 1;
+}
+
+/**
+ * Bytes of a GMP number of the given bits: its limbs, rounded up, one more
+ * for the room reserveBits leaves and the mpz_t itself
+ */
+double PowerSum :: numberBytes(double bits) {
+  if (bits < 0) {
+    bits = 0;
+  }
+  return (floor(bits/GMP_NUMB_BITS) + 2)*sizeof(mp_limb_t)
+         + sizeof(__mpz_struct);
+}
+
+/**
+ * Make room in value for a number of the given bits, plus a little for the
+ * rounding of a bound computed in floating point, so that it is not
+ * reallocated as it grows up to that size
+ */
+void PowerSum :: reserveBits(mpz_class & value, double bits) {
+  if (bits < 0) {
+    bits = 0;
+  }
+  mpz_realloc2(value.get_mpz_t(), (mp_bitcnt_t)bits + 8);
+}
+
+PowerSum::SeriesMethod PowerSum :: resolveSeriesMethod(long power) {
+  if (seriesMethod != SERIES_AUTO) {
+    return seriesMethod;
+  }
+  return (power <= DIFFERENCE_POWER_LIMIT) ? SERIES_DIFFERENCE : SERIES_SIEVE;
+}
+
+/**
+ * Add the terms of part number "part" out of numParts parts of the series
+ * 0^power + 1^power + ... + n^power to sum.  A part is a contiguous range of
+ * terms.
+ */
+void PowerSum :: addSeriesPart(SeriesMethod method, long power, long n,
+                               long part, long numParts, mpz_class & sum) {
+  TraceScope trace("series part");
+  long rangeSize = (n + 1)/numParts;
+  long remainder = (n + 1)%numParts;
+  long from = part*rangeSize + (part < remainder ? part : remainder);
+  long to = from + rangeSize - 1 + (part < remainder ? 1 : 0);
+  if (method == SERIES_DIFFERENCE) {
+    addPowersUsingDifferences(power, from, to, sum);
+  } else {
+    addPowersInRange(power, from, to, sum);
+  }
+}
+
+/**
+ * Add k^power for all k in [from, to] to sum by exponentiating every term
+ */
+void PowerSum :: addPowersInRange(long power, long from, long to,
+                                  mpz_class & sum) {
+  mpz_class term;
+  for (long k = from; k <= to; k++) {
+    if ((k & CANCELLATION_CHECK_MASK) == 0) {
+      CancellationToken::checkCurrent();
+    }
+    mpz_ui_pow_ui(term.get_mpz_t(), (unsigned long)k, (unsigned long)power);
+    sum += term;
+  }
+}
+
+/**
+ * Add k^power for all k in [from, to] to sum without any multiplication in
+ * the loop.  With f(k) = k^m, the forward differences D(j, k) = D(j - 1, k + 1)
+ * - D(j - 1, k) satisfy D(j, k + 1) = D(j, k) + D(j + 1, k) and D(m, k) = m!
+ * is constant.  So once the table D(0, k) ... D(m, k) is known, moving to
+ * k + 1 takes m additions and one more addition accumulates f(k).
+ * For k >= 0 all the differences are non-negative and non-decreasing in k
+ * since they equal m!/(m - j)! x^(m - j) for some x in [k, k + j].  This gives
+ * an upper bound on the number of limbs in each row of the table for the
+ * whole chunk, so the additions are done with fixed width mpn primitives
+ * over one contiguous buffer.  The range is split into chunks so that the
+ * widths stay tight, and each chunk is seeded by direct powers.
+ */
+void PowerSum :: addPowersUsingDifferences(long power, long from, long to,
+                                           mpz_class & sum) {
+  vector<mpz_class> seed(power + 1);
+  vector<size_t> width(power + 1);
+  vector<size_t> offset(power + 1);
+  vector<mp_limb_t> table;
+  vector<mp_limb_t> chunkSum;
+  mpz_class fallingFactorial;
+  mpz_t chunkTotal; // Read-only view of chunkSum, never to be cleared
+
+  for (long start = from; start <= to; start += DIFFERENCE_CHUNK_SIZE) {
+    long end = to - start < DIFFERENCE_CHUNK_SIZE ?
+               to : start + DIFFERENCE_CHUNK_SIZE - 1;
+    CancellationToken::checkCurrent();
+
+    // Seed the table with f(start), f(start + 1), ..., f(start + m) and
+    // difference it in place
+    for (long j = 0; j <= power; j++) {
+      mpz_ui_pow_ui(seed[j].get_mpz_t(), (unsigned long)(start + j),
+                    (unsigned long)power);
+    }
+    for (long j = 1; j <= power; j++) {
+      for (long i = power; i >= j; i--) {
+        seed[i] -= seed[i - 1];
+      }
+    }
+
+    // D(j, k) < m!/(m - j)! (2^bits)^(m - j) for all k <= end + 1
+    size_t bits = mpz_sizeinbase(mpz_class(end + 1 + power).get_mpz_t(), 2);
+    size_t total = 0;
+    fallingFactorial = 1;
+    for (long j = 0; j <= power; j++) {
+      size_t bound = mpz_sizeinbase(fallingFactorial.get_mpz_t(), 2)
+                     + bits*(power - j);
+      width[j] = bound/GMP_NUMB_BITS + 1;
+      fallingFactorial *= (power - j);
+    }
+    // Rows that receive a carry must be at least as wide as the row added
+    for (long j = power - 1; j >= 0; j--) {
+      if (width[j] < width[j + 1]) {
+        width[j] = width[j + 1];
+      }
+    }
+    for (long j = 0; j <= power; j++) {
+      offset[j] = total;
+      total += width[j];
+    }
+    table.assign(total, 0);
+    for (long j = 0; j <= power; j++) {
+      size_t size = mpz_size(seed[j].get_mpz_t());
+      for (size_t l = 0; l < size; l++) {
+        table[offset[j] + l] = mpz_getlimbn(seed[j].get_mpz_t(), l);
+      }
+    }
+
+    // One extra limb holds the sum of up to 2^GMP_NUMB_BITS terms
+    size_t sumWidth = width[0] + 1;
+    chunkSum.assign(sumWidth, 0);
+    mp_limb_t * row = &table[0];
+    mp_limb_t * acc = &chunkSum[0];
+    for (long k = start; k <= end; k++) {
+      mpn_add(acc, acc, sumWidth, row, width[0]);
+      for (long j = 0; j < power; j++) {
+        mpn_add(row + offset[j], row + offset[j], width[j],
+                row + offset[j + 1], width[j + 1]);
+      }
+    }
+    mpz_add(sum.get_mpz_t(), sum.get_mpz_t(),
+            mpz_roinit_n(chunkTotal, acc, (mp_size_t)sumWidth));
+  }
+}
+
+/**
+ * Add up 0^power + 1^power + ... + n^power.  Since f(k) = k^m is completely
+ * multiplicative, every composite k is reached from k/p, where p is the
+ * smallest prime factor of k, with a single multiplication f(k) = f(p)f(k/p).
+ * This forms a tree rooted at the primes in which the children of c are p*c
+ * for all primes p up to the smallest prime factor of c, so the root of k is
+ * its largest prime factor.  Such p never exceed sqrt(n), so only the powers
+ * of those small primes are kept, in a table shared by all threads.  Trees
+ * of small roots hold most composites, so the roots are split into units of
+ * about equal estimated work, several per thread, which the threads take
+ * in turn as they finish.
+ */
+mpz_class PowerSum :: addPowersUsingSieve(long power, long n) {
+  // 0^0 is 1 and 0^m is 0 otherwise.  1^m is always 1
+  mpz_class sum = (power == 0) ? 1 : 0;
+  if (n >= 1) {
+    sum += 1;
+  }
+  if (n < 2) {
+    return sum;
+  }
+
+  SievePrimes small;
+  getSievePrimes(power, n, small);
+  if (numThreads <= 1) {
+    addSieveUnit(power, n, small, 2, n, sum);
+    return sum;
+  }
+
+  vector<long> ends = sieveUnitEnds(n, numThreads*SIEVE_UNITS_PER_THREAD);
+  long numUnits = (long)ends.size();
+  vector<mpz_class> partial(numUnits);
+  CancellationToken * token = CancellationToken::current();
+  getThreadPool()->parallelFor(0, numUnits, 1, [&](long begin, long end) {
+    CancellationScope scope(token);
+    for (long unit = begin; unit < end; unit++) {
+      long from = (unit == 0) ? 2 : ends[unit - 1] + 1;
+      addSieveUnit(power, n, small, from, ends[unit], partial[unit]);
+    }
+  });
+  sum += reducePartialSums(partial);
+  return sum;
+}
+
+/**
+ * Find the primes up to sqrt(n) and raise them to power
+ */
+void PowerSum :: getSievePrimes(long power, long n, SievePrimes & small) {
+  TraceScope trace("sieve primes");
+  long root = 1;
+  while ((root + 1) <= n/(root + 1)) {
+    root++;
+  }
+  small.root = root;
+  vector<char> composite(root + 1, 0);
+  for (long i = 2; i <= root; i++) {
+    if (!composite[i]) {
+      small.primes.push_back(i);
+      for (long j = i*i; j <= root; j += i) {
+        composite[j] = 1;
+      }
+    }
+  }
+  small.powers.resize(small.primes.size());
+  for (size_t i = 0; i < small.primes.size(); i++) {
+    CancellationToken::checkCurrent();
+    mpz_ui_pow_ui(small.powers[i].get_mpz_t(), (unsigned long)small.primes[i],
+                  (unsigned long)power);
+  }
+}
+
+/**
+ * Add k^power to sum for every k in [2, n] whose root, its largest prime
+ * factor, lies in [from, to].  Every root that is not a small prime is
+ * exponentiated once and its tree is walked depth first, which needs one
+ * value per level.  The roots come from a segmented sieve, so memory stays
+ * bounded by the segment size and the depth of the tree (log2(n)) however
+ * large n is.
+ */
+void PowerSum :: addSieveUnit(long power, long n, const SievePrimes & small,
+                              long from, long to, mpz_class & sum) {
+  TraceScope trace("series part");
+  const vector<long> & primes = small.primes;
+
+  // One value per level of the tree.  Every level at least doubles k
+  long depth = 1;
+  for (long k = n; k > 1; k >>= 1) {
+    depth++;
+  }
+  vector<mpz_class> values(depth + 1);
+  vector<long> terms(depth + 1);
+  vector<size_t> nextPrime(depth + 1);
+  vector<size_t> lastPrime(depth + 1);
+
+  long numTerms = 0;
+  long segmentSize = std::min(to - from + 1, SIEVE_SEGMENT_SIZE);
+  vector<char> segment(segmentSize);
+  for (long start = from; start <= to; start += segmentSize) {
+    long end = to - start < segmentSize ? to : start + segmentSize - 1;
+    CancellationToken::checkCurrent();
+    std::fill(segment.begin(), segment.end(), 0);
+    for (size_t i = 0; i < primes.size(); i++) {
+      long p = primes[i];
+      long first = p*p;
+      if (first > end) {
+        break;
+      }
+      if (first < start) {
+        first = ((start + p - 1)/p)*p;
+      }
+      for (long j = first; j <= end; j += p) {
+        segment[j - start] = 1;
+      }
+    }
+
+    for (long prime = start; prime <= end; prime++) {
+      if (segment[prime - start]) {
+        continue;
+      }
+      // Walk the tree of this prime.  Children of k use the primes
+      // primes[0 .. lastPrime] where primes[lastPrime] is the smallest prime
+      // factor of k.
+      size_t smallIndex = primes.size();
+      if (prime <= small.root) {
+        smallIndex = std::lower_bound(primes.begin(), primes.end(), prime)
+                     - primes.begin();
+        values[0] = small.powers[smallIndex];
+      } else {
+        mpz_ui_pow_ui(values[0].get_mpz_t(), (unsigned long)prime,
+                      (unsigned long)power);
+      }
+      terms[0] = prime;
+      nextPrime[0] = 0;
+      lastPrime[0] = smallIndex;
+      sum += values[0];
+      long level = 0;
+      while (level >= 0) {
+        size_t i = nextPrime[level];
+        if (i >= primes.size() || i > lastPrime[level]
+            || primes[i] > n/terms[level]) {
+          level--;
+          continue;
+        }
+        if ((++numTerms & CANCELLATION_CHECK_MASK) == 0) {
+          CancellationToken::checkCurrent();
+        }
+        nextPrime[level]++;
+        mpz_mul(values[level + 1].get_mpz_t(), small.powers[i].get_mpz_t(),
+                values[level].get_mpz_t());
+        sum += values[level + 1];
+        level++;
+        terms[level] = terms[level - 1]*primes[i];
+        nextPrime[level] = 0;
+        lastPrime[level] = i;
+      }
+    }
+  }
+}
@@ -4,15 +4,50 @@
 #include <time.h>
 #include <gmpxx.h>
 
+#include <future>
+#include <memory>
+#include <mutex>
 #include <ostream>
+#include <stdexcept>
 #include <vector>
 
+#include "CancellationToken.h"
+#include "CoefficientArray.h"
+#include "CoefficientGenerator.h"
+#include "PowerSumStats.h"
+#include "ThreadPool.h"
+
+using std::future;
 using std::ostream;
+using std::shared_ptr;
 using std::vector;
 
+/* Thrown, before any work is done, by a computation predicted to need more
+ * memory than the limit set by setMemoryLimit
+ */
+class MemoryLimitExceeded : public std::runtime_error {
+  public:
+    MemoryLimitExceeded(double predictedBytes, double limitBytes);
+    double getPredictedBytes() const { return predictedBytes; }
+    double getLimitBytes() const { return limitBytes; }
+
+  private:
+    double predictedBytes;
+    double limitBytes;
+};
+
 class PowerSum {
   public:
-    PowerSum() {}
+    /* Methods available to add up the series in computeSumUsingSeries */
+    enum SeriesMethod {
+      SERIES_AUTO,       // Pick one of the methods below based on the power
+      SERIES_POWER,      // Compute every term k^m by exponentiation
+      SERIES_DIFFERENCE, // Advance k^m using a table of forward differences
+      SERIES_SIEVE       // Exponentiate primes only and multiply for composites
+    };
+
+    PowerSum() : seriesMethod(SERIES_AUTO), numThreads(1), memoryLimit(0),
+                 viewPower(-1) {}
     /* To get the coefficients in the sum formula.
      * Parameters:
      *   power - desired power (IN)
@@ -21,6 +56,37 @@ class PowerSum {
      */
     virtual vector<mpq_class> getCoefficients(long power) = 0;
 
+    /* To get the coefficients in the sum formula into an array of the caller.
+     * The memory of the array is reused, and formulas with integer
+     * coefficients store them as integers, so no mpq_class is created.
+     * Parameters:
+     *   power - desired power (IN)
+     *   coeffs - array in which the coefficients are returned (OUT)
+     */
+    virtual void getCoefficients(long power, CoefficientArray & coeffs);
+
+    /* To get the coefficients in the sum formula as a read-only view of
+     * storage kept by the formula.  The coefficients of the power asked for
+     * last are kept, so repeated calls for one power compute them once.  May
+     * be called from several threads at the same time.
+     * Parameters:
+     *   power - desired power (IN)
+     * Return value
+     *   coefficients, which stay valid for as long as the caller holds them
+     */
+    shared_ptr<const CoefficientArray> getCoefficientView(long power);
+
+    /* To get the coefficients in the sum formula one at a time.  Formulas
+     * that work out one coefficient per step hand each out as it is found;
+     * others work them all out on the first call of next.  The formula must
+     * stay alive while the generator is used.
+     * Parameters:
+     *   power - desired power (IN)
+     * Return value
+     *   generator of the coefficients
+     */
+    virtual std::unique_ptr<CoefficientGenerator> createGenerator(long power);
+
     /* To print the sum formula for a given power
      * Parameters:
      *   power - desired power (IN)
@@ -37,6 +103,19 @@ class PowerSum {
      */
     virtual mpz_class computeSum(long power, long n);
 
+    /* To compute the sum for a specific power and the number of terms and
+     * obtain measurements of the coefficient initialization and summation
+     * Parameters:
+     *   power - desired power (IN)
+     *   numTerms - number of terms (IN)
+     *   stats - times of the two phases, sizes of the coefficients and of the
+     *           sum and counts of the work done (OUT)
+     * Return value
+     *   sum computed
+     */
+    virtual mpz_class computeSumWithStats(long power, long n,
+                                          PowerSumStats & stats) = 0;
+
     /* To compute the sum for a specific power and the number of terms and
      * obtain CPU times
      * Parameters:
@@ -47,8 +126,23 @@ class PowerSum {
      * Return value
      *   sum computed
      */
-    virtual mpz_class computeSumWithTimeStat(long power, long n,
-                                             vector<long> & stat) = 0;
+    mpz_class computeSumWithTimeStat(long power, long n, vector<long> & stat);
+
+    /* To compute the sum from coefficients already obtained for the power, so
+     * that sums for many values of n share one set of coefficients.  May be
+     * called from several threads at the same time.
+     * Parameters:
+     *   coeffs - coefficients returned by getCoefficients(power, coeffs)
+     *            (IN)
+     *   power - desired power (IN)
+     *   numTerms - number of terms (IN)
+     * Return value
+     *   sum computed
+     */
+    virtual mpz_class computeSumUsingCoefficients(
+                        const CoefficientArray & coeffs, long power,
+                        long n) = 0;
+
     /* To compute the sum for a specific power and the number of terms using the
      * simple implementation (series summation)
      * Parameters:
@@ -59,11 +153,132 @@ class PowerSum {
      */
     virtual mpz_class computeSumUsingSeries(long power, long n);
 
+    /* To start computing the sum on a thread of its own.  The computation
+     * checks the token as it goes and stops soon after the token is cancelled
+     * or its deadline passes, in which case getting the result throws
+     * ComputationCancelled.
+     * Parameters:
+     *   power - desired power (IN)
+     *   numTerms - number of terms (IN)
+     *   token - token to stop the computation or NULL (IN)
+     * Return value
+     *   future that becomes ready with the sum computed
+     */
+    future<mpz_class> computeSumAsync(long power, long n,
+                                      shared_ptr<CancellationToken> token);
+
+    /* To start getting the coefficients on a thread of their own.  Stops like
+     * computeSumAsync.
+     * Parameters:
+     *   power - desired power (IN)
+     *   token - token to stop the computation or NULL (IN)
+     * Return value
+     *   future that becomes ready with the coefficients
+     */
+    future<vector<mpq_class> > getCoefficientsAsync(long power,
+                                       shared_ptr<CancellationToken> token);
+
+    /* To select the method used by computeSumUsingSeries
+     * Parameters:
+     *   method - method to use for the series summation (IN)
+     */
+    void setSeriesMethod(SeriesMethod method);
+
+    /* To set the number of threads used by the computations.  For
+     * computeSumUsingSeries, the terms are split into one part per thread, or
+     * for the sieve into several units of about equal work per thread, and
+     * the partial sums are combined in a fixed pairwise order.
+     * Formulas may use the threads in generating coefficients.
+     * Parameters:
+     *   threads - number of threads, 1 or more (IN)
+     */
+    virtual void setNumThreads(int threads);
+
+    /* To get the CPU time taken by the threads the computations of this
+     * object have started, besides the calling thread
+     * Return value
+     *   CPU time in nanoseconds, 0 while there are no such threads
+     */
+    long getHelperCpuTime();
+
+    /* To predict the most memory that computing the sum takes, from bounds
+     * on the sizes of the coefficients and of the numbers worked with.
+     * Counts GMP numbers and the packed copies of the coefficients, which is
+     * nearly all of the memory for large powers.
+     * Parameters:
+     *   power - desired power (IN)
+     *   numTerms - number of terms (IN)
+     * Return value
+     *   predicted bytes
+     */
+    virtual double predictMemory(long power, long n) = 0;
+
+    /* To predict the most memory that computeSumUsingSeries takes with the
+     * current number of threads, like predictMemory
+     * Parameters:
+     *   power - desired power (IN)
+     *   numTerms - number of terms (IN)
+     * Return value
+     *   predicted bytes
+     */
+    double predictSeriesMemory(long power, long n);
+
+    /* To set the most memory a computation of a sum is allowed.  Sums
+     * predicted to need more throw MemoryLimitExceeded before they start,
+     * and so do the coefficients and formulas of a power predicted to need
+     * more than a sum of power terms.
+     * Parameters:
+     *   bytes - limit in bytes, 0 for no limit (IN)
+     */
+    virtual void setMemoryLimit(double bytes);
+
     virtual ~PowerSum() {}
     // Some useful implementations for use in derived classes
   protected:
-    long computeCpuTime(struct timespec & before, struct timespec & after);
+    // Primes up to sqrt(n) and their powers, which every unit of the sieve
+    // multiplies by
+    struct SievePrimes {
+      long root;
+      vector<long> primes;
+      vector<mpz_class> powers;
+    };
+
     mpz_class nCr(long n, long r);
+    double log2nCr(long n, long r);
+    double log2Bernoulli(long i);
+    double log2Sum(long power, long n);
+    double numberBytes(double bits);
+    double getMemoryLimit();
+    void checkMemoryLimit(double predictedBytes);
+    void reserveBits(mpz_class & value, double bits);
+    ThreadPool * getThreadPool();
+    mpq_class evaluatePolynomial(const CoefficientArray & coeffs,
+                                 const mpz_class & x, long & multiplications);
+    vector<mpq_class> moveToRationals(vector<mpz_class> & coeffs);
+    void packCoefficients(const vector<mpz_class> & coeffs, size_t count,
+                          CoefficientArray & packed);
+    void packCoefficients(const vector<mpq_class> & coeffs, size_t count,
+                          CoefficientArray & packed);
+    SeriesMethod resolveSeriesMethod(long power);
+    void addSeriesPart(SeriesMethod method, long power, long n, long part,
+                       long numParts, mpz_class & sum);
+    void addPowersInRange(long power, long from, long to, mpz_class & sum);
+    void addPowersUsingDifferences(long power, long from, long to,
+                                   mpz_class & sum);
+    mpz_class addPowersUsingSieve(long power, long n);
+    void getSievePrimes(long power, long n, SievePrimes & small);
+    void addSieveUnit(long power, long n, const SievePrimes & small,
+                      long from, long to, mpz_class & sum);
+
+  private:
+    SeriesMethod seriesMethod;
+    int numThreads;
+    double memoryLimit;
+    std::unique_ptr<ThreadPool> threadPool;
+    std::mutex threadPoolLock;
+    long viewPower;
+    shared_ptr<const CoefficientArray> view;
+    std::mutex viewLock;
 };
 
 #endif
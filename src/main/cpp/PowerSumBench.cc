@@ -0,0 +1,951 @@
+/* Benchmark of the formulas over a grid of powers and numbers of terms,
+ * run in a single process.  Every (formula, power, numTerms) point is run a
+ * few times to warm up and then a number of times measured.  For each phase
+ * (coefficient initialization, summation and their total) the median, 90th
+ * and 99th percentiles, mean, standard deviation, minimum and maximum of the
+ * CPU time of the process in nanoseconds are reported as a table, CSV or
+ * JSON, followed by the same for the wall time of both phases.  The CPU time
+ * of the process includes the work the formulas hand to their threads.
+ * Bernoulli and Faulhaber add up the coefficients as they are generated, so
+ * their init phase only sets up the generation.  For a measure of the
+ * coefficients that is the same for every formula, the generation of all of
+ * them by getCoefficients is timed once per power as phase "coeff", which
+ * is reported with 0 terms.
+ *
+ * The samples can be saved as a baseline and a later run compared with it.
+ * A point of a CPU time phase has regressed when its median is slower than
+ * the baseline by more than a threshold and a one-sided Mann-Whitney U test
+ * finds the samples slower at a significance level.  Points faster than a
+ * minimum time are left out, as timer and scheduling noise swamps them.  The
+ * regressed points are printed to standard error and the exit status is 2.
+ *
+ * In scaling mode the grid is run instead with 1, 2, 4, ... threads up to the
+ * number of hardware threads.  The median wall times of coefficient
+ * initialization, summation and the series addition are reported with the
+ * speed-up over one thread and the parallel efficiency, speed-up/threads.
+ *
+ * Usage: PowerSumBench [<options>]
+ */
+#include <math.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "PowerSumRegistry.h"
+#include "StirlingPowerSum.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::invalid_argument;
+using std::ifstream;
+using std::istringstream;
+using std::ofstream;
+using std::setw;
+using std::stoi;
+using std::stol;
+using std::string;
+using std::vector;
+
+// Grid of tests/runPerformanceTests.sh
+static const long DEFAULT_POWERS[] = {
+  10, 15, 20, 50, 100, 200, 500, 1000, 2000, 3000, 4000
+};
+static const long DEFAULT_TERMS[] = {
+  10, 25, 50, 75, 100, 250, 500, 750, 1000, 2000, 5000, 7500, 10000, 20000,
+  50000, 75000, 100000, 200000, 500000, 750000, 1000000
+};
+
+enum OutputFormat {
+  FORMAT_TEXT,
+  FORMAT_CSV,
+  FORMAT_JSON
+};
+
+// Exit status when a regression is found, besides EXIT_FAILURE for errors
+static const int EXIT_REGRESSION = 2;
+
+// Clock of the init, sum and total phases, as saved in the baseline
+static const char * const CPU_CLOCK = "process_cpu";
+
+// Mann-Whitney U p-values are exact up to this many samples on either side
+// and taken from the normal approximation above
+static const size_t MAX_EXACT_SAMPLES = 25;
+
+// Samples of one phase of one point of the grid
+struct Result {
+  string engine;
+  long power;
+  long terms;
+  string phase;
+  vector<long> samples;
+};
+
+// Statistics of the samples of one phase
+struct Summary {
+  long median;
+  long p90;
+  long p99;
+  double mean;
+  double stddev;
+  long min;
+  long max;
+};
+
+static void usage(const string & commandName) {
+  cerr << "Usage: " << commandName << " [<options>]" << endl << endl
+  << "Options:" << endl
+  << "--powers <power>[,<power>...]" << endl
+  << "    Powers to run (default: the grid of runPerformanceTests.sh)" << endl
+  << "--terms <numTerms>[,<numTerms>...]" << endl
+  << "    Numbers of terms to run (default: the grid of"
+  << " runPerformanceTests.sh)" << endl
+  << "--engines <name>[,<name>...]" << endl
+  << "    Formulas to run, from " << PowerSumRegistry::listNames() << endl
+  << "    (default is all but auto)" << endl
+  << "--repetitions <count>" << endl
+  << "    Measured runs per point (default 5)" << endl
+  << "--warmup <count>" << endl
+  << "    Runs per point before measuring (default 1)" << endl
+  << "--threads <count>" << endl
+  << "    Threads used by the formulas (default 1)" << endl
+  << "--series" << endl
+  << "    Also time the series addition of computeSumUsingSeries" << endl
+
+  << "--scaling" << endl
+  << "    Run the grid with 1, 2, 4, ... threads and report the speed-up and"
+  << endl
+  << "    efficiency of the wall times of init, sum and series" << endl
+  << "--max-threads <count>" << endl
+  << "    Most threads of --scaling (default the hardware threads)" << endl
+  << "--pin" << endl
+  << "    With --scaling, run n threads on the first n CPUs only" << endl
+  << "--format (text|csv|json)" << endl
+  << "    Output format (default text)" << endl
+  << "--save-baseline <file>" << endl
+  << "    Write the samples of every point to file as JSON" << endl
+  << "--baseline <file>" << endl
+  << "    Compare the coeff, init, sum and total CPU times with a saved"
+  << endl
+  << "    baseline and exit with status 2 if any point has regressed.  The"
+  << endl
+  << "    baseline has to be measured with the same clock, the CPU time of"
+  << endl
+  << "    the process" << endl
+
+  << "--threshold <percent>" << endl
+  << "    Slow-down of the median that counts as a regression (default 10)"
+  << endl
+  << "--min-time <ns>" << endl
+  << "    Points with a faster baseline median are too noisy to compare"
+  << endl
+  << "    (default 100000)" << endl
+  << "--alpha <level>" << endl
+  << "    Significance level of the test (default 0.05)" << endl << endl
+  << "Besides the init, sum, total and wall phases of each point, phase"
+  << endl
+  << "coeff times getCoefficients once per formula and power with 0 terms."
+  << endl
+  << "Bernoulli and Faulhaber generate their coefficients in the sum phase,"
+  << endl
+  << "so coeff rather than init compares the coefficients of all formulas."
+  << endl;
+}
+
+static void error(const string & commandName, const string & message) {
+  cerr << message << endl;
+  usage(commandName);
+  exit(EXIT_FAILURE);
+}
+
+static vector<long> parseList(const string & commandName, const string & value,
+                              long minimum) {
+  vector<long> list;
+  istringstream in(value);
+  string item;
+  while (std::getline(in, item, ',')) {
+    try {
+      size_t used;
+      long number = stol(item, &used);
+      if (used != item.size() || number < minimum) {
+        throw invalid_argument("");
+      }
+      list.push_back(number);
+    } catch(...) {
+      error(commandName, "Invalid list: " + value);
+    }
+  }
+  if (list.empty()) {
+    error(commandName, "Invalid list: " + value);
+  }
+  return list;
+}
+
+/**
+ * Percentiles are taken by the nearest rank method.  The median of an even
+ * number of samples is the mean of the middle two.
+ */
+static Summary summarize(vector<long> samples) {
+  Summary summary;
+  std::sort(samples.begin(), samples.end());
+  size_t count = samples.size();
+  summary.min = samples.front();
+  summary.max = samples.back();
+  if (count & 1) {
+    summary.median = samples[count/2];
+  } else {
+    summary.median = (samples[count/2 - 1] + samples[count/2])/2;
+  }
+  summary.p90 = samples[(size_t)ceil(0.90*count) - 1];
+  summary.p99 = samples[(size_t)ceil(0.99*count) - 1];
+
+  double sum = 0;
+  for (size_t i = 0; i < count; i++) {
+    sum += samples[i];
+  }
+  summary.mean = sum/count;
+  double squares = 0;
+  for (size_t i = 0; i < count; i++) {
+    squares += (samples[i] - summary.mean)*(samples[i] - summary.mean);
+  }
+  summary.stddev = (count > 1) ? sqrt(squares/(count - 1)) : 0;
+  return summary;
+}
+
+// Prints one line per phase as the results come in
+class Report {
+  public:
+    Report(OutputFormat format, int repetitions, int warmup, int threads)
+      : format(format), repetitions(repetitions), firstRow(true) {
+      if (format == FORMAT_CSV) {
+        cout << "engine,power,terms,phase,repetitions,median_ns,p90_ns,p99_ns,"
+             << "mean_ns,stddev_ns,min_ns,max_ns" << endl;
+      } else if (format == FORMAT_JSON) {
+        cout << "{" << endl
+             << "  \"repetitions\": " << repetitions << "," << endl
+             << "  \"warmup\": " << warmup << "," << endl
+             << "  \"threads\": " << threads << "," << endl
+             << "  \"clock\": \"" << CPU_CLOCK << "\"," << endl
+             << "  \"results\": [";
+      } else {
+        cout << "Repetitions = " << repetitions << ", warm-up = " << warmup
+             << ", threads = " << threads
+             << " (process CPU and wall times in ns)" << endl
+             << setw(10) << "Engine" << setw(6) << "Power" << setw(9)
+             << "Terms" << setw(7) << "Phase" << setw(12) << "Median"
+             << setw(12) << "P90" << setw(12) << "P99" << setw(12)
+             << "Stddev" << endl;
+      }
+    }
+
+    void add(const string & engine, long power, long terms,
+             const string & phase, const vector<long> & samples) {
+      Result result = {engine, power, terms, phase, samples};
+      results.push_back(result);
+      Summary s = summarize(samples);
+      std::ostringstream mean;
+      std::ostringstream stddev;
+      mean << std::fixed << std::setprecision(1) << s.mean;
+      stddev << std::fixed << std::setprecision(1) << s.stddev;
+      if (format == FORMAT_CSV) {
+        cout << engine << ',' << power << ',' << terms << ',' << phase << ','
+             << repetitions << ',' << s.median << ',' << s.p90 << ','
+             << s.p99 << ',' << mean.str() << ',' << stddev.str() << ','
+             << s.min << ',' << s.max << endl;
+      } else if (format == FORMAT_JSON) {
+        cout << (firstRow ? "" : ",") << endl
+             << "    {\"engine\": \"" << engine << "\", \"power\": " << power
+             << ", \"terms\": " << terms << ", \"phase\": \"" << phase
+             << "\", \"median_ns\": " << s.median << ", \"p90_ns\": "
+             << s.p90 << ", \"p99_ns\": " << s.p99 << ", \"mean_ns\": "
+             << mean.str() << ", \"stddev_ns\": " << stddev.str()
+             << ", \"min_ns\": " << s.min << ", \"max_ns\": " << s.max << "}";
+      } else {
+        cout << setw(10) << engine << setw(6) << power << setw(9) << terms
+             << setw(7) << phase << setw(12) << s.median << setw(12) << s.p90
+             << setw(12) << s.p99 << setw(12) << stddev.str() << endl;
+      }
+      firstRow = false;
+    }
+
+    // To end the output
+    void finish() {
+      if (format == FORMAT_JSON) {
+        cout << endl << "  ]" << endl << "}" << endl;
+      }
+    }
+
+    const vector<Result> & getResults() const {
+      return results;
+    }
+
+  private:
+    vector<Result> results;
+    OutputFormat format;
+    int repetitions;
+    bool firstRow;
+};
+
+static void benchmarkFormula(const string & name, PowerSum & ps, long power,
+                             long terms, int warmup, int repetitions,
+                             Report & report) {
+  PowerSumStats stats;
+  for (int run = 0; run < warmup; run++) {
+    ps.computeSumWithStats(power, terms, stats);
+  }
+  vector<long> init;
+  vector<long> sum;
+  vector<long> total;
+  vector<long> wall;
+  for (int run = 0; run < repetitions; run++) {
+    ps.computeSumWithStats(power, terms, stats);
+    init.push_back(stats.init.processCpuTime);
+    sum.push_back(stats.sum.processCpuTime);
+    total.push_back(stats.init.processCpuTime + stats.sum.processCpuTime);
+    wall.push_back(stats.init.wallTime + stats.sum.wallTime);
+  }
+  report.add(name, power, terms, "init", init);
+  report.add(name, power, terms, "sum", sum);
+  report.add(name, power, terms, "total", total);
+  report.add(name, power, terms, "wall", wall);
+}
+
+static void benchmarkCoefficients(const string & name, PowerSum & ps,
+                                  long power, int warmup, int repetitions,
+                                  Report & report) {
+  struct timespec before;
+  struct timespec after;
+  for (int run = 0; run < warmup; run++) {
+    CoefficientArray coeffs;
+    ps.getCoefficients(power, coeffs);
+  }
+  vector<long> total;
+  for (int run = 0; run < repetitions; run++) {
+    CoefficientArray coeffs;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &before);
+    ps.getCoefficients(power, coeffs);
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &after);
+    total.push_back(elapsedNano(before, after));
+  }
+  report.add(name, power, 0, "coeff", total);
+}
+
+static void benchmarkSeries(PowerSum & ps, long power, long terms,
+                            int warmup, int repetitions, Report & report) {
+  struct timespec before;
+  struct timespec after;
+  for (int run = 0; run < warmup; run++) {
+    ps.computeSumUsingSeries(power, terms);
+  }
+  vector<long> total;
+  for (int run = 0; run < repetitions; run++) {
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &before);
+    ps.computeSumUsingSeries(power, terms);
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &after);
+    total.push_back(elapsedNano(before, after));
+  }
+  report.add("series", power, terms, "total", total);
+}
+
+// Thread counts of --scaling: powers of 2 below maxThreads, then maxThreads
+static vector<int> scalingThreadCounts(int maxThreads) {
+  vector<int> counts;
+  for (int count = 1; count < maxThreads; count *= 2) {
+    counts.push_back(count);
+  }
+  counts.push_back(maxThreads);
+  return counts;
+}
+
+/**
+ * Threads inherit the CPUs of the thread that starts them, so restricting
+ * the calling thread before the formulas create their pools pins the pools
+ * too.  The CPUs are the first count of those the process was allowed to
+ * run on at the start.
+ */
+static bool pinToCpus(int count) {
+#ifdef __linux__
+  static cpu_set_t allowed;
+  static bool haveAllowed = false;
+  if (!haveAllowed) {
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+      return false;
+    }
+    haveAllowed = true;
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  int numPinned = 0;
+  for (int cpu = 0; cpu < CPU_SETSIZE && numPinned < count; cpu++) {
+    if (CPU_ISSET(cpu, &allowed)) {
+      CPU_SET(cpu, &set);
+      numPinned++;
+    }
+  }
+  return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+  return false;
+#endif
+}
+
+// Prints the scaling of one phase as the thread counts come in.  The wall
+// time of one thread is kept to work out the speed-up of the others.
+class ScalingReport {
+  public:
+    ScalingReport(OutputFormat format, int repetitions, int warmup,
+                  bool pinned)
+      : format(format), firstRow(true) {
+      if (format == FORMAT_CSV) {
+        cout << "engine,power,terms,phase,threads,median_wall_ns,speedup,"
+             << "efficiency" << endl;
+      } else if (format == FORMAT_JSON) {
+        cout << "{" << endl
+             << "  \"repetitions\": " << repetitions << "," << endl
+             << "  \"warmup\": " << warmup << "," << endl
+             << "  \"pinned\": " << (pinned ? "true" : "false") << ","
+             << endl
+             << "  \"results\": [";
+      } else {
+        cout << "Repetitions = " << repetitions << ", warm-up = " << warmup
+             << ", pinned = " << (pinned ? "yes" : "no")
+             << " (median wall times in ns)" << endl
+             << setw(10) << "Engine" << setw(6) << "Power" << setw(9)
+             << "Terms" << setw(8) << "Phase" << setw(8) << "Threads"
+             << setw(12) << "Wall" << setw(9) << "Speed-up" << setw(11)
+             << "Efficiency" << endl;
+      }
+    }
+
+    void add(const string & engine, long power, long terms,
+             const string & phase, int threads, vector<long> samples) {
+      std::sort(samples.begin(), samples.end());
+      size_t count = samples.size();
+      long median = (count & 1) ? samples[count/2]
+                                : (samples[count/2 - 1] + samples[count/2])/2;
+      std::ostringstream key;
+      key << engine << ' ' << power << ' ' << terms << ' ' << phase;
+      if (threads == 1) {
+        singleThreaded[key.str()] = median;
+      }
+      long base = singleThreaded[key.str()];
+      double speedup = (median > 0) ? (double)base/median : 0;
+      std::ostringstream speedupText;
+      std::ostringstream efficiencyText;
+      speedupText << std::fixed << std::setprecision(2) << speedup;
+      efficiencyText << std::fixed << std::setprecision(2)
+                     << speedup/threads;
+      if (format == FORMAT_CSV) {
+        cout << engine << ',' << power << ',' << terms << ',' << phase << ','
+             << threads << ',' << median << ',' << speedupText.str() << ','
+             << efficiencyText.str() << endl;
+      } else if (format == FORMAT_JSON) {
+        cout << (firstRow ? "" : ",") << endl
+             << "    {\"engine\": \"" << engine << "\", \"power\": " << power
+             << ", \"terms\": " << terms << ", \"phase\": \"" << phase
+             << "\", \"threads\": " << threads << ", \"median_wall_ns\": "
+             << median << ", \"speedup\": " << speedupText.str()
+             << ", \"efficiency\": " << efficiencyText.str() << "}";
+      } else {
+        cout << setw(10) << engine << setw(6) << power << setw(9) << terms
+             << setw(8) << phase << setw(8) << threads << setw(12) << median
+             << setw(9) << speedupText.str() << setw(11)
+             << efficiencyText.str() << endl;
+      }
+      firstRow = false;
+    }
+
+    void finish() {
+      if (format == FORMAT_JSON) {
+        cout << endl << "  ]" << endl << "}" << endl;
+      }
+    }
+
+  private:
+    OutputFormat format;
+    bool firstRow;
+    std::map<string, long> singleThreaded;
+};
+
+static void scaleFormula(const string & name, PowerSum & ps, long power,
+                         long terms, int threads, int warmup,
+                         int repetitions, ScalingReport & report) {
+  PowerSumStats stats;
+  for (int run = 0; run < warmup; run++) {
+    ps.computeSumWithStats(power, terms, stats);
+  }
+  vector<long> init;
+  vector<long> sum;
+  for (int run = 0; run < repetitions; run++) {
+    ps.computeSumWithStats(power, terms, stats);
+    init.push_back(stats.init.wallTime);
+    sum.push_back(stats.sum.wallTime);
+  }
+  report.add(name, power, terms, "init", threads, init);
+  report.add(name, power, terms, "sum", threads, sum);
+}
+
+static void scaleSeries(PowerSum & ps, long power, long terms, int threads,
+                        int warmup, int repetitions, ScalingReport & report) {
+  struct timespec before;
+  struct timespec after;
+  for (int run = 0; run < warmup; run++) {
+    ps.computeSumUsingSeries(power, terms);
+  }
+  vector<long> wall;
+  for (int run = 0; run < repetitions; run++) {
+    clock_gettime(CLOCK_MONOTONIC, &before);
+    ps.computeSumUsingSeries(power, terms);
+    clock_gettime(CLOCK_MONOTONIC, &after);
+    wall.push_back(elapsedNano(before, after));
+  }
+  report.add("series", power, terms, "series", threads, wall);
+}
+
+/**
+ * One result per line, so that readBaseline can take the file apart without
+ * a JSON parser
+ */
+static void writeBaseline(const string & fileName, int repetitions,
+                          int threads, const vector<Result> & results) {
+  ofstream out(fileName.c_str());
+  out << "{" << endl
+      << "  \"repetitions\": " << repetitions << "," << endl
+      << "  \"threads\": " << threads << "," << endl
+      << "  \"clock\": \"" << CPU_CLOCK << "\"," << endl
+      << "  \"results\": [";
+  for (size_t r = 0; r < results.size(); r++) {
+    const Result & result = results[r];
+    out << (r == 0 ? "" : ",") << endl
+        << "    {\"engine\": \"" << result.engine << "\", \"power\": "
+        << result.power << ", \"terms\": " << result.terms
+        << ", \"phase\": \"" << result.phase << "\", \"samples_ns\": [";
+    for (size_t i = 0; i < result.samples.size(); i++) {
+      out << (i == 0 ? "" : ", ") << result.samples[i];
+    }
+    out << "]}";
+  }
+  out << endl << "  ]" << endl << "}" << endl;
+  if (!out) {
+    throw std::runtime_error("Cannot write baseline: " + fileName);
+  }
+}
+
+// Value of "key": in a line of a baseline, up to the next , ] or }
+static string baselineField(const string & line, const string & key) {
+  string quoted = "\"" + key + "\": ";
+  size_t start = line.find(quoted);
+  if (start == string::npos) {
+    throw std::runtime_error("Missing " + key + " in baseline: " + line);
+  }
+  start += quoted.size();
+  if (line[start] == '"') {
+    return line.substr(start + 1, line.find('"', start + 1) - start - 1);
+  }
+  if (line[start] == '[') {
+    return line.substr(start + 1, line.find(']', start) - start - 1);
+  }
+  return line.substr(start, line.find_first_of(",]}", start) - start);
+}
+
+/**
+ * Baselines saved before the clock was recorded took the CPU time of the
+ * calling thread only
+ */
+static vector<Result> readBaseline(const string & fileName, int & threads,
+                                   string & clock) {
+  ifstream in(fileName.c_str());
+  if (!in) {
+    throw std::runtime_error("Cannot read baseline: " + fileName);
+  }
+  vector<Result> results;
+  threads = 0;
+  clock = "thread_cpu";
+  string line;
+  while (std::getline(in, line)) {
+    if (line.find("\"threads\": ") != string::npos
+        && line.find("\"engine\"") == string::npos) {
+      threads = stoi(baselineField(line, "threads"));
+    }
+    if (line.find("\"clock\": ") != string::npos) {
+      clock = baselineField(line, "clock");
+    }
+    if (line.find("\"engine\": ") == string::npos) {
+      continue;
+    }
+    Result result;
+    result.engine = baselineField(line, "engine");
+    result.power = stol(baselineField(line, "power"));
+    result.terms = stol(baselineField(line, "terms"));
+    result.phase = baselineField(line, "phase");
+    istringstream samples(baselineField(line, "samples_ns"));
+    string sample;
+    while (std::getline(samples, sample, ',')) {
+      result.samples.push_back(stol(sample));
+    }
+    if (result.samples.empty()) {
+      throw std::runtime_error("No samples in baseline: " + line);
+    }
+    results.push_back(result);
+  }
+  return results;
+}
+
+/**
+ * One-sided Mann-Whitney U test of the alternative that the samples of after
+ * tend to be larger than those of before.  U counts the pairs in which the
+ * sample of after is the larger one, ties counting half.  For small samples
+ * the p-value P(U0 >= U) comes from the exact distribution of U0 under the
+ * null hypothesis: the number of orderings of m and n samples with U0 = u
+ * is c(m, n, u) = c(m - 1, n, u - n) + c(m, n - 1, u).  Larger samples use
+ * the normal approximation with a continuity correction.
+ */
+static double mannWhitneyPValue(const vector<long> & before,
+                                const vector<long> & after) {
+  size_t m = after.size();
+  size_t n = before.size();
+  double u = 0;
+  for (size_t i = 0; i < m; i++) {
+    for (size_t j = 0; j < n; j++) {
+      if (after[i] > before[j]) {
+        u += 1;
+      } else if (after[i] == before[j]) {
+        u += 0.5;
+      }
+    }
+  }
+  if (m > MAX_EXACT_SAMPLES || n > MAX_EXACT_SAMPLES) {
+    double mean = m*n/2.0;
+    double deviation = sqrt(m*n*(m + n + 1)/12.0);
+    return 0.5*erfc((u - 0.5 - mean)/deviation/sqrt(2.0));
+  }
+
+  // counts[a][b][v] for a of m and b of n samples
+  size_t maxU = m*n;
+  vector<vector<vector<double> > > counts(m + 1,
+    vector<vector<double> >(n + 1, vector<double>(maxU + 1, 0)));
+  for (size_t a = 0; a <= m; a++) {
+    for (size_t b = 0; b <= n; b++) {
+      if (a == 0 || b == 0) {
+        counts[a][b][0] = 1;
+        continue;
+      }
+      for (size_t v = 0; v <= a*b; v++) {
+        counts[a][b][v] = counts[a][b - 1][v]
+                          + (v >= b ? counts[a - 1][b][v - b] : 0);
+      }
+    }
+  }
+  double total = 0;
+  double atLeast = 0;
+  for (size_t v = 0; v <= maxU; v++) {
+    total += counts[m][n][v];
+    if (v + 1e-9 >= u) {
+      atLeast += counts[m][n][v];
+    }
+  }
+  return atLeast/total;
+}
+
+static long median(vector<long> samples) {
+  std::sort(samples.begin(), samples.end());
+  size_t count = samples.size();
+  return (count & 1) ? samples[count/2]
+                     : (samples[count/2 - 1] + samples[count/2])/2;
+}
+
+/**
+ * Points of the baseline that were not run this time, and the other way
+ * round, are skipped
+ */
+static bool compareWithBaseline(const vector<Result> & baseline,
+                                const vector<Result> & results,
+                                double threshold, double alpha,
+                                long minTime) {
+  size_t compared = 0;
+  size_t regressed = 0;
+  for (size_t r = 0; r < results.size(); r++) {
+    const Result & result = results[r];
+    if (result.phase != "coeff" && result.phase != "init"
+        && result.phase != "sum" && result.phase != "total") {
+      continue;
+    }
+    for (size_t b = 0; b < baseline.size(); b++) {
+      const Result & base = baseline[b];
+      if (base.engine != result.engine || base.power != result.power
+          || base.terms != result.terms || base.phase != result.phase) {
+        continue;
+      }
+      long before = median(base.samples);
+      long after = median(result.samples);
+      if (before < minTime) {
+        break;
+      }
+      compared++;
+      double change = (before > 0) ? 100.0*(after - before)/before : 0;
+      if (change <= threshold) {
+        break;
+      }
+      double p = mannWhitneyPValue(base.samples, result.samples);
+      if (p < alpha) {
+        if (regressed == 0) {
+          cerr << "Regressions against the baseline:" << endl;
+        }
+        regressed++;
+        cerr << "  " << result.engine << " power " << result.power
+             << " terms " << result.terms << " " << result.phase
+             << ": median " << before << " -> " << after << " ns ("
+             << std::fixed << std::setprecision(1) << '+' << change
+             << "%, p = " << std::setprecision(4) << p << ")" << endl;
+        cerr.unsetf(std::ios::floatfield);
+      }
+      break;
+    }
+  }
+  cerr << "Compared " << compared << " points with the baseline, "
+       << regressed << " regressed" << endl;
+  return regressed > 0;
+}
+
+int main(int argc, char ** argv) {
+  string commandName = argv[0];
+  vector<long> powers(DEFAULT_POWERS, DEFAULT_POWERS
+                      + sizeof(DEFAULT_POWERS)/sizeof(DEFAULT_POWERS[0]));
+  vector<long> terms(DEFAULT_TERMS, DEFAULT_TERMS
+                     + sizeof(DEFAULT_TERMS)/sizeof(DEFAULT_TERMS[0]));
+  int repetitions = 5;
+  int warmup = 1;
+  int threads = 1;
+  bool series = false;
+  OutputFormat format = FORMAT_TEXT;
+  string saveBaselineFile;
+  string baselineFile;
+  double threshold = 10;
+  long minTime = 100000;
+  double alpha = 0.05;
+  bool scaling = false;
+  int maxThreads = (int)std::thread::hardware_concurrency();
+  bool pin = false;
+  vector<const PowerSumEngine *> engines =
+    PowerSumRegistry::getDefaultEngines();
+
+  for (int i = 1; i < argc; i++) {
+    string option = argv[i];
+    if (option == "-h" || option == "--help") {
+      usage(commandName);
+      return EXIT_SUCCESS;
+    }
+    // Options without a value
+    if (option == "--series") {
+      series = true;
+      continue;
+    }
+    if (option == "--scaling") {
+      scaling = true;
+      continue;
+    }
+    if (option == "--pin") {
+      pin = true;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      error(commandName, "Missing value for option: " + option);
+    }
+    string value = argv[++i];
+    if (option == "--powers") {
+      powers = parseList(commandName, value, 0);
+    } else if (option == "--terms") {
+      terms = parseList(commandName, value, 0);
+    } else if (option == "--engines") {
+      engines.clear();
+      istringstream names(value);
+      string name;
+      while (getline(names, name, ',')) {
+        const PowerSumEngine * engine = PowerSumRegistry::find(name);
+        if (engine == NULL) {
+          error(commandName, "Invalid engine: " + name);
+        }
+        engines.push_back(engine);
+      }
+      if (engines.empty()) {
+        error(commandName, "Invalid engine: " + value);
+      }
+    } else if (option == "--repetitions" || option == "--warmup"
+               || option == "--threads" || option == "--max-threads") {
+      int count = 0;
+      try {
+        count = stoi(value);
+        if (count < (option == "--warmup" ? 0 : 1)) {
+          throw invalid_argument("");
+        }
+      } catch(...) {
+        error(commandName, "Invalid count: " + value);
+      }
+      if (option == "--repetitions") {
+        repetitions = count;
+      } else if (option == "--warmup") {
+        warmup = count;
+      } else if (option == "--threads") {
+        threads = count;
+      } else {
+        maxThreads = count;
+      }
+    } else if (option == "--save-baseline") {
+      saveBaselineFile = value;
+    } else if (option == "--baseline") {
+      baselineFile = value;
+    } else if (option == "--min-time") {
+      try {
+        size_t used;
+        minTime = stol(value, &used);
+        if (used != value.size() || minTime < 0) {
+          throw invalid_argument("");
+        }
+      } catch(...) {
+        error(commandName, "Invalid value: " + value);
+      }
+    } else if (option == "--threshold" || option == "--alpha") {
+      double number = 0;
+      try {
+        size_t used;
+        number = std::stod(value, &used);
+        if (used != value.size() || number < 0
+            || (option == "--alpha" && number > 1)) {
+          throw invalid_argument("");
+        }
+      } catch(...) {
+        error(commandName, "Invalid value: " + value);
+      }
+      if (option == "--threshold") {
+        threshold = number;
+      } else {
+        alpha = number;
+      }
+    } else if (option == "--format") {
+      if (value == "text") {
+        format = FORMAT_TEXT;
+      } else if (value == "csv") {
+        format = FORMAT_CSV;
+      } else if (value == "json") {
+        format = FORMAT_JSON;
+      } else {
+        error(commandName, "Invalid format: " + value);
+      }
+    } else {
+      error(commandName, "Invalid option: " + option);
+    }
+  }
+
+  if (scaling && (!baselineFile.empty() || !saveBaselineFile.empty())) {
+    error(commandName, "--scaling does not take a baseline");
+  }
+  // hardware_concurrency is 0 when it is not known
+  if (maxThreads < 1) {
+    maxThreads = 1;
+  }
+
+  // Read the baseline first so that a bad file does not waste a run
+  vector<Result> baseline;
+  if (!baselineFile.empty()) {
+    int baselineThreads = 0;
+    string baselineClock;
+    try {
+      baseline = readBaseline(baselineFile, baselineThreads, baselineClock);
+    } catch (std::exception & e) {
+      cerr << e.what() << endl;
+      return EXIT_FAILURE;
+    }
+    if (baselineClock != CPU_CLOCK) {
+      cerr << "The baseline was measured with the " << baselineClock
+           << " clock instead of " << CPU_CLOCK << ", save it again" << endl;
+      return EXIT_FAILURE;
+    }
+    if (baselineThreads != threads) {
+      cerr << "Warning: the baseline was run with " << baselineThreads
+           << " threads" << endl;
+    }
+  }
+
+  vector<std::unique_ptr<PowerSum> > formulas;
+  for (size_t f = 0; f < engines.size(); f++) {
+    formulas.push_back(engines[f]->create());
+    formulas[f]->setNumThreads(threads);
+  }
+  StirlingPowerSum sps;
+  sps.setNumThreads(threads);
+
+  if (scaling) {
+    ScalingReport report(format, repetitions, warmup, pin);
+    vector<int> counts = scalingThreadCounts(maxThreads);
+    for (size_t c = 0; c < counts.size(); c++) {
+      if (pin && !pinToCpus(counts[c])) {
+        cerr << "Cannot pin to " << counts[c] << " CPUs" << endl;
+        return EXIT_FAILURE;
+      }
+      for (size_t f = 0; f < formulas.size(); f++) {
+        formulas[f]->setNumThreads(counts[c]);
+      }
+      sps.setNumThreads(counts[c]);
+      for (size_t p = 0; p < powers.size(); p++) {
+        for (size_t t = 0; t < terms.size(); t++) {
+          for (size_t f = 0; f < formulas.size(); f++) {
+            scaleFormula(engines[f]->name, *formulas[f], powers[p], terms[t],
+                         counts[c], warmup, repetitions, report);
+          }
+          scaleSeries(sps, powers[p], terms[t], counts[c], warmup,
+                      repetitions, report);
+        }
+      }
+    }
+    report.finish();
+    return EXIT_SUCCESS;
+  }
+
+  Report report(format, repetitions, warmup, threads);
+  for (size_t p = 0; p < powers.size(); p++) {
+    for (size_t f = 0; f < formulas.size(); f++) {
+      benchmarkCoefficients(engines[f]->name, *formulas[f], powers[p],
+                            warmup, repetitions, report);
+    }
+    for (size_t t = 0; t < terms.size(); t++) {
+      for (size_t f = 0; f < formulas.size(); f++) {
+        benchmarkFormula(engines[f]->name, *formulas[f], powers[p], terms[t],
+                         warmup, repetitions, report);
+      }
+      if (series) {
+        benchmarkSeries(sps, powers[p], terms[t], warmup, repetitions,
+                        report);
+      }
+    }
+  }
+  report.finish();
+
+  if (!saveBaselineFile.empty()) {
+    try {
+      writeBaseline(saveBaselineFile, repetitions, threads,
+                    report.getResults());
+    } catch (std::exception & e) {
+      cerr << e.what() << endl;
+      return EXIT_FAILURE;
+    }
+  }
+  if (!baselineFile.empty()
+      && compareWithBaseline(baseline, report.getResults(), threshold,
+                             alpha, minTime)) {
+    return EXIT_REGRESSION;
+  }
+  return EXIT_SUCCESS;
+}
@@ -1,30 +1,45 @@
+#include <errno.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 #include <time.h>
 
+#include <algorithm>
+#include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
 #include <set>
 #include <sstream>
 #include <string>
+#include <thread>
 
-#include "BernoulliPowerSum.h"
-#include "CentralFactorialPowerSum.h"
-#include "EulerPowerSum.h"
-#include "FaulhaberPowerSum.h"
+#include "AutoPowerSum.h"
+#include "GmpAllocator.h"
+#include "ModularSeriesSum.h"
+#include "PerfCounters.h"
 #include "PowerSum.h"
+#include "PowerSumRegistry.h"
 #include "StirlingPowerSum.h"
+#include "Trace.h"
 
 using std::cerr;
 using std::cout;
 using std::endl;
 using std::invalid_argument;
+using std::istringstream;
+using std::ofstream;
+using std::ostringstream;
 using std::set;
+using std::stod;
+using std::stoi;
 using std::stol;
+using std::stoul;
 using std::string;
+using std::thread;
 
 static void usage(string & commandName) {
   cerr << "Usage: " << commandName
-  << " (-c|-f|-h|-s|-sv) [<power>] [<numTerms>]" << endl << endl
+  << " (-c|-f|-h|-s|-sv) [<power>] [<numTerms>] [<options>]" << endl << endl
   << "<power> and <numTerms> should be greater than or equal to 0" << endl
   << endl << "Examples:\n"
   << "To print the help on usage:" << endl
@@ -43,67 +58,432 @@ static void usage(string & commandName) {
   << "If <numTerms> is missing, a default of 20 is assumed" << endl;
 }
 
+// Width of the lines of the help on options
+static const size_t HELP_WIDTH = 72;
+
+/**
+ * Indent text by four spaces and break it into lines between words so that
+ * none is longer than HELP_WIDTH.  Used for text made up at run time.
+ */
+static string wrapHelp(const string & text) {
+  string wrapped;
+  string line = "   ";
+  size_t start = 0;
+  while (start <= text.size()) {
+    size_t end = text.find(' ', start);
+    if (end == string::npos) {
+      end = text.size();
+    }
+    string word = text.substr(start, end - start);
+    if (line.size() + 1 + word.size() > HELP_WIDTH && line.size() > 4) {
+      wrapped += line + "\n";
+      line = "   ";
+    }
+    line += " " + word;
+    start = end + 1;
+  }
+  return wrapped + line + "\n";
+}
+
+// Options are only described with -h so that the usage printed on errors
+// stays the same across all language implementations
+static void optionsUsage(string & commandName) {
+  cerr << endl << "Options:" << endl
+  << "--series (auto|power|difference|sieve)" << endl
+  << "    Method used to add up the series for -sv.  power computes every"
+  << endl
+  << "    term by exponentiation, difference advances the terms using a"
+  << endl
+  << "    table of forward differences, sieve exponentiates only primes and"
+  << endl
+  << "    multiplies powers of factors for composites and auto (default)"
+  << endl
+  << "    picks one of them.  The automatic formula uses it too when it adds"
+  << endl
+  << "    up the series.  --verify modular and -sm have kernels of their own"
+  << endl
+  << "    and leave it to the automatic formula" << endl
+  << "--threads <count>" << endl
+  << "    Number of threads used by each formula and to add up the series"
+  << endl
+  << "    for -sv (default 1).  The series is timed both in CPU time of its"
+  << endl
+  << "    threads and wall time.  --verify modular and -sm add up the series"
+  << endl
+  << "    on one thread, so there the count only applies to the formulas"
+  << endl
+  << "--verify (series|modular)" << endl
+  << "    What -sv compares the sums with.  series (default) is the exact sum"
+  << endl
+  << "    of the series, modular is the sum of the series modulo a few primes"
+  << endl
+  << "    below 2^31 evaluated with vector instructions" << endl
+  << "--kernel (auto|scalar|avx2|avx512)" << endl
+  << "    Kernel used by --verify modular.  auto (default) picks the best"
+  << endl
+  << "    kernel supported by the processor" << endl
+  << "--concurrent" << endl
+  << "    Run every formula and the verification of -sv or -sm on a thread of"
+  << endl
+  << "    their own.  Output is printed in the same order as without it."
+  << endl
+  << "    Each formula is timed in CPU time of its own thread.  The series"
+  << endl
+  << "    is timed in CPU time of its own thread and, for --threads above 1,"
+  << endl
+  << "    of the threads it starts" << endl
+  << "--primes <count>" << endl
+  << "    Number of random 61 bit primes used by -sm (default 4).  Each prime"
+  << endl
+  << "    lowers the probability of missing a wrong sum by about 2^-50"
+  << endl
+  << "--seed <seed>" << endl
+  << "    Seed used to pick the primes for -sm (default is based on the time)"
+  << endl
+  << "--timeout <milliseconds>" << endl
+  << "    Time allowed to each formula.  A formula still running when its"
+  << endl
+  << "    time is up is stopped and reported as cancelled (default is no"
+  << endl
+  << "    limit)" << endl
+  << "--allocator (system|pool)" << endl
+  << "    Memory used by GMP numbers.  system (default) is malloc, pool keeps"
+  << endl
+  << "    freed blocks in pools of each thread for reuse and prints counts of"
+  << endl
+  << "    the allocator calls at the end" << endl
+  << "--stats" << endl
+  << "    Print measurements of each formula for -s, -sv and -sm: CPU time of"
+  << endl
+  << "    its thread and of the process and wall time of both phases, sizes"
+  << endl
+  << "    of the coefficients and the sum and the number of multiplications"
+  << endl
+  << "    of big numbers, the GMP allocations and the most memory held by"
+  << endl
+  << "    GMP numbers next to the predicted memory.  The GMP allocations are"
+  << endl
+  << "    left out with --concurrent, as they count all formulas running at"
+  << endl
+  << "    the time" << endl
+  << "--perf" << endl
+  << "    Print hardware counts of the thread of each formula for -s, -sv and"
+  << endl
+  << "    -sm: cycles, instructions, cache and branch misses of both phases."
+  << endl
+  << "    Needs Linux perf events, which may be off in virtual machines or by"
+  << endl
+  << "    /proc/sys/kernel/perf_event_paranoid" << endl
+  << "--trace <file>" << endl
+  << "    Write a timeline of the stages of every formula and thread to file"
+  << endl
+  << "    in the Chrome trace format, which chrome://tracing and Perfetto"
+  << endl
+  << "    open" << endl
+  << "--engines <name>[,<name>...]" << endl
+  << wrapHelp("Formulas to run, from " + PowerSumRegistry::listNames()
+              + " (default is all but auto).  auto picks, for the power and"
+              + " number of terms, whichever of the formulas or the series"
+              + " addition a cost model predicts to be fastest")
+  << "--auto" << endl
+  << "    Same as --engines auto" << endl
+  << "--cost-model <file>" << endl
+  << "    Cost model of auto.  Read from file if it exists, otherwise"
+  << endl
+  << "    calibrated on this machine, which takes a few seconds, and saved"
+  << endl
+  << "    to file (default is built-in constants).  A file that is not a"
+  << endl
+  << "    cost model is an error and is left as it is" << endl
+  << "--memory-limit <bytes>[K|M|G]" << endl
+  << "    Most memory each formula and the series for -sv may take.  A"
+  << endl
+  << "    formula predicted to take more is not run and auto picks among the"
+  << endl
+  << "    methods predicted to fit (default is no limit).  Predictions are"
+  << endl
+  << "    upper bounds, up to about twice the peak --stats measures for"
+  << endl
+  << "    high powers and more for small ones.  For -c and -f the limit"
+  << endl
+  << "    applies to the memory a sum of power terms would take" << endl
+  << "--explain" << endl
+  << "    Print the predicted times of every method and the one auto picks"
+  << endl << endl
+  << "-sm works like -sv but compares the sums with the sum of the series"
+  << endl
+  << "modulo random primes, which is interpolated from the first terms of"
+  << endl
+  << "the series, so the check takes the same time for any <numTerms>"
+  << endl << endl
+  << "Examples:" << endl
+  << "To verify the sum using forward differences for the series:" << endl
+  << commandName << " -sv 3 1000000 --series difference" << endl << endl
+  << "To verify the sum modulo 8 random primes:" << endl
+  << commandName << " -sm 1000 1000000000 --primes 8" << endl;
+}
+
 static void error(string & commandName, string message) {
   cerr << message << endl;
   usage(commandName);
   exit(EXIT_FAILURE);
 }
 
-static void printCpuTime(struct timespec & before, struct timespec & after) {
-  cout << "Time taken = ";
-  long cpuNano = (after.tv_sec - before.tv_sec)*1000000000L
-                      + after.tv_nsec - before.tv_nsec;
-  cout << cpuNano << endl;
+static void printCpuTime(struct timespec & before, struct timespec & after,
+                         ostream & out) {
+  out << "Time taken = ";
+  out << elapsedNano(before, after) << endl;
 }
 
-static void printCoefficients(vector<mpq_class> & coeffs, ostream &out) {
+static void printWallTime(struct timespec & before, struct timespec & after,
+                          ostream & out) {
+  out << "Wall Time = " << elapsedNano(before, after) << endl;
+}
+
+static void printVerification(const string & formula, bool cancelled,
+                              bool overMemoryLimit, bool matches) {
+  if (overMemoryLimit) {
+    cout << "The sum was not computed within the memory limit for " << formula
+         << " formula" << endl;
+  } else if (cancelled) {
+    cout << "The sum was not computed in time for " << formula << " formula"
+         << endl;
+  } else if (matches) {
+    cout << "The sum matches with " << formula << " formula :-)" << endl;
+  } else {
+    cout << "The sums do not match for " << formula << " formula :-(" << endl;
+  }
+}
+
+static void printCoefficients(const CoefficientArray & coeffs, ostream &out) {
   for (size_t t = 0; t < coeffs.size(); t++) {
-    out << " " << coeffs[t];
+    out << " " << coeffs.rational(t);
   }
   out << endl;
 }
 
-static void printFaulhaberTitle() {
-  cout << "Faulhaber: -------------------------------------" << endl;
+static void getCoefficientsTimed(PowerSum & ps, long power, ostream & out) {
+  struct timespec before;
+  struct timespec after;
+
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &before);
+  shared_ptr<const CoefficientArray> coeffs = ps.getCoefficientView(power);
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &after);
+  printCoefficients(*coeffs, out);
+  printCpuTime(before, after, out);
+}
+
+static void printPhaseStats(const string & phase,
+                            const PowerSumPhaseStats & stats, ostream & out) {
+  out << phase << " (cpu:process cpu:wall) = " << stats.cpuTime << ':'
+      << stats.processCpuTime << ':' << stats.wallTime << endl;
 }
 
-static void printBernoulliTitle() {
-  cout << "Bernoulli: -------------------------------------" << endl;
+static void printStats(const PowerSumStats & stats, bool showMemory,
+                       ostream & out) {
+  printPhaseStats("Coefficient init", stats.init, out);
+  printPhaseStats("Summation", stats.sum, out);
+  out << "Coefficients = " << stats.numCoefficients
+      << ", max limbs = " << stats.maxCoefficientLimbs
+      << ", total limbs = " << stats.totalCoefficientLimbs << endl;
+  out << "Result bits = " << stats.resultBits
+      << ", big multiplications = " << stats.bigMultiplications << endl;
+  if (showMemory && stats.allocations >= 0) {
+    out << "GMP allocations = " << stats.allocations
+        << ", bytes = " << stats.allocatedBytes
+        << ", peak bytes = " << stats.peakBytes << endl;
+  }
+}
+
+static void printPhaseCounters(const string & phase,
+                               const PerfCounterValues & counters,
+                               ostream & out) {
+  out << phase << " cycles = " << counters.cycles << ", instructions = "
+      << counters.instructions;
+  if (counters.cycles > 0 && counters.instructions >= 0) {
+    out << ", IPC = " << std::fixed << std::setprecision(2)
+        << (double)counters.instructions/counters.cycles;
+    out.unsetf(std::ios::floatfield);
+  }
+  out << endl;
+  out << phase << " cache misses = " << counters.cacheMisses << " of "
+      << counters.cacheReferences << ", branch misses = "
+      << counters.branchMisses << " of " << counters.branches << endl;
 }
 
-static void printStirlingTitle() {
-  cout << "Stirling: --------------------------------------" << endl;
+static void printCounters(const PowerSumStats & stats, ostream & out) {
+  if (stats.init.counters.cycles < 0 && stats.sum.counters.cycles < 0) {
+    out << "Hardware counters not available" << endl;
+    return;
+  }
+  printPhaseCounters("Coefficient init", stats.init.counters, out);
+  printPhaseCounters("Summation", stats.sum.counters, out);
 }
 
-static void printEulerTitle() {
-  cout << "Euler: -----------------------------------------" << endl;
+static mpz_class computeAndPrintSumTimed(PowerSum & ps, long power,
+                                         long numTerms, bool showStats,
+                                         bool showMemory, bool showCounters,
+                                         ostream & out) {
+  PowerSumStats stats;
+
+  mpz_class sum = ps.computeSumWithStats(power, numTerms, stats);
+  {
+    TraceScope trace("decimal conversion");
+    out << "Sum computed = " << sum << endl;
+  }
+  out << "Time taken = ";
+  long total = stats.init.cpuTime + stats.sum.cpuTime;
+  out << total << ':' << stats.init.cpuTime << ':' << stats.sum.cpuTime
+      << endl;
+  if (showStats) {
+    printStats(stats, showMemory, out);
+    out << "Predicted memory = " << (long)ps.predictMemory(power, numTerms)
+        << " bytes" << endl;
+  }
+  if (showCounters) {
+    printCounters(stats, out);
+  }
+  return sum;
 }
 
-static void printCentralFactorialTitle() {
-  cout << "Central Factorial: -----------------------------" << endl;
+// Width of the line of dashes that starts the output of a formula
+static const size_t TITLE_WIDTH = 48;
+
+// What one formula was asked to do and what it produced.  Output is
+// collected here so that runs on different threads print in a fixed order.
+struct FormulaRun {
+  const char * name;
+  string title;
+  PowerSum * ps;
+  bool showStats;
+  bool showMemory;      // GMP counts are of the whole process, so they are
+                        // left out while other formulas run alongside
+  bool showCounters;
+  mpz_class sum;
+  bool cancelled;       // No sum, because it was cancelled or is too big
+  bool overMemoryLimit;
+  ostringstream out;
+};
+
+static void runFormula(const string & command, long power, long numTerms,
+                       long timeout, FormulaRun & run) {
+  CancellationToken token;
+  if (timeout > 0) {
+    token.setTimeout(timeout);
+  }
+  CancellationScope scope(&token);
+  TraceScope trace(run.name);
+
+  run.out << run.title << endl;
+  run.cancelled = false;
+  run.overMemoryLimit = false;
+  try {
+    if (command == "-c") {
+      getCoefficientsTimed(*run.ps, power, run.out);
+    } else if (command == "-f") {
+      run.ps->printSumFormula(power, run.out);
+    } else {
+      run.sum = computeAndPrintSumTimed(*run.ps, power, numTerms,
+                                        run.showStats, run.showMemory,
+                                        run.showCounters, run.out);
+    }
+  } catch (ComputationCancelled &) {
+    run.cancelled = true;
+    run.out << "Cancelled after " << timeout << " ms" << endl;
+  } catch (MemoryLimitExceeded & e) {
+    run.cancelled = true;
+    run.overMemoryLimit = true;
+    run.out << e.what() << endl;
+  }
 }
 
-static void getCoefficientsTimed(PowerSum & ps, long power) {
+// What the sums are verified against for -sv and -sm
+struct Reference {
+  bool modular;
+  mpz_class sum;                  // Sum of the series if not modular
+  vector<unsigned long> primes;   // Primes if modular
+  vector<unsigned long> residues; // Sum of the series modulo the primes
+  ostringstream out;
+};
+
+/**
+ * The series may run on several threads.  Its CPU time is that of this
+ * thread and of the threads of the series, which leaves out formulas
+ * running at the same time with --concurrent.
+ */
+static void computeReference(const string & command, long power,
+                             long numTerms, PowerSum & series,
+                             ModularSeriesSum & mss, Reference & ref) {
   struct timespec before;
   struct timespec after;
+  struct timespec wallBefore;
+  struct timespec wallAfter;
+  TraceScope trace("reference");
 
+  clock_gettime(CLOCK_MONOTONIC, &wallBefore);
+  long helperBefore = series.getHelperCpuTime();
   clock_gettime(CLOCK_THREAD_CPUTIME_ID, &before);
-  vector<mpq_class> coeffs = ps.getCoefficients(power);
+  if (command == "-sm") {
+    ref.out << "Modular verification:---------------------------" << endl;
+    for (size_t i = 0; i < ref.primes.size(); i++) {
+      ref.residues.push_back(ModularSeriesSum::interpolateSum(power, numTerms,
+                                                              ref.primes[i]));
+    }
+  } else if (ref.modular) {
+    ref.out << "Series addition modulo primes:------------------" << endl;
+    ref.out << "Kernel = " << ModularSeriesSum::kernelName(mss.getKernel())
+            << endl;
+    for (size_t i = 0; i < ref.primes.size(); i++) {
+      ref.residues.push_back(mss.computeSum(power, numTerms, ref.primes[i]));
+    }
+  } else {
+    ref.out << "Series addition:--------------------------------" << endl;
+    ref.sum = series.computeSumUsingSeries(power, numTerms);
+  }
   clock_gettime(CLOCK_THREAD_CPUTIME_ID, &after);
-  printCoefficients(coeffs, cout);
-  printCpuTime(before, after);
+  long helperTime = series.getHelperCpuTime() - helperBefore;
+  clock_gettime(CLOCK_MONOTONIC, &wallAfter);
+
+  if (ref.modular) {
+    for (size_t i = 0; i < ref.primes.size(); i++) {
+      ref.out << "Sum computed mod " << ref.primes[i] << " = "
+              << ref.residues[i] << endl;
+    }
+  } else {
+    TraceScope decimalTrace("decimal conversion");
+    ref.out << "Sum computed = " << ref.sum << endl;
+  }
+  ref.out << "Time taken = " << elapsedNano(before, after) + helperTime
+          << endl;
+  printWallTime(wallBefore, wallAfter, ref.out);
 }
 
-static mpz_class computeAndPrintSumTimed(PowerSum & ps, long power,
-                                         long numTerms) {
-  vector<long> stat;
-
-  mpz_class sum = ps.computeSumWithTimeStat(power, numTerms, stat);
-  cout << "Sum computed = " << sum << endl;
-  cout << "Time taken = ";
-  long total = stat[0] + stat[1];
-  cout << total << ':' << stat[0] << ':' << stat[1] << endl;
-  return sum;
+// Thread functions of --concurrent, which name their thread in the trace
+static void runFormulaOnThread(const string & command, long power,
+                               long numTerms, long timeout, FormulaRun & run) {
+  Trace::setThreadName(run.name);
+  runFormula(command, power, numTerms, timeout, run);
+}
+
+static void computeReferenceOnThread(const string & command, long power,
+                                     long numTerms, PowerSum & series,
+                                     ModularSeriesSum & mss, Reference & ref) {
+  Trace::setThreadName("Reference");
+  computeReference(command, power, numTerms, series, mss, ref);
+}
+
+static bool matchesReference(Reference & ref, mpz_class & sum) {
+  if (!ref.modular) {
+    return sum == ref.sum;
+  }
+  // The sums are only compared modulo a few primes, so a wrong sum goes
+  // undetected only if the error is divisible by all of them
+  for (size_t i = 0; i < ref.primes.size(); i++) {
+    if (mpz_fdiv_ui(sum.get_mpz_t(), ref.primes[i]) != ref.residues[i]) {
+      return false;
+    }
+  }
+  return true;
 }
 
 int main(int argc, char ** argv) {
@@ -113,8 +493,7 @@ int main(int argc, char ** argv) {
   validOptions.insert("-h");
   validOptions.insert("-s");
   validOptions.insert("-sv");
-  struct timespec before;
-  struct timespec after;
+  validOptions.insert("-sm");
 
   string * args = new string[argc];
   for (int i = 0; i < argc; i++) {
@@ -124,6 +503,7 @@ int main(int argc, char ** argv) {
   // Validate command arguments
   if (argc <= 1 || args[1] == "-h") {
     usage(args[0]);
+    optionsUsage(args[0]);
     return EXIT_SUCCESS;
   }
 
@@ -131,113 +511,370 @@ int main(int argc, char ** argv) {
     error(args[0], string("Invalid option: " + args[1]));
   }
 
-  if (argc < 3) {
+  // Separate named options from <power> and <numTerms>.  Named options start
+  // with "--" so that they are not mistaken for negative numbers
+  vector<string> positional;
+  PowerSum::SeriesMethod seriesMethod = PowerSum::SERIES_AUTO;
+  int numThreads = 1;
+  bool verifyModular = false;
+  ModularSeriesSum::Kernel kernel = ModularSeriesSum::KERNEL_AUTO;
+  long numPrimes = 4;
+  unsigned long seed = (unsigned long)time(NULL);
+  bool concurrent = false;
+  long timeout = 0;
+  bool poolAllocator = false;
+  bool showStats = false;
+  bool showCounters = false;
+  string traceFile;
+  string engineNames;
+  bool explain = false;
+  string costModelFile;
+  double memoryLimit = 0;
+  for (int i = 2; i < argc; i++) {
+    if (args[i].compare(0, 2, "--") != 0) {
+      positional.push_back(args[i]);
+      continue;
+    }
+    // Options without a value
+    if (args[i] == "--concurrent") {
+      concurrent = true;
+      continue;
+    }
+    if (args[i] == "--stats") {
+      showStats = true;
+      continue;
+    }
+    if (args[i] == "--perf") {
+      showCounters = true;
+      continue;
+    }
+    if (args[i] == "--auto") {
+      engineNames = "auto";
+      continue;
+    }
+    if (args[i] == "--explain") {
+      explain = true;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      error(args[0], "Missing value for option: " + args[i]);
+    }
+    string value = args[++i];
+    if (args[i - 1] == "--series") {
+      if (value == "auto") {
+        seriesMethod = PowerSum::SERIES_AUTO;
+      } else if (value == "power") {
+        seriesMethod = PowerSum::SERIES_POWER;
+      } else if (value == "difference") {
+        seriesMethod = PowerSum::SERIES_DIFFERENCE;
+      } else if (value == "sieve") {
+        seriesMethod = PowerSum::SERIES_SIEVE;
+      } else {
+        error(args[0], "Invalid series method: " + value);
+      }
+    } else if (args[i - 1] == "--verify") {
+      if (value == "series") {
+        verifyModular = false;
+      } else if (value == "modular") {
+        verifyModular = true;
+      } else {
+        error(args[0], "Invalid verification: " + value);
+      }
+    } else if (args[i - 1] == "--kernel") {
+      if (value == "auto") {
+        kernel = ModularSeriesSum::KERNEL_AUTO;
+      } else if (value == "scalar") {
+        kernel = ModularSeriesSum::KERNEL_SCALAR;
+      } else if (value == "avx2") {
+        kernel = ModularSeriesSum::KERNEL_AVX2;
+      } else if (value == "avx512") {
+        kernel = ModularSeriesSum::KERNEL_AVX512;
+      } else {
+        error(args[0], "Invalid kernel: " + value);
+      }
+    } else if (args[i - 1] == "--primes") {
+      try {
+        numPrimes = stol(value);
+        if (numPrimes < 1) {
+          throw invalid_argument("");
+        }
+      } catch(...) {
+        error(args[0], "Invalid number of primes: " + value);
+      }
+    } else if (args[i - 1] == "--seed") {
+      try {
+        seed = stoul(value);
+      } catch(...) {
+        error(args[0], "Invalid seed: " + value);
+      }
+    } else if (args[i - 1] == "--allocator") {
+      if (value == "system") {
+        poolAllocator = false;
+      } else if (value == "pool") {
+        poolAllocator = true;
+      } else {
+        error(args[0], "Invalid allocator: " + value);
+      }
+    } else if (args[i - 1] == "--trace") {
+      traceFile = value;
+    } else if (args[i - 1] == "--engines") {
+      engineNames = value;
+    } else if (args[i - 1] == "--memory-limit") {
+      try {
+        size_t used;
+        memoryLimit = stod(value, &used);
+        string unit = value.substr(used);
+        if (unit == "K") {
+          memoryLimit *= 1024.0;
+        } else if (unit == "M") {
+          memoryLimit *= 1024.0*1024;
+        } else if (unit == "G") {
+          memoryLimit *= 1024.0*1024*1024;
+        } else if (!unit.empty()) {
+          throw invalid_argument("");
+        }
+        if (memoryLimit <= 0) {
+          throw invalid_argument("");
+        }
+      } catch(...) {
+        error(args[0], "Invalid memory limit: " + value);
+      }
+    } else if (args[i - 1] == "--cost-model") {
+      costModelFile = value;
+    } else if (args[i - 1] == "--timeout") {
+      try {
+        timeout = stol(value);
+        if (timeout < 1) {
+          throw invalid_argument("");
+        }
+      } catch(...) {
+        error(args[0], "Invalid timeout: " + value);
+      }
+    } else if (args[i - 1] == "--threads") {
+      try {
+        numThreads = stoi(value);
+        if (numThreads < 1) {
+          throw invalid_argument("");
+        }
+      } catch(...) {
+        error(args[0], "Invalid number of threads: " + value);
+      }
+    } else {
+      error(args[0], "Invalid option: " + args[i - 1]);
+    }
+  }
+
+  vector<const PowerSumEngine *> chosen;
+  if (engineNames.empty()) {
+    chosen = PowerSumRegistry::getDefaultEngines();
+  } else {
+    istringstream names(engineNames);
+    string name;
+    while (getline(names, name, ',')) {
+      const PowerSumEngine * engine = PowerSumRegistry::find(name);
+      if (engine == NULL) {
+        error(args[0], "Invalid engine: " + name);
+      }
+      if (std::find(chosen.begin(), chosen.end(), engine) == chosen.end()) {
+        chosen.push_back(engine);
+      }
+    }
+    if (chosen.empty()) {
+      error(args[0], "Invalid engine: " + engineNames);
+    }
+  }
+
+  if (positional.size() < 1) {
     error(args[0], "Missing mandatory argument: <power>");
   }
 
   long power = 1;
   long numTerms = 20;
   try {
-    power = stol(args[2]);
+    power = stol(positional[0]);
     if (power < 0) {
       throw invalid_argument("");
     }
   } catch(...) {
-    error(args[0], "Invalid power: " + args[2]);
+    error(args[0], "Invalid power: " + positional[0]);
   }
-  if (argc > 3) {
+  if (positional.size() > 1) {
     try {
-      numTerms = stol(args[3]);
+      numTerms = stol(positional[1]);
       if (numTerms < 0) {
         throw invalid_argument("");
       }
     } catch(...) {
-      error(args[0], "Invalid number of terms: " + args[3]);
+      error(args[0], "Invalid number of terms: " + positional[1]);
+    }
+  }
+
+  // The allocator has to be in place before the first GMP number is created.
+  // The counting one lets --stats report the peak memory of each formula.
+  if (poolAllocator) {
+    GmpAllocator::install();
+  } else if (showStats) {
+    GmpAllocator::installCounting();
+  }
+  PerfCounterGroup::setEnabled(showCounters);
+  ofstream traceOut;
+  if (!traceFile.empty()) {
+    traceOut.open(traceFile.c_str());
+    if (!traceOut) {
+      error(args[0], "Cannot write trace file: " + traceFile);
     }
+    Trace::setThreadName("main");
+    Trace::setEnabled(true);
   }
 
   // Do what the user asked
-  FaulhaberPowerSum fps;
-  BernoulliPowerSum bps;
+  // Only the formulas asked for are created.  The series of the reference
+  // has a formula of its own, which is not run.
+  const int numRuns = chosen.size();
+  vector<std::unique_ptr<PowerSum> > formulas;
+  vector<FormulaRun> runs(numRuns);
+  for (int r = 0; r < numRuns; r++) {
+    formulas.push_back(chosen[r]->create());
+    runs[r].name = chosen[r]->title.c_str();
+    runs[r].title = chosen[r]->title + ": ";
+    runs[r].title.resize(TITLE_WIDTH, '-');
+    runs[r].ps = formulas[r].get();
+  }
   StirlingPowerSum sps;
-  EulerPowerSum eps;
-  CentralFactorialPowerSum cps;
-  mpz_class sumFaulhaber;
-  mpz_class sumBernoulli;
-  mpz_class sumStirling;
-  mpz_class sumEuler;
-  mpz_class sumCentral;
-
-  if (args[1] == "-c") {
+  AutoPowerSum aps;
+
+  const string & command = args[1];
+  bool verify = (command == "-sv" || command == "-sm");
+  Reference ref;
+  ref.modular = (command == "-sm" || verifyModular);
+  ModularSeriesSum mss;
+  mss.setKernel(kernel);
+  if (command == "-sm") {
+    ref.primes = ModularSeriesSum::randomPrimes(numPrimes, seed);
+  } else if (ref.modular) {
+    const unsigned long primes[] = {2147483647UL, 2147483629UL,
+                                    2147483587UL, 2147483579UL};
+    ref.primes.assign(primes, primes + sizeof(primes)/sizeof(primes[0]));
+  }
+  sps.setSeriesMethod(seriesMethod);
+  sps.setNumThreads(numThreads);
+  aps.setNumThreads(numThreads);
+  aps.setMemoryLimit(memoryLimit);
+  for (int r = 0; r < numRuns; r++) {
+    runs[r].ps->setMemoryLimit(memoryLimit);
+    runs[r].ps->setSeriesMethod(seriesMethod);
+    runs[r].ps->setNumThreads(numThreads);
+    runs[r].showStats = showStats;
+    runs[r].showMemory = !concurrent;
+    runs[r].showCounters = showCounters;
+  }
+  if (!costModelFile.empty()) {
+    // Only a file that does not exist is calibrated and written, so that a
+    // mistyped name does not overwrite some other file
+    struct stat fileStat;
+    if (stat(costModelFile.c_str(), &fileStat) != 0 && errno == ENOENT) {
+      cerr << "Calibrating cost model" << endl;
+      aps.calibrate();
+      if (!aps.saveCostModel(costModelFile)) {
+        error(args[0], "Cannot write cost model file: " + costModelFile);
+      }
+    } else if (!aps.loadCostModel(costModelFile)) {
+      error(args[0], "Invalid cost model file: " + costModelFile);
+    }
+  }
+  // Automatic formulas that were asked for use the model loaded above
+  for (int r = 0; r < numRuns; r++) {
+    AutoPowerSum * automatic = dynamic_cast<AutoPowerSum *>(runs[r].ps);
+    if (automatic != NULL) {
+      automatic->setCostModel(aps);
+    }
+  }
+
+  // The series is the reference of every formula, so there is no point in
+  // starting if it does not fit
+  if (verify && !ref.modular && memoryLimit > 0) {
+    double predicted = sps.predictSeriesMemory(power, numTerms);
+    if (predicted > memoryLimit) {
+      cerr << "Series addition: "
+           << MemoryLimitExceeded(predicted, memoryLimit).what() << endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (command == "-c") {
     cout << "Computing coefficients for power " << power << endl;
-    printFaulhaberTitle();
-    getCoefficientsTimed(fps, power);
-    printBernoulliTitle();
-    getCoefficientsTimed(bps, power);
-    printStirlingTitle();
-    getCoefficientsTimed(sps, power);
-    printEulerTitle();
-    getCoefficientsTimed(eps, power);
-    printCentralFactorialTitle();
-    getCoefficientsTimed(cps, power);
-  } else if (args[1] == "-f") {
-    printFaulhaberTitle();
-    fps.printSumFormula(power, cout);
-    printBernoulliTitle();
-    bps.printSumFormula(power, cout);
-    printStirlingTitle();
-    sps.printSumFormula(power, cout);
-    printEulerTitle();
-    eps.printSumFormula(power, cout);
-    printCentralFactorialTitle();
-    cps.printSumFormula(power, cout);
-  } else {
+  } else if (command != "-f") {
     cout << "Computing S(" << power << ", " << numTerms << ")" << endl;
-    printFaulhaberTitle();
-    sumFaulhaber = computeAndPrintSumTimed(fps, power, numTerms);
-    printBernoulliTitle();
-    sumBernoulli = computeAndPrintSumTimed(bps, power, numTerms);
-    printStirlingTitle();
-    sumStirling = computeAndPrintSumTimed(sps, power, numTerms);
-    printEulerTitle();
-    sumEuler = computeAndPrintSumTimed(eps, power, numTerms);
-    printCentralFactorialTitle();
-    sumCentral = computeAndPrintSumTimed(cps, power, numTerms);
-    if (args[1] == "-sv") {
-      cout << "Series addition:--------------------------------" << endl;
-      clock_gettime(CLOCK_THREAD_CPUTIME_ID, &before);
-      mpz_class sumFromSeries = sps.computeSumUsingSeries(power, numTerms);
-      clock_gettime(CLOCK_THREAD_CPUTIME_ID, &after);
-      cout << "Sum computed = " << sumFromSeries << endl;
-      printCpuTime(before, after);
-      if (sumFaulhaber == sumFromSeries) {
-        cout << "The sum matches with Faulhaber formula :-)" << endl;
-      } else {
-        cout << "The sums do not match for Faulhaber formula :-(" << endl;
-      }
-      if (sumBernoulli == sumFromSeries) {
-        cout << "The sum matches with Bernoulli formula :-)" << endl;
-      } else {
-        cout << "The sums do not match for Bernoulli formula :-(" << endl;
-      }
-      if (sumStirling == sumFromSeries) {
-        cout << "The sum matches with Stirling formula :-)" << endl;
-      } else {
-        cout << "The sums do not match for Stirling formula :-(" << endl;
-      }
-      if (sumEuler == sumFromSeries) {
-        cout << "The sum matches with Euler formula :-)" << endl;
-      } else {
-        cout << "The sums do not match for Euler formula :-(\n";
-      }
-      if (sumCentral == sumFromSeries) {
-        cout << "The sum matches with Central Factorial formula :-)" << endl;
-      } else {
-        cout << "The sums do not match for Central Factorial formula :-("
-             << endl;
+  }
+  if (explain) {
+    // The coefficients do not depend on the number of terms, so -c and -f
+    // are explained as the sum of power terms
+    bool hasTerms = (command != "-c" && command != "-f");
+    aps.explain(power, hasTerms ? numTerms : power, cout);
+  }
+  if (concurrent) {
+    // The formulas share no state, so each one and the reference run on a
+    // thread of their own.  Output is printed in the usual order afterwards.
+    vector<thread> workers;
+    for (int r = 0; r < numRuns; r++) {
+      workers.push_back(thread(runFormulaOnThread, std::cref(command), power,
+                               numTerms, timeout, std::ref(runs[r])));
+    }
+    if (verify) {
+      workers.push_back(thread(computeReferenceOnThread, std::cref(command),
+                               power, numTerms, std::ref(sps), std::ref(mss),
+                               std::ref(ref)));
+    }
+    for (size_t w = 0; w < workers.size(); w++) {
+      workers[w].join();
+    }
+    for (int r = 0; r < numRuns; r++) {
+      cout << runs[r].out.str();
+    }
+  } else {
+    for (int r = 0; r < numRuns; r++) {
+      runFormula(command, power, numTerms, timeout, runs[r]);
+      cout << runs[r].out.str();
+    }
+    if (verify) {
+      computeReference(command, power, numTerms, sps, mss, ref);
+    }
+  }
+
+  if (verify) {
+    cout << ref.out.str();
+    if (command == "-sm") {
+      size_t maxBits = 1;
+      for (int r = 0; r < numRuns; r++) {
+        if (runs[r].cancelled) {
+          continue;
+        }
+        size_t bits = mpz_sizeinbase(runs[r].sum.get_mpz_t(), 2);
+        if (bits > maxBits) {
+          maxBits = bits;
+        }
       }
+      cout << "False positive bound = "
+           << ModularSeriesSum::falsePositiveBound(maxBits, ref.primes.size())
+           << endl;
+    }
+    for (int r = 0; r < numRuns; r++) {
+      printVerification(runs[r].name, runs[r].cancelled,
+                        runs[r].overMemoryLimit,
+                        matchesReference(ref, runs[r].sum));
     }
   }
+  if (poolAllocator) {
+    GmpAllocatorStats stats = GmpAllocator::getStats();
+    cout << "Allocator: allocations = " << stats.allocations
+         << ", reallocations = " << stats.reallocations
+         << ", frees = " << stats.frees
+         << ", pool hits = " << stats.poolHits
+         << ", bytes allocated = " << stats.bytesAllocated << endl;
+  }
+  if (!traceFile.empty()) {
+    Trace::write(traceOut);
+  }
   delete[] args;
   return EXIT_SUCCESS;
 }
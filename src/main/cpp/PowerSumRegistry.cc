@@ -0,0 +1,77 @@
+#include "AutoPowerSum.h"
+#include "BernoulliPowerSum.h"
+#include "CentralFactorialPowerSum.h"
+#include "EulerPowerSum.h"
+#include "FaulhaberPowerSum.h"
+#include "PowerSumRegistry.h"
+#include "StirlingPowerSum.h"
+
+template <class Formula>
+static std::unique_ptr<PowerSum> createFormula() {
+  return std::unique_ptr<PowerSum>(new Formula());
+}
+
+/**
+ * The table is built on first use rather than at static initialization, so
+ * that it is ready for callers in other static initializers
+ */
+static vector<PowerSumEngine> & engines() {
+  static vector<PowerSumEngine> table = {
+    {"faulhaber", "Faulhaber", createFormula<FaulhaberPowerSum>, true},
+    {"bernoulli", "Bernoulli", createFormula<BernoulliPowerSum>, true},
+    {"stirling", "Stirling", createFormula<StirlingPowerSum>, true},
+    {"euler", "Euler", createFormula<EulerPowerSum>, true},
+    {"central", "Central Factorial", createFormula<CentralFactorialPowerSum>,
+     true},
+    {"auto", "Auto", createFormula<AutoPowerSum>, false}
+  };
+  return table;
+}
+
+void PowerSumRegistry :: add(const PowerSumEngine & engine) {
+  vector<PowerSumEngine> & table = engines();
+  for (size_t e = 0; e < table.size(); e++) {
+    if (table[e].name == engine.name) {
+      table[e] = engine;
+      return;
+    }
+  }
+  table.push_back(engine);
+}
+
+const vector<PowerSumEngine> & PowerSumRegistry :: getEngines() {
+  return engines();
+}
+
+vector<const PowerSumEngine *> PowerSumRegistry :: getDefaultEngines() {
+  const vector<PowerSumEngine> & table = engines();
+  vector<const PowerSumEngine *> chosen;
+  for (size_t e = 0; e < table.size(); e++) {
+    if (table[e].runByDefault) {
+      chosen.push_back(&table[e]);
+    }
+  }
+  return chosen;
+}
+
+const PowerSumEngine * PowerSumRegistry :: find(const string & name) {
+  const vector<PowerSumEngine> & table = engines();
+  for (size_t e = 0; e < table.size(); e++) {
+    if (table[e].name == name) {
+      return &table[e];
+    }
+  }
+  return NULL;
+}
+
+string PowerSumRegistry :: listNames() {
+  const vector<PowerSumEngine> & table = engines();
+  string names;
+  for (size_t e = 0; e < table.size(); e++) {
+    if (e > 0) {
+      names += ", ";
+    }
+    names += table[e].name;
+  }
+  return names;
+}
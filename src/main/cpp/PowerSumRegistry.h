@@ -0,0 +1,64 @@
+#ifndef POWERSUM_REGISTRY_H
+#define POWERSUM_REGISTRY_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "PowerSum.h"
+
+using std::string;
+using std::vector;
+
+/* Function creating a new sum formula */
+typedef std::unique_ptr<PowerSum> (*PowerSumFactory)();
+
+/* Sum formula known by name */
+struct PowerSumEngine {
+  string name;          // Name used to choose the formula, in lower case
+  string title;         // Name printed in the output
+  PowerSumFactory create;
+  bool runByDefault;    // Run when no formulas are chosen
+};
+
+/* Table of the sum formulas that the command line and the benchmarks can
+ * run.  The five formulas and the automatic choice among them are known
+ * from the start; more can be added before the table is first used.  Not
+ * safe to change while other threads read it.
+ */
+class PowerSumRegistry {
+  public:
+    /* To add a formula, or replace the one with the same name
+     * Parameters:
+     *   engine - formula and its names (IN)
+     */
+    static void add(const PowerSumEngine & engine);
+
+    /* To get all formulas in the order they were added
+     * Return value
+     *   formulas
+     */
+    static const vector<PowerSumEngine> & getEngines();
+
+    /* To get the formulas run when none are chosen
+     * Return value
+     *   formulas, in the order they were added
+     */
+    static vector<const PowerSumEngine *> getDefaultEngines();
+
+    /* To find a formula by name
+     * Parameters:
+     *   name - name of the formula (IN)
+     * Return value
+     *   the formula or NULL if there is none by that name
+     */
+    static const PowerSumEngine * find(const string & name);
+
+    /* To get the names of all formulas
+     * Return value
+     *   names separated by ", "
+     */
+    static string listNames();
+};
+
+#endif
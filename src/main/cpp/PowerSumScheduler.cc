@@ -0,0 +1,186 @@
+#include <limits.h>
+
+#include <stdexcept>
+
+#include "PowerSumScheduler.h"
+
+using std::make_shared;
+using std::mutex;
+using std::promise;
+using std::unique_lock;
+
+PowerSumScheduler :: PowerSumScheduler(int numThreads, size_t maxSets)
+                   : nextFormulaId(0), maxSets(maxSets), numGenerated(0),
+                     useCount(0),
+                     pool((numThreads < 1 ? 1 : numThreads) + 1) {
+  // The thread calling submit does not take part in the work, so the pool
+  // needs one thread more than the number of threads computing sums
+}
+
+long PowerSumScheduler :: addFormula(PowerSum & formula) {
+  unique_lock<mutex> guard(lock);
+  long formulaId = nextFormulaId++;
+  formulas[formulaId] = &formula;
+  return formulaId;
+}
+
+/**
+ * Tasks still running for the formula hold on to their sets, which are freed
+ * when the tasks are done with them
+ */
+void PowerSumScheduler :: removeFormula(long formulaId) {
+  unique_lock<mutex> guard(lock);
+  formulas.erase(formulaId);
+  sets.erase(sets.lower_bound(Key(formulaId, LONG_MIN)),
+             sets.upper_bound(Key(formulaId, LONG_MAX)));
+}
+
+/**
+ * The first query for a (formula, power) pair creates its coefficient set and
+ * queues a task to generate the coefficients.  Queries that arrive before the
+ * coefficients are ready wait in the set and are queued by that task when it
+ * is done.  Later queries are queued right away.
+ */
+future<mpz_class> PowerSumScheduler :: submit(long formulaId, long power,
+                                              long n) {
+  Query query;
+  query.n = n;
+  query.result = make_shared<promise<mpz_class> >();
+  future<mpz_class> result = query.result->get_future();
+
+  PowerSum * engine;
+  shared_ptr<CoefficientSet> set;
+  bool generateNow = false;
+  bool evaluateNow = false;
+  {
+    unique_lock<mutex> guard(lock);
+    std::map<long, PowerSum *>::iterator registered = formulas.find(formulaId);
+    if (registered == formulas.end()) {
+      throw std::invalid_argument("Unknown formula id: "
+                                  + std::to_string(formulaId));
+    }
+    engine = registered->second;
+    shared_ptr<CoefficientSet> & entry = sets[Key(formulaId, power)];
+    if (!entry) {
+      entry = make_shared<CoefficientSet>();
+      generateNow = true;
+      numGenerated++;
+    }
+    set = entry;
+    set->pending++;
+    set->lastUse = ++useCount;
+    if (generateNow) {
+      evictUnused();
+    }
+    if (set->ready) {
+      evaluateNow = true;
+    } else {
+      set->waiting.push_back(query);
+    }
+  }
+
+  if (generateNow) {
+    pool.submit([this, engine, power, set]() {
+      generate(engine, power, set);
+    });
+  }
+  if (evaluateNow) {
+    pool.submit([this, engine, power, set, query]() {
+      evaluate(engine, power, set, query);
+    });
+  }
+  return result;
+}
+
+size_t PowerSumScheduler :: getNumCoefficientSets() {
+  unique_lock<mutex> guard(lock);
+  return sets.size();
+}
+
+size_t PowerSumScheduler :: getNumGenerated() {
+  unique_lock<mutex> guard(lock);
+  return numGenerated;
+}
+
+PowerSumScheduler :: ~PowerSumScheduler() {
+}
+
+void PowerSumScheduler :: generate(PowerSum * formula, long power,
+                                   shared_ptr<CoefficientSet> set) {
+  CoefficientArray coeffs;
+  std::exception_ptr error;
+  try {
+    formula->getCoefficients(power, coeffs);
+  } catch (...) {
+    error = std::current_exception();
+  }
+
+  vector<Query> waiting;
+  {
+    unique_lock<mutex> guard(lock);
+    set->coeffs.swap(coeffs);
+    set->error = error;
+    set->ready = true;
+    waiting.swap(set->waiting);
+  }
+  // Submitted from a thread of the pool, so these go to the queue of this
+  // thread where the coefficients are still in the cache
+  for (size_t i = 0; i < waiting.size(); i++) {
+    Query query = waiting[i];
+    pool.submit([this, formula, power, set, query]() {
+      evaluate(formula, power, set, query);
+    });
+  }
+}
+
+void PowerSumScheduler :: evaluate(PowerSum * formula, long power,
+                                   shared_ptr<CoefficientSet> set,
+                                   const Query & query) {
+  mpz_class sum;
+  std::exception_ptr error = set->error;
+  if (!error) {
+    try {
+      sum = formula->computeSumUsingCoefficients(set->coeffs, power, query.n);
+    } catch (...) {
+      error = std::current_exception();
+    }
+  }
+
+  // Done with the set before the result is handed out, so that a caller
+  // seeing the result also sees the set as unused
+  {
+    unique_lock<mutex> guard(lock);
+    set->pending--;
+    if (set->pending == 0) {
+      evictUnused();
+    }
+  }
+  if (error) {
+    query.result->set_exception(error);
+  } else {
+    query.result->set_value(sum);
+  }
+}
+
+/**
+ * Called with the lock held.  Sets with pending queries stay, so there may
+ * be more than maxSets while many powers are in flight.  A set dropped while
+ * a task still holds it is freed when the task is done with it.
+ */
+void PowerSumScheduler :: evictUnused() {
+  while (sets.size() > maxSets) {
+    SetMap::iterator oldest = sets.end();
+    SetMap::iterator it;
+    for (it = sets.begin(); it != sets.end(); ++it) {
+      if (it->second->pending == 0
+          && (oldest == sets.end()
+              || it->second->lastUse < oldest->second->lastUse)) {
+        oldest = it;
+      }
+    }
+    if (oldest == sets.end()) {
+      return;
+    }
+    sets.erase(oldest);
+  }
+}
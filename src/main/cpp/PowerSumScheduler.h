@@ -0,0 +1,118 @@
+#ifndef POWERSUM_SCHEDULER_H
+#define POWERSUM_SCHEDULER_H
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include "PowerSum.h"
+#include "ThreadPool.h"
+
+using std::shared_ptr;
+
+class PowerSumScheduler {
+  public:
+    /* To create a scheduler
+     * Parameters:
+     *   numThreads - number of threads computing the sums (IN)
+     *   maxSets - number of coefficient sets kept once no query needs them
+     *             (IN)
+     */
+    PowerSumScheduler(int numThreads, size_t maxSets = 64);
+
+    /* To register a formula to submit sums for.  Coefficient sets are kept
+     * under the id, which is never handed out again, so a formula created
+     * where a removed one used to be does not find its coefficients.
+     * Parameters:
+     *   formula - formula used to compute the sums (IN)
+     * Return value
+     *   id of the formula in this scheduler
+     */
+    long addFormula(PowerSum & formula);
+
+    /* To unregister a formula and drop the coefficient sets kept for it.
+     * Sums already submitted are still computed, so the formula must stay
+     * alive until their results are ready.
+     * Parameters:
+     *   formulaId - id returned by addFormula (IN)
+     */
+    void removeFormula(long formulaId);
+
+    /* To queue the computation of a sum.  The coefficients of a formula for
+     * a power are generated once, on the first query for them, and kept for
+     * all later queries for the same formula and power.  Sets no query is
+     * waiting for are dropped, least recently used first, when there are
+     * more than maxSets of them.  The sum for each n
+     * is then computed as a task of its own.  Those tasks start on the
+     * thread that generated the coefficients and are stolen by idle threads.
+     * The formula must stay alive until the result is ready and is only to be
+     * used through its thread safe methods in the meantime.
+     * Parameters:
+     *   formulaId - id returned by addFormula, std::invalid_argument is
+     *               thrown for any other (IN)
+     *   power - desired power (IN)
+     *   n - number of terms (IN)
+     * Return value
+     *   future that becomes ready with the sum computed
+     */
+    future<mpz_class> submit(long formulaId, long power, long n);
+
+    /* To get the number of coefficient sets kept
+     * Return value
+     *   number of (formula, power) pairs whose coefficients are kept
+     */
+    size_t getNumCoefficientSets();
+
+    /* To get the number of times coefficients were generated
+     * Return value
+     *   number of coefficient sets generated so far, counting again a set
+     *   generated after it was dropped
+     */
+    size_t getNumGenerated();
+
+    /* Waits for all queued sums to be computed */
+    ~PowerSumScheduler();
+
+  private:
+    // A query waiting for the coefficients it needs
+    struct Query {
+      long n;
+      shared_ptr<std::promise<mpz_class> > result;
+    };
+
+    // Coefficients of one formula for one power
+    struct CoefficientSet {
+      CoefficientSet() : ready(false), pending(0), lastUse(0) {}
+      bool ready;
+      long pending;           // Queries submitted and not yet computed
+      unsigned long lastUse;  // Value of useCount at the last query
+      std::exception_ptr error;
+      CoefficientArray coeffs;
+      vector<Query> waiting;
+    };
+
+    // Formula id and power
+    typedef std::pair<long, long> Key;
+    typedef std::map<Key, shared_ptr<CoefficientSet> > SetMap;
+
+    PowerSumScheduler(const PowerSumScheduler &);
+    PowerSumScheduler & operator=(const PowerSumScheduler &);
+    void generate(PowerSum * formula, long power,
+                  shared_ptr<CoefficientSet> set);
+    void evaluate(PowerSum * formula, long power,
+                  shared_ptr<CoefficientSet> set, const Query & query);
+    void evictUnused();
+
+    std::mutex lock;
+    std::map<long, PowerSum *> formulas;
+    long nextFormulaId;
+    SetMap sets;
+    size_t maxSets;
+    size_t numGenerated;
+    unsigned long useCount;
+    // Declared last so that its threads stop before the members they use
+    ThreadPool pool;
+};
+
+#endif
@@ -0,0 +1,112 @@
+#include "GmpAllocator.h"
+#include "PowerSumStats.h"
+#include "Trace.h"
+
+long elapsedNano(const struct timespec & before,
+                 const struct timespec & after) {
+  return (after.tv_sec - before.tv_sec)*1000000000L
+         + after.tv_nsec - before.tv_nsec;
+}
+
+PowerSumStats :: PowerSumStats()
+               : numCoefficients(0), maxCoefficientLimbs(0),
+                 totalCoefficientLimbs(0), resultBits(0),
+                 bigMultiplications(0), allocations(-1),
+                 allocatedBytes(-1), peakBytes(-1) {
+  init.cpuTime = 0;
+  init.processCpuTime = 0;
+  init.wallTime = 0;
+  init.counters.cycles = -1;
+  init.counters.instructions = -1;
+  init.counters.cacheReferences = -1;
+  init.counters.cacheMisses = -1;
+  init.counters.branches = -1;
+  init.counters.branchMisses = -1;
+  sum = init;
+}
+
+PowerSumStatsRecorder :: PowerSumStatsRecorder(PowerSumStats & stats)
+                       : stats(stats), startAllocations(0),
+                         startAllocatedBytes(0), peakTracker(-1),
+                         traceStart(0) {
+  stats = PowerSumStats();
+  if (GmpAllocator::isInstalled()) {
+    GmpAllocatorStats allocatorStats = GmpAllocator::getStats();
+    startAllocations = allocatorStats.allocations;
+    startAllocatedBytes = allocatorStats.bytesAllocated;
+    peakTracker = GmpAllocator::startPeakTracking();
+  }
+}
+
+/**
+ * A computation that threw never got to finish, whose tracker is let go
+ * here
+ */
+PowerSumStatsRecorder :: ~PowerSumStatsRecorder() {
+  if (peakTracker >= 0) {
+    GmpAllocator::stopPeakTracking(peakTracker);
+  }
+}
+
+void PowerSumStatsRecorder :: startPhase() {
+  clock_gettime(CLOCK_MONOTONIC, &wallStart);
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &processCpuStart);
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpuStart);
+  traceStart = Trace::isEnabled() ? Trace::now() : 0;
+  counters.start();
+}
+
+void PowerSumStatsRecorder :: endPhase(PowerSumPhaseStats & phase) {
+  struct timespec cpuEnd;
+  struct timespec processCpuEnd;
+  struct timespec wallEnd;
+  counters.stop(phase.counters);
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpuEnd);
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &processCpuEnd);
+  clock_gettime(CLOCK_MONOTONIC, &wallEnd);
+  phase.cpuTime = elapsedNano(cpuStart, cpuEnd);
+  phase.processCpuTime = elapsedNano(processCpuStart, processCpuEnd);
+  phase.wallTime = elapsedNano(wallStart, wallEnd);
+  if (traceStart != 0) {
+    Trace::record((&phase == &stats.init) ? "coefficient init" : "summation",
+                  traceStart, Trace::now());
+  }
+}
+
+void PowerSumStatsRecorder :: recordCoefficients(
+                                const CoefficientArray & coeffs,
+                                size_t first) {
+  stats.numCoefficients = (first < coeffs.size()) ?
+                          (long)(coeffs.size() - first) : 0;
+  stats.maxCoefficientLimbs = 0;
+  stats.totalCoefficientLimbs = 0;
+  for (size_t i = first; i < coeffs.size(); i++) {
+    long limbs = (long)(mpz_size(coeffs.numerator(i))
+                        + mpz_size(coeffs.denominator(i)));
+    stats.totalCoefficientLimbs += limbs;
+    if (limbs > stats.maxCoefficientLimbs) {
+      stats.maxCoefficientLimbs = limbs;
+    }
+  }
+}
+
+void PowerSumStatsRecorder :: recordCoefficient(const mpq_class & coeff) {
+  long limbs = (long)(mpz_size(coeff.get_num_mpz_t())
+                      + mpz_size(coeff.get_den_mpz_t()));
+  stats.numCoefficients++;
+  stats.totalCoefficientLimbs += limbs;
+  if (limbs > stats.maxCoefficientLimbs) {
+    stats.maxCoefficientLimbs = limbs;
+  }
+}
+
+void PowerSumStatsRecorder :: finish(const mpz_class & sum) {
+  stats.resultBits = (sum == 0) ? 0 : (long)mpz_sizeinbase(sum.get_mpz_t(), 2);
+  if (GmpAllocator::isInstalled()) {
+    GmpAllocatorStats allocatorStats = GmpAllocator::getStats();
+    stats.allocations = allocatorStats.allocations - startAllocations;
+    stats.allocatedBytes = allocatorStats.bytesAllocated - startAllocatedBytes;
+    stats.peakBytes = GmpAllocator::stopPeakTracking(peakTracker);
+    peakTracker = -1;
+  }
+}
@@ -0,0 +1,113 @@
+#ifndef POWERSUM_STATS_H
+#define POWERSUM_STATS_H
+
+#include <time.h>
+#include <gmpxx.h>
+
+#include "CoefficientArray.h"
+#include "PerfCounters.h"
+
+/* To get the time between two readings of a clock
+ * Parameters:
+ *   before - earlier reading (IN)
+ *   after - later reading (IN)
+ * Return value
+ *   nanoseconds from before to after
+ */
+long elapsedNano(const struct timespec & before,
+                 const struct timespec & after);
+
+/* Times of one phase of a computation in nanoseconds and the hardware
+ * counts of the thread computing the sum
+ */
+struct PowerSumPhaseStats {
+  long cpuTime;        // CPU time of the thread computing the sum
+  long processCpuTime; // CPU time of all threads, including helper threads
+  long wallTime;       // Elapsed real time
+  PerfCounterValues counters; // -1 unless PerfCounterGroup is enabled and
+                              // the counters are available
+};
+
+/* Measurements of one computation of a sum by a formula */
+struct PowerSumStats {
+  PowerSumPhaseStats init;     // Coefficient initialization
+  PowerSumPhaseStats sum;      // Summation using the coefficients.  For
+                               // formulas adding up the coefficients as
+                               // they are generated, init only covers
+                               // setting up the generation and sum the
+                               // rest.
+  long numCoefficients;        // Coefficients used by the summation
+  long maxCoefficientLimbs;    // Limbs of the largest coefficient
+  long totalCoefficientLimbs;  // Limbs of all coefficients
+  long resultBits;             // Bits of the sum
+  long bigMultiplications;     // Calls multiplying two multi-precision
+                               // numbers in the summation
+  long allocations;            // GMP allocations, -1 unless GmpAllocator is
+  long allocatedBytes;         // installed.  Counted over all threads.
+  long peakBytes;              // Most bytes held by GMP numbers and packed
+                               // coefficients at once above those held at
+                               // the start, -1 likewise.  Includes those of
+                               // other computations running at the time.
+
+  PowerSumStats();
+};
+
+/* Fills in a PowerSumStats while a formula computes a sum.  Phases are
+ * timed between startPhase and endPhase, which also bracket the hardware
+ * counters if PerfCounterGroup is enabled and record the phase in the Trace
+ * if it is on.
+ */
+class PowerSumStatsRecorder {
+  public:
+    /* To start recording.  The stats are reset.
+     * Parameters:
+     *   stats - stats to fill in (OUT)
+     */
+    PowerSumStatsRecorder(PowerSumStats & stats);
+    ~PowerSumStatsRecorder();
+
+    /* To start timing a phase */
+    void startPhase();
+
+    /* To stop timing a phase
+     * Parameters:
+     *   phase - times of the phase (OUT)
+     */
+    void endPhase(PowerSumPhaseStats & phase);
+
+    /* To record the sizes of the coefficients used by the summation
+     * Parameters:
+     *   coeffs - coefficients (IN)
+     *   first - index of the first coefficient used, for summations that
+     *           skip those before it (IN)
+     */
+    void recordCoefficients(const CoefficientArray & coeffs,
+                            size_t first = 0);
+
+    /* To add the size of one more coefficient, for formulas that use each
+     * coefficient as it is generated
+     * Parameters:
+     *   coeff - coefficient (IN)
+     */
+    void recordCoefficient(const mpq_class & coeff);
+
+    /* To record the result and the allocations and peak memory since the
+     * start
+     * Parameters:
+     *   sum - sum computed (IN)
+     */
+    void finish(const mpz_class & sum);
+
+  private:
+    PowerSumStats & stats;
+    PerfCounterGroup counters;
+    long startAllocations;
+    long startAllocatedBytes;
+    int peakTracker;      // -1 if the peak is not followed
+    struct timespec cpuStart;
+    struct timespec processCpuStart;
+    struct timespec wallStart;
+    long traceStart; // 0 unless the phase is traced
+};
+
+#endif
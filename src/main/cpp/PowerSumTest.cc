@@ -0,0 +1,333 @@
+/* Tests of the library interfaces the command line does not reach.  Every
+ * test prints its name and the checks that failed.
+ *
+ * Usage: PowerSumTest
+ */
+#include <stdlib.h>
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BernoulliPowerSum.h"
+#include "CentralFactorialPowerSum.h"
+#include "EulerPowerSum.h"
+#include "FaulhaberPowerSum.h"
+#include "GmpAllocator.h"
+#include "PowerSumScheduler.h"
+#include "StirlingPowerSum.h"
+
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+static int numFailures = 0;
+
+static void check(bool ok, const string & what) {
+  if (!ok) {
+    cout << "  FAILED: " << what << endl;
+    numFailures++;
+  }
+}
+
+// One of each formula
+struct Formulas {
+  FaulhaberPowerSum fps;
+  BernoulliPowerSum bps;
+  StirlingPowerSum sps;
+  EulerPowerSum eps;
+  CentralFactorialPowerSum cps;
+  PowerSum * all[5];
+  const char * names[5];
+
+  Formulas() {
+    PowerSum * formulas[] = {&fps, &bps, &sps, &eps, &cps};
+    const char * formulaNames[] = {
+      "Faulhaber", "Bernoulli", "Stirling", "Euler", "Central Factorial"
+    };
+    for (int i = 0; i < 5; i++) {
+      all[i] = formulas[i];
+      names[i] = formulaNames[i];
+    }
+  }
+};
+
+static const int NUM_FORMULAS = 5;
+
+static string describe(const char * name, long power, long n) {
+  return string(name) + " S(" + std::to_string(power) + ", "
+         + std::to_string(n) + ")";
+}
+
+/**
+ * Mixed queries over 40 (formula, power) pairs, each asked for many times
+ * with different n, are to generate every set once
+ */
+static void testSchedulerSharesCoefficients() {
+  cout << "Scheduler shares coefficients" << endl;
+  Formulas formulas;
+  PowerSumScheduler scheduler(3);
+  long ids[NUM_FORMULAS];
+  for (int i = 0; i < NUM_FORMULAS; i++) {
+    ids[i] = scheduler.addFormula(*formulas.all[i]);
+  }
+  vector<future<mpz_class> > results;
+  vector<int> formula;
+  vector<long> power;
+  vector<long> n;
+  for (int i = 0; i < 2000; i++) {
+    formula.push_back(i % NUM_FORMULAS);
+    power.push_back((i*7) % 40);
+    n.push_back((i*13) % 200);
+    results.push_back(scheduler.submit(ids[formula[i]], power[i], n[i]));
+  }
+  for (size_t i = 0; i < results.size(); i++) {
+    mpz_class sum = results[i].get();
+    PowerSum & ps = *formulas.all[formula[i]];
+    check(sum == ps.computeSum(power[i], n[i]),
+          describe(formulas.names[formula[i]], power[i], n[i]));
+  }
+  check(scheduler.getNumGenerated() == 40, "40 sets generated");
+  check(scheduler.getNumCoefficientSets() == 40, "40 sets kept");
+}
+
+/**
+ * With room for 4 sets, waves of queries over 8 powers keep at most 4 and
+ * generate the evicted ones again when they are asked for
+ */
+static void testSchedulerEvictsUnusedSets() {
+  cout << "Scheduler evicts unused sets" << endl;
+  StirlingPowerSum sps;
+  PowerSumScheduler scheduler(2, 4);
+  long id = scheduler.addFormula(sps);
+  for (int wave = 0; wave < 2; wave++) {
+    for (long power = 0; power < 8; power++) {
+      vector<future<mpz_class> > results;
+      for (long n = 0; n < 20; n++) {
+        results.push_back(scheduler.submit(id, power, n));
+      }
+      for (long n = 0; n < 20; n++) {
+        check(results[n].get() == sps.computeSumUsingSeries(power, n),
+              describe("Stirling", power, n));
+      }
+      check(scheduler.getNumCoefficientSets() <= 4, "at most 4 sets kept");
+    }
+  }
+  check(scheduler.getNumGenerated() == 16, "16 sets generated");
+
+  // The set used last is still kept
+  scheduler.submit(id, 7, 5).get();
+  check(scheduler.getNumGenerated() == 16, "last set reused");
+}
+
+/**
+ * A formula registered after another one was removed gets coefficients of
+ * its own, even when it lives at the same address, and the removed id is
+ * refused
+ */
+static void testSchedulerForgetsRemovedFormulas() {
+  cout << "Scheduler forgets removed formulas" << endl;
+  PowerSumScheduler scheduler(2);
+  std::unique_ptr<PowerSum> formula(new StirlingPowerSum());
+  long oldId = scheduler.addFormula(*formula);
+  check(scheduler.submit(oldId, 10, 100).get()
+        == formula->computeSumUsingSeries(10, 100), "sum before removal");
+  scheduler.removeFormula(oldId);
+  check(scheduler.getNumCoefficientSets() == 0, "sets dropped on removal");
+
+  formula.reset();
+  formula.reset(new EulerPowerSum());
+  long newId = scheduler.addFormula(*formula);
+  check(newId != oldId, "new id");
+  check(scheduler.submit(newId, 10, 100).get()
+        == formula->computeSumUsingSeries(10, 100), "sum after removal");
+  check(scheduler.getNumGenerated() == 2, "coefficients generated again");
+
+  bool refused = false;
+  try {
+    scheduler.submit(oldId, 10, 100);
+  } catch (std::invalid_argument &) {
+    refused = true;
+  }
+  check(refused, "removed id refused");
+}
+
+static bool sameCoefficients(const vector<mpq_class> & expected,
+                             const CoefficientArray & coeffs) {
+  if (coeffs.size() != expected.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < expected.size(); i++) {
+    if (mpq_equal(coeffs.rational(i), expected[i].get_mpq_t()) == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * The array filled by getCoefficients(power, coeffs) and the view are to
+ * hold the coefficients of getCoefficients(power), and the view is to be
+ * kept for repeated calls for the same power
+ */
+static void testCoefficientViews() {
+  cout << "Coefficient arrays and views" << endl;
+  Formulas formulas;
+  long powers[] = {0, 1, 2, 7, 30, 101};
+  CoefficientArray coeffs;
+  for (int f = 0; f < NUM_FORMULAS; f++) {
+    PowerSum & ps = *formulas.all[f];
+    for (size_t i = 0; i < sizeof(powers)/sizeof(powers[0]); i++) {
+      long power = powers[i];
+      string what = string(formulas.names[f]) + " power "
+                    + std::to_string(power);
+      vector<mpq_class> expected = ps.getCoefficients(power);
+      // The array is reused from the previous power
+      ps.getCoefficients(power, coeffs);
+      check(sameCoefficients(expected, coeffs), what + " array");
+      shared_ptr<const CoefficientArray> view = ps.getCoefficientView(power);
+      check(sameCoefficients(expected, *view), what + " view");
+      check(ps.getCoefficientView(power) == view, what + " view kept");
+    }
+  }
+}
+
+// Milliseconds a cancelled computation may take to stop
+static const long STOP_MILLIS = 500;
+
+static long millisSince(CancellationToken::Clock::time_point start) {
+  return (long)std::chrono::duration_cast<std::chrono::milliseconds>(
+                 CancellationToken::Clock::now() - start).count();
+}
+
+template<class T>
+static bool isCancelled(future<T> & result) {
+  try {
+    result.get();
+  } catch (ComputationCancelled &) {
+    return true;
+  }
+  return false;
+}
+
+/**
+ * Faulhaber for a high power on several threads takes seconds, so it is
+ * still running when it is cancelled and has to stop soon after, the rows
+ * being eliminated on the threads of the pool included
+ */
+static void testCancelStopsComputation() {
+  cout << "Cancel stops a multi-threaded computation" << endl;
+  FaulhaberPowerSum fps;
+  fps.setNumThreads(3);
+  shared_ptr<CancellationToken> coeffToken(new CancellationToken());
+  shared_ptr<CancellationToken> sumToken(new CancellationToken());
+  future<vector<mpq_class> > coeffs = fps.getCoefficientsAsync(6000,
+                                                               coeffToken);
+  future<mpz_class> sum = fps.computeSumAsync(6000, 100000, sumToken);
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  CancellationToken::Clock::time_point start = CancellationToken::Clock::now();
+  coeffToken->cancel();
+  sumToken->cancel();
+  check(isCancelled(coeffs), "coefficients cancelled");
+  check(isCancelled(sum), "sum cancelled");
+  check(millisSince(start) < STOP_MILLIS, "stopped soon after cancel");
+}
+
+/**
+ * Most of the sieve lies in the trees of the first few roots, so a sieve
+ * for many terms on several threads has to stop inside those trees
+ */
+static void testCancelStopsSieve() {
+  cout << "Cancel stops a multi-threaded sieve" << endl;
+  StirlingPowerSum sps;
+  sps.setNumThreads(3);
+  sps.setSeriesMethod(PowerSum::SERIES_SIEVE);
+  shared_ptr<CancellationToken> token(new CancellationToken());
+  future<mpz_class> sum = std::async(std::launch::async, [&sps, token]() {
+    CancellationScope scope(token.get());
+    return sps.computeSumUsingSeries(100, 100000000);
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  CancellationToken::Clock::time_point start = CancellationToken::Clock::now();
+  token->cancel();
+  check(isCancelled(sum), "sieve cancelled");
+  check(millisSince(start) < STOP_MILLIS, "stopped soon after cancel");
+}
+
+/**
+ * A deadline cancels a long computation on its own, while one without a
+ * token or with time to spare finishes with the right sum
+ */
+static void testDeadlineStopsComputation() {
+  cout << "Deadline stops a computation" << endl;
+  BernoulliPowerSum bps;
+  StirlingPowerSum sps;
+  shared_ptr<CancellationToken> shortToken(new CancellationToken());
+  shortToken->setTimeout(100);
+  shared_ptr<CancellationToken> longToken(new CancellationToken());
+  longToken->setTimeout(60000);
+
+  CancellationToken::Clock::time_point start = CancellationToken::Clock::now();
+  future<mpz_class> late = bps.computeSumAsync(5000, 100, shortToken);
+  future<mpz_class> noToken = bps.computeSumAsync(30, 1000, NULL);
+  future<mpz_class> inTime = sps.computeSumAsync(30, 1000, longToken);
+  check(isCancelled(late), "sum cancelled at the deadline");
+  check(millisSince(start) < 100 + STOP_MILLIS, "stopped soon after deadline");
+
+  mpz_class expected = sps.computeSumUsingSeries(30, 1000);
+  check(noToken.get() == expected, "sum without a token");
+  check(inTime.get() == expected, "sum before the deadline");
+}
+
+/**
+ * A tracker started while another one runs sees only the bytes held from
+ * then on and leaves the peak of the other one alone, and packed
+ * coefficients count like GMP numbers
+ */
+static void testPeakTrackersAreIndependent() {
+  cout << "Peak trackers are independent" << endl;
+  const long BIG_BYTES = 1 << 20;
+  int outer = GmpAllocator::startPeakTracking();
+  check(outer >= 0, "outer tracker started");
+  {
+    mpz_class big;
+    mpz_setbit(big.get_mpz_t(), 8*BIG_BYTES);
+  }
+  int inner = GmpAllocator::startPeakTracking();
+  check(inner >= 0 && inner != outer, "inner tracker started");
+  {
+    mpz_class small = 1;
+    small <<= 8*1024;
+    CoefficientArray coeffs;
+    coeffs.reserve(1, mpz_size(small.get_mpz_t()));
+    coeffs.append(small);
+  }
+  long innerPeak = GmpAllocator::stopPeakTracking(inner);
+  check(innerPeak >= 2*1024 && innerPeak < BIG_BYTES, "inner peak");
+  check(GmpAllocator::stopPeakTracking(outer) >= BIG_BYTES, "outer peak");
+}
+
+int main() {
+  // Counts the bytes held for the peak trackers
+  GmpAllocator::installCounting();
+  testSchedulerSharesCoefficients();
+  testSchedulerEvictsUnusedSets();
+  testSchedulerForgetsRemovedFormulas();
+  testCoefficientViews();
+  testCancelStopsComputation();
+  testCancelStopsSieve();
+  testDeadlineStopsComputation();
+  testPeakTrackersAreIndependent();
+  if (numFailures > 0) {
+    cout << numFailures << " checks failed" << endl;
+    return EXIT_FAILURE;
+  }
+  cout << "All tests passed" << endl;
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,75 @@
+/* Benchmark of the coefficient recurrences of the Stirling, Euler and
+ * Central Factorial formulas.  For every power of a grid it times
+ * getCoefficients and counts the GMP allocator calls made, both per cell of
+ * the triangle of the recurrence (power^2/2 cells).
+ *
+ * Usage: RecurrenceBench [<power> ...]
+ */
+#include <stdlib.h>
+#include <time.h>
+
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "CentralFactorialPowerSum.h"
+#include "EulerPowerSum.h"
+#include "GmpAllocator.h"
+#include "StirlingPowerSum.h"
+
+using std::cout;
+using std::endl;
+using std::setw;
+using std::string;
+using std::vector;
+
+static void benchmark(const string & name, PowerSum & ps, long power) {
+  struct timespec before;
+  struct timespec after;
+
+  GmpAllocatorStats start = GmpAllocator::getStats();
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &before);
+  {
+    vector<mpq_class> coeffs = ps.getCoefficients(power);
+  }
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &after);
+  GmpAllocatorStats end = GmpAllocator::getStats();
+
+  double cells = (double)power*power/2;
+  long calls = (end.allocations - start.allocations)
+               + (end.reallocations - start.reallocations);
+  cout << setw(18) << name << setw(8) << power
+       << setw(14) << elapsedNano(before, after)
+       << setw(12) << std::fixed << std::setprecision(2)
+       << elapsedNano(before, after)/cells
+       << setw(12) << calls
+       << setw(12) << std::setprecision(4) << calls/cells << endl;
+}
+
+int main(int argc, char ** argv) {
+  vector<long> powers;
+  for (int i = 1; i < argc; i++) {
+    powers.push_back(atol(argv[i]));
+  }
+  if (powers.empty()) {
+    long grid[] = {100, 250, 500, 1000, 2000, 4000};
+    powers.assign(grid, grid + sizeof(grid)/sizeof(grid[0]));
+  }
+
+  // Count the allocator calls of GMP
+  GmpAllocator::install();
+
+  StirlingPowerSum sps;
+  EulerPowerSum eps;
+  CentralFactorialPowerSum cps;
+  cout << setw(18) << "Formula" << setw(8) << "Power" << setw(14) << "Time (ns)"
+       << setw(12) << "ns/cell" << setw(12) << "Allocs" << setw(12)
+       << "Allocs/cell" << endl;
+  for (size_t i = 0; i < powers.size(); i++) {
+    benchmark("Stirling", sps, powers[i]);
+    benchmark("Euler", eps, powers[i]);
+    benchmark("Central Factorial", cps, powers[i]);
+  }
+  return EXIT_SUCCESS;
+}
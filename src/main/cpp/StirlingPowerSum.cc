@@ -1,26 +1,33 @@
+#include <math.h>
+
 #include <iostream>
 
 using std::endl;
 
 #include "StirlingPowerSum.h"
+#include "Trace.h"
 
 StirlingPowerSum :: StirlingPowerSum()
                   : PowerSum() {
 }
 
 vector<mpq_class> StirlingPowerSum :: getCoefficients(long power) {
-  vector<mpq_class> outCoeffs;
+  checkMemoryLimit(predictMemory(power, power));
   vector<mpz_class> coeffs = getCoefficients(power, power + 1);
-  for (size_t i = 0; i < coeffs.size(); i++) {
-    outCoeffs.push_back(mpq_class(coeffs[i]));
-  }
-  return outCoeffs;
+  return moveToRationals(coeffs);
+}
+
+void StirlingPowerSum :: getCoefficients(long power,
+                                         CoefficientArray & coeffs) {
+  checkMemoryLimit(predictMemory(power, power));
+  packCoefficients(getCoefficients(power, power + 1), power + 1, coeffs);
 }
 
 void StirlingPowerSum :: printSumFormula(long power, ostream &out) {
   if (power < 0) {
     return;
   }
+  checkMemoryLimit(predictMemory(power, power));
 
   vector<mpz_class> coeffs = getCoefficients(power, power + 1);
   bool firstTime = true;
@@ -46,26 +53,50 @@ void StirlingPowerSum :: printSumFormula(long power, ostream &out) {
   out << endl;
 }
 
-mpz_class StirlingPowerSum :: computeSumWithTimeStat(long power, long n, 
-                                                     vector<long> & stat) {
-  struct timespec before;
-  struct timespec after;
-
+mpz_class StirlingPowerSum :: computeSumWithStats(long power, long n,
+                                                  PowerSumStats & stats) {
+  checkMemoryLimit(predictMemory(power, n));
+  PowerSumStatsRecorder recorder(stats);
   mpz_class sum = 0;
-  stat.clear();
 
   if (power < 0 || n < 0) {
-    stat.push_back(0);
-    stat.push_back(0);
+    recorder.finish(sum);
     return sum;
   }
 
-  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &before);
-  vector<mpz_class> coeffs = getCoefficients(power, n + 1);
-  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &after);
-  stat.push_back(computeCpuTime(before, after));
+  recorder.startPhase();
+  // Only the terms up to n are worked out, the rest are 0
+  long numCoeffs = ((power < n) ? power : n) + 1;
+  CoefficientArray coeffs;
+  packCoefficients(getCoefficients(power, numCoeffs), numCoeffs, coeffs);
+  recorder.endPhase(stats.init);
+  recorder.recordCoefficients(coeffs);
+
+  recorder.startPhase();
+  sum = evaluateSum(coeffs, n, stats.bigMultiplications);
+  recorder.endPhase(stats.sum);
+  recorder.finish(sum);
+  return sum;
+}
+
+mpz_class StirlingPowerSum :: computeSumUsingCoefficients(
+                                const CoefficientArray & coeffs, long power,
+                                long n) {
+  checkMemoryLimit(predictMemory(power, n));
+  if (power < 0 || n < 0) {
+    return 0;
+  }
+  long multiplications = 0;
+  return evaluateSum(coeffs, n, multiplications);
+}
 
-  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &before);
+/**
+ * Add up coeffs[t](n + 1)n...(n - t + 1)/(t + 1) for t = 0, 1, ...
+ */
+mpz_class StirlingPowerSum :: evaluateSum(const CoefficientArray & coeffs,
+                                          long n, long & multiplications) {
+  TraceScope trace("Stirling summation");
+  mpz_class sum = 0;
   mpz_class fallingFactorial = n + 1;
   mpz_class factor = 0;
   long numTermsToCompute = coeffs.size();
@@ -73,18 +104,39 @@ mpz_class StirlingPowerSum :: computeSumWithTimeStat(long power, long n,
     numTermsToCompute = n + 1;
   }
   for (long t = 0; t < numTermsToCompute; t++) {
+    CancellationToken::checkCurrent();
     // We know that the following division is exact and we do this first
     // before the multiplication to avoid generating a large intermediate
     // value
-    factor = fallingFactorial/(t + 1);
-    sum += coeffs[t]*factor;;
+    mpz_divexact_ui(factor.get_mpz_t(), fallingFactorial.get_mpz_t(), t + 1);
+    mpz_addmul(sum.get_mpz_t(), coeffs.numerator(t), factor.get_mpz_t());
+    multiplications++;
     fallingFactorial *= (n - t);
   }
-  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &after);
-  stat.push_back(computeCpuTime(before, after));
   return sum;
 }
 
+/**
+ * The coefficients up to n take the room getCoefficients reserves for them
+ * and are packed once more for the summation, which also holds a falling
+ * factorial, its quotient and the sum.  Each packed one also has an offset,
+ * a size and a view, which numberBytes(0) covers.  The rest stay 0 and hold
+ * no limbs.
+ */
+double StirlingPowerSum :: predictMemory(long power, long n) {
+  if (power < 0 || n < 0) {
+    return 0;
+  }
+  long lastTerm = (power > n) ? n : power;
+  double coefficients = (lastTerm + 1)*numberBytes(0);
+  for (long term = 1; term <= lastTerm; term++) {
+    coefficients += numberBytes(log2nCr(power - 1, term - 1)
+                                + (power - term)*log2((double)term));
+  }
+  return (power - lastTerm)*sizeof(__mpz_struct) + 2*coefficients
+         + 3*numberBytes(log2Sum(power, n));
+}
+
 StirlingPowerSum :: ~StirlingPowerSum() {
 }
 
@@ -100,6 +152,7 @@ StirlingPowerSum :: ~StirlingPowerSum() {
  */
 vector<mpz_class> StirlingPowerSum :: getCoefficients(long power,
                                               long maxNumCoefficients) {
+  TraceScope trace("Stirling recurrence");
   vector<mpz_class> coeffs;
 
   if (power < 0) {
@@ -113,20 +166,28 @@ vector<mpz_class> StirlingPowerSum :: getCoefficients(long power,
       coeffs.push_back(0);
     }
 
-    // Anchors to hold values from previous iteration
-    mpz_class Smj = 0;
-    mpz_class Sm_1j_1 = 1; // S(0, 0)
-  
+    // Make room for the final values so that the coefficients are never
+    // reallocated as they grow.  S(m, j) <= Binom((m - 1), (j - 1))j^(m - j)
+    long lastTerm = (power > maxNumCoefficients) ? maxNumCoefficients : power;
+    for (long term = 1; term <= lastTerm; term++) {
+      reserveBits(coeffs[term], log2nCr(power - 1, term - 1)
+                                + (power - term)*log2((double)term));
+    }
+    coeffs[0] = 1; // S(0, 0)
+
     for (long currentPower = 1; currentPower <= power; currentPower++) {
+      CancellationToken::checkCurrent();
       long termMax
        = (currentPower > maxNumCoefficients)? maxNumCoefficients : currentPower;
-      // Initialize other coefficients for the current power
-      for(long term = 1; term <= termMax; term++) {
-        Smj = term*coeffs[term] + Sm_1j_1;
-        Sm_1j_1 = coeffs[term];
-        coeffs[term] = Smj;
+      // Update the coefficients for the current power in place.  Going down
+      // the row, coeffs[term - 1] still holds S(m - 1, term - 1) when it is
+      // needed, so no temporaries are involved
+      for(long term = termMax; term >= 1; term--) {
+        mpz_mul_ui(coeffs[term].get_mpz_t(), coeffs[term].get_mpz_t(), term);
+        mpz_add(coeffs[term].get_mpz_t(), coeffs[term].get_mpz_t(),
+                coeffs[term - 1].get_mpz_t());
       }
-      Sm_1j_1 = coeffs[0];
+      coeffs[0] = 0; // S(m, 0) for m > 0
     }
   } else {
     coeffs.push_back(1);
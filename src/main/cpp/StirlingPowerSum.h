@@ -7,13 +7,23 @@ class StirlingPowerSum : public PowerSum {
   public:
     StirlingPowerSum();
     virtual vector<mpq_class> getCoefficients(long power);
+    virtual void getCoefficients(long power, CoefficientArray & coeffs);
     virtual void printSumFormula(long power, ostream &out);
-    virtual mpz_class computeSumWithTimeStat(long power, long n,
-                                             vector<long> & stat);
+    virtual mpz_class computeSumWithStats(long power, long n,
+                                          PowerSumStats & stats);
+    virtual mpz_class computeSumUsingCoefficients(
+                        const CoefficientArray & coeffs, long power,
+                        long n);
+    virtual double predictMemory(long power, long n);
     virtual ~StirlingPowerSum();
 
-  private:
+  protected:
+    // Kernel, timed on its own by KernelBench
     vector<mpz_class> getCoefficients(long power, long maxNumCoefficients);
+
+  private:
+    mpz_class evaluateSum(const CoefficientArray & coeffs, long n,
+                          long & multiplications);
     void printFactors(long term, ostream & out);
 
 };
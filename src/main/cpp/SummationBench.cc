@@ -0,0 +1,75 @@
+/* Benchmark of the summation step of the five formulas, the part of
+ * computeSumWithTimeStat that streams over the coefficients once they are
+ * known.  For every power of a grid it reports the median summation time
+ * over a few runs and the time per coefficient.
+ *
+ * Usage: SummationBench [<numTerms> [<power> ...]]
+ */
+#include <stdlib.h>
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "BernoulliPowerSum.h"
+#include "CentralFactorialPowerSum.h"
+#include "EulerPowerSum.h"
+#include "FaulhaberPowerSum.h"
+#include "StirlingPowerSum.h"
+
+using std::cout;
+using std::endl;
+using std::setw;
+using std::string;
+using std::vector;
+
+static const int NUM_RUNS = 5;
+
+static void benchmark(const string & name, PowerSum & ps, long power,
+                      long numTerms) {
+  vector<long> times;
+  vector<long> stat;
+  for (int run = 0; run < NUM_RUNS; run++) {
+    ps.computeSumWithTimeStat(power, numTerms, stat);
+    times.push_back(stat[1]);
+  }
+  std::sort(times.begin(), times.end());
+  long median = times[NUM_RUNS/2];
+  cout << setw(18) << name << setw(8) << power << setw(14) << median
+       << setw(12) << std::fixed << std::setprecision(1)
+       << (double)median/(power + 1) << endl;
+}
+
+int main(int argc, char ** argv) {
+  long numTerms = 1000000000L;
+  vector<long> powers;
+  if (argc > 1) {
+    numTerms = atol(argv[1]);
+  }
+  for (int i = 2; i < argc; i++) {
+    powers.push_back(atol(argv[i]));
+  }
+  if (powers.empty()) {
+    long grid[] = {100, 250, 500, 1000, 2000};
+    powers.assign(grid, grid + sizeof(grid)/sizeof(grid[0]));
+  }
+
+  FaulhaberPowerSum fps;
+  BernoulliPowerSum bps;
+  StirlingPowerSum sps;
+  EulerPowerSum eps;
+  CentralFactorialPowerSum cps;
+  cout << "Number of terms = " << numTerms << endl;
+  cout << setw(18) << "Formula" << setw(8) << "Power" << setw(14)
+       << "Sum time (ns)" << setw(12) << "ns/coeff" << endl;
+  for (size_t i = 0; i < powers.size(); i++) {
+    benchmark("Faulhaber", fps, powers[i], numTerms);
+    benchmark("Bernoulli", bps, powers[i], numTerms);
+    benchmark("Stirling", sps, powers[i], numTerms);
+    benchmark("Euler", eps, powers[i], numTerms);
+    benchmark("Central Factorial", cps, powers[i], numTerms);
+  }
+  return EXIT_SUCCESS;
+}
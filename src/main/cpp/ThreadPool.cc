@@ -0,0 +1,223 @@
+#include <pthread.h>
+#include <time.h>
+
+#include "ThreadPool.h"
+#include "Trace.h"
+
+using std::atomic;
+using std::condition_variable;
+using std::make_shared;
+using std::mutex;
+using std::packaged_task;
+using std::shared_ptr;
+using std::thread;
+using std::unique_lock;
+
+// Pool and queue of the thread running this code, if it is a thread of a pool
+static thread_local ThreadPool * currentPool = NULL;
+static thread_local size_t currentQueue = 0;
+
+ThreadPool :: ThreadPool(int numThreads)
+            : nextQueue(0), pending(0), stopping(false) {
+  for (int i = 1; i < numThreads; i++) {
+    queues.push_back(std::unique_ptr<WorkQueue>(new WorkQueue()));
+  }
+  for (size_t i = 0; i < queues.size(); i++) {
+    workers.push_back(thread(&ThreadPool::work, this, i));
+  }
+}
+
+int ThreadPool :: size() {
+  return (int)workers.size() + 1;
+}
+
+future<void> ThreadPool :: submit(function<void()> task) {
+  shared_ptr<packaged_task<void()> > packaged
+    = make_shared<packaged_task<void()> >(task);
+  future<void> done = packaged->get_future();
+  if (workers.empty()) {
+    (*packaged)();
+  } else {
+    push([packaged]() { (*packaged)(); });
+  }
+  return done;
+}
+
+// Progress of one parallelFor.  It is shared with the helper tasks since
+// they may only get to run after parallelFor has returned.
+struct ParallelForState {
+  long first;
+  long last;
+  long grain;
+  long numChunks;
+  function<void(long, long)> body;
+  atomic<long> nextChunk;
+  atomic<long> chunksDone;
+  mutex lock;
+  condition_variable done;
+  std::exception_ptr error; // First exception thrown by body
+};
+
+static void runChunks(ParallelForState & state) {
+  long chunk;
+  while ((chunk = state.nextChunk++) < state.numChunks) {
+    long begin = state.first + chunk*state.grain;
+    long end = (state.last - begin < state.grain) ?
+               state.last : begin + state.grain;
+    try {
+      state.body(begin, end);
+    } catch (...) {
+      unique_lock<mutex> guard(state.lock);
+      if (!state.error) {
+        state.error = std::current_exception();
+      }
+      // Skip the chunks nobody has started.  They count as done.
+      long skipped = state.numChunks
+                     - state.nextChunk.exchange(state.numChunks);
+      if (skipped > 0) {
+        state.chunksDone += skipped;
+      }
+    }
+    if (++state.chunksDone == state.numChunks) {
+      unique_lock<mutex> guard(state.lock);
+      state.done.notify_all();
+    }
+  }
+}
+
+void ThreadPool :: parallelFor(long first, long last, long grain,
+                               const function<void(long, long)> & body) {
+  if (last <= first) {
+    return;
+  }
+  if (grain < 1) {
+    grain = 1;
+  }
+  long numChunks = (last - first + grain - 1)/grain;
+  if (numChunks == 1 || workers.empty()) {
+    body(first, last);
+    return;
+  }
+
+  shared_ptr<ParallelForState> state = make_shared<ParallelForState>();
+  state->first = first;
+  state->last = last;
+  state->grain = grain;
+  state->numChunks = numChunks;
+  state->body = body;
+  state->nextChunk = 0;
+  state->chunksDone = 0;
+  long numHelpers = (long)workers.size();
+  if (numHelpers > numChunks - 1) {
+    numHelpers = numChunks - 1;
+  }
+  for (long i = 0; i < numHelpers; i++) {
+    push([state]() { runChunks(*state); });
+  }
+
+  runChunks(*state);
+  unique_lock<mutex> guard(state->lock);
+  while (state->chunksDone < numChunks) {
+    state->done.wait(guard);
+  }
+  if (state->error) {
+    std::rethrow_exception(state->error);
+  }
+}
+
+/**
+ * Threads waiting for tasks take no CPU time, so the difference between two
+ * calls is the CPU time of the tasks run in between
+ */
+long ThreadPool :: getCpuTime() {
+  long total = 0;
+  for (size_t i = 0; i < workers.size(); i++) {
+    clockid_t clock;
+    struct timespec used;
+    if (pthread_getcpuclockid(workers[i].native_handle(), &clock) == 0
+        && clock_gettime(clock, &used) == 0) {
+      total += used.tv_sec*1000000000L + used.tv_nsec;
+    }
+  }
+  return total;
+}
+
+ThreadPool :: ~ThreadPool() {
+  {
+    unique_lock<mutex> guard(lock);
+    stopping = true;
+  }
+  ready.notify_all();
+  for (size_t i = 0; i < workers.size(); i++) {
+    workers[i].join();
+  }
+}
+
+void ThreadPool :: push(function<void()> task) {
+  size_t target;
+  if (currentPool == this) {
+    target = currentQueue;
+  } else {
+    target = nextQueue++ % queues.size();
+  }
+  {
+    unique_lock<mutex> guard(queues[target]->lock);
+    queues[target]->tasks.push_back(task);
+  }
+  {
+    unique_lock<mutex> guard(lock);
+    pending++;
+  }
+  ready.notify_one();
+}
+
+/**
+ * Take the newest task of the thread's own queue, which is the one most
+ * likely to find its data in the cache, or else steal the oldest task of
+ * another queue, starting with the next one so that thieves spread out
+ */
+bool ThreadPool :: take(size_t self, function<void()> & task) {
+  for (size_t i = 0; i < queues.size(); i++) {
+    size_t victim = (self + i) % queues.size();
+    unique_lock<mutex> guard(queues[victim]->lock);
+    std::deque<function<void()> > & tasks = queues[victim]->tasks;
+    if (tasks.empty()) {
+      continue;
+    }
+    if (victim == self) {
+      task = tasks.back();
+      tasks.pop_back();
+    } else {
+      task = tasks.front();
+      tasks.pop_front();
+    }
+    pending--;
+    return true;
+  }
+  return false;
+}
+
+void ThreadPool :: work(size_t self) {
+  currentPool = this;
+  currentQueue = self;
+  Trace::setThreadName("pool");
+  for (;;) {
+    function<void()> task;
+    if (take(self, task)) {
+      TraceScope trace("pool task");
+      task();
+      continue;
+    }
+    unique_lock<mutex> guard(lock);
+    if (pending > 0) {
+      // A task is being pushed or taken right now
+      guard.unlock();
+      std::this_thread::yield();
+      continue;
+    }
+    if (stopping) {
+      return;
+    }
+    ready.wait(guard);
+  }
+}
@@ -0,0 +1,91 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using std::function;
+using std::future;
+using std::vector;
+
+class ThreadPool {
+  public:
+    /* To create a pool.  The thread calling parallelFor also does its share
+     * of the work, so only numThreads - 1 threads are started.
+     * Parameters:
+     *   numThreads - number of threads working on a parallelFor (IN)
+     */
+    ThreadPool(int numThreads);
+
+    /* To get the number of threads working on a parallelFor
+     * Return value
+     *   number of threads including the calling thread
+     */
+    int size();
+
+    /* To run a task on one of the threads of the pool.  Every thread has its
+     * own queue.  A task submitted from a thread of the pool goes to the queue
+     * of that thread, which runs its newest task first.  Other tasks are dealt
+     * out to the queues in turn.  A thread whose queue is empty steals the
+     * oldest task of another queue.  With no threads in the pool, the task
+     * runs on the calling thread before submit returns.
+     * Parameters:
+     *   task - task to run (IN)
+     * Return value
+     *   future that becomes ready when the task has run
+     */
+    future<void> submit(function<void()> task);
+
+    /* To run body over [first, last) split into chunks of grain indices.  The
+     * chunks are shared between the calling thread and the threads of the
+     * pool.  Returns when all chunks are done.  If body throws, chunks not
+     * yet started are skipped and the first exception is rethrown here.
+     * Parameters:
+     *   first - first index (IN)
+     *   last - one past the last index (IN)
+     *   grain - number of indices in a chunk (IN)
+     *   body - function called as body(begin, end) for every chunk (IN)
+     */
+    void parallelFor(long first, long last, long grain,
+                     const function<void(long, long)> & body);
+
+    /* To get the CPU time the threads of the pool have taken since they
+     * started, which leaves out the threads calling submit and parallelFor
+     * Return value
+     *   CPU time in nanoseconds
+     */
+    long getCpuTime();
+
+    ~ThreadPool();
+
+  private:
+    ThreadPool(const ThreadPool &);
+    ThreadPool & operator=(const ThreadPool &);
+    // Tasks queued for one thread of the pool
+    struct WorkQueue {
+      std::mutex lock;
+      std::deque<function<void()> > tasks;
+    };
+
+    void work(size_t self);
+    void push(function<void()> task);
+    bool take(size_t self, function<void()> & task);
+
+    vector<std::unique_ptr<WorkQueue> > queues;
+    vector<std::thread> workers;
+    std::atomic<size_t> nextQueue;
+    std::atomic<long> pending;
+    // Idle threads sleep on ready.  pending is only increased with lock held
+    std::mutex lock;
+    std::condition_variable ready;
+    bool stopping;
+};
+
+#endif
@@ -0,0 +1,146 @@
+#include <time.h>
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "Trace.h"
+
+using std::endl;
+using std::vector;
+
+std::atomic<bool> Trace :: enabled(false);
+
+struct TraceEvent {
+  const char * name;
+  long start;
+  long end;
+};
+
+// Events of one thread.  Only that thread adds to it.  The lock keeps the
+// writer of the trace out while an event is added.
+struct ThreadBuffer {
+  int id;
+  const char * name;
+  std::mutex lock;
+  vector<TraceEvent> events;
+};
+
+// Buffers outlive their threads so that events of threads of a pool that
+// was shut down still make it into the trace
+static std::mutex buffersLock;
+static vector<std::unique_ptr<ThreadBuffer> > buffers;
+
+static thread_local ThreadBuffer * threadBuffer = NULL;
+static thread_local const char * threadName = NULL;
+
+static ThreadBuffer * getThreadBuffer() {
+  if (threadBuffer == NULL) {
+    std::lock_guard<std::mutex> guard(buffersLock);
+    buffers.push_back(std::unique_ptr<ThreadBuffer>(new ThreadBuffer()));
+    threadBuffer = buffers.back().get();
+    threadBuffer->id = (int)buffers.size();
+    threadBuffer->name = threadName;
+  }
+  return threadBuffer;
+}
+
+static void writeName(const char * name, ostream & out) {
+  out << '"';
+  for (const char * c = name; *c != '\0'; c++) {
+    if (*c == '"' || *c == '\\') {
+      out << '\\';
+    }
+    out << *c;
+  }
+  out << '"';
+}
+
+// Time stamps of the trace format are in microseconds
+static void writeMicros(long nanos, ostream & out) {
+  out << nanos/1000 << '.' << (char)('0' + nanos/100%10)
+      << (char)('0' + nanos/10%10) << (char)('0' + nanos%10);
+}
+
+void Trace :: setEnabled(bool value) {
+  enabled = value;
+}
+
+long Trace :: now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec*1000000000L + time.tv_nsec;
+}
+
+void Trace :: record(const char * name, long start, long end) {
+  ThreadBuffer * buffer = getThreadBuffer();
+  TraceEvent event = {name, start, end};
+  std::lock_guard<std::mutex> guard(buffer->lock);
+  buffer->events.push_back(event);
+}
+
+void Trace :: setThreadName(const char * name) {
+  threadName = name;
+  if (threadBuffer != NULL) {
+    std::lock_guard<std::mutex> guard(threadBuffer->lock);
+    threadBuffer->name = name;
+  }
+}
+
+/**
+ * Every stage is written as a complete event ("ph": "X") with its start and
+ * duration.  The time stamps are taken relative to the earliest event so
+ * that the timeline starts at 0.  Threads are named by metadata events.
+ */
+void Trace :: write(ostream & out) {
+  std::lock_guard<std::mutex> guard(buffersLock);
+  long origin = 0;
+  bool haveOrigin = false;
+  for (size_t b = 0; b < buffers.size(); b++) {
+    std::lock_guard<std::mutex> bufferGuard(buffers[b]->lock);
+    const vector<TraceEvent> & events = buffers[b]->events;
+    for (size_t e = 0; e < events.size(); e++) {
+      if (!haveOrigin || events[e].start < origin) {
+        origin = events[e].start;
+        haveOrigin = true;
+      }
+    }
+  }
+
+  out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+  bool first = true;
+  for (size_t b = 0; b < buffers.size(); b++) {
+    ThreadBuffer & buffer = *buffers[b];
+    std::lock_guard<std::mutex> bufferGuard(buffer.lock);
+    out << (first ? "" : ",") << endl
+        << "  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": "
+        << buffer.id << ", \"args\": {\"name\": ";
+    if (buffer.name != NULL) {
+      writeName(buffer.name, out);
+    } else {
+      out << "\"thread " << buffer.id << '"';
+    }
+    out << "}}";
+    first = false;
+    for (size_t e = 0; e < buffer.events.size(); e++) {
+      const TraceEvent & event = buffer.events[e];
+      out << ',' << endl << "  {\"name\": ";
+      writeName(event.name, out);
+      out << ", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer.id
+          << ", \"ts\": ";
+      writeMicros(event.start - origin, out);
+      out << ", \"dur\": ";
+      writeMicros(event.end - event.start, out);
+      out << '}';
+    }
+  }
+  out << endl << "]}" << endl;
+}
+
+void Trace :: clear() {
+  std::lock_guard<std::mutex> guard(buffersLock);
+  for (size_t b = 0; b < buffers.size(); b++) {
+    std::lock_guard<std::mutex> bufferGuard(buffers[b]->lock);
+    buffers[b]->events.clear();
+  }
+}
@@ -0,0 +1,98 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+
+#include <atomic>
+#include <iostream>
+
+using std::ostream;
+
+/* Timeline of the stages of a run, written in the Chrome trace event format
+ * that chrome://tracing and Perfetto open.  Every thread records its events
+ * into a buffer of its own.  Recording is off by default.  Then a trace point
+ * costs one load of a flag.
+ */
+class Trace {
+  public:
+    /* To turn recording on or off
+     * Parameters:
+     *   enabled - true to record (IN)
+     */
+    static void setEnabled(bool enabled);
+
+    /* To find out if recording is on
+     * Return value
+     *   true if events are recorded
+     */
+    static bool isEnabled() {
+      return enabled.load(std::memory_order_relaxed);
+    }
+
+    /* To get the time stamp of an event
+     * Return value
+     *   monotonic time in nanoseconds
+     */
+    static long now();
+
+    /* To record a finished stage on the calling thread
+     * Parameters:
+     *   name - name of the stage, a string literal (IN)
+     *   start - time stamp of the start of the stage (IN)
+     *   end - time stamp of the end of the stage (IN)
+     */
+    static void record(const char * name, long start, long end);
+
+    /* To name the calling thread in the timeline.  Threads not named are
+     * numbered.
+     * Parameters:
+     *   name - name of the thread, a string literal (IN)
+     */
+    static void setThreadName(const char * name);
+
+    /* To write the events of all threads as a JSON trace.  Threads still
+     * recording may add events while it is written, which are left out or
+     * included.
+     * Parameters:
+     *   out - stream to write to (OUT)
+     */
+    static void write(ostream & out);
+
+    /* To drop the events recorded so far */
+    static void clear();
+
+  private:
+    static std::atomic<bool> enabled;
+};
+
+/* Records the lifetime of a scope as a stage of the timeline if recording
+ * was on when the scope was entered
+ */
+class TraceScope {
+  public:
+    /* To start a stage
+     * Parameters:
+     *   name - name of the stage, a string literal (IN)
+     */
+    explicit TraceScope(const char * name)
+      : name(Trace::isEnabled() ? name : NULL), start(0) {
+      if (this->name != NULL) {
+        start = Trace::now();
+      }
+    }
+
+    ~TraceScope() {
+      if (name != NULL) {
+        Trace::record(name, start, Trace::now());
+      }
+    }
+
+  private:
+    TraceScope(const TraceScope &);
+    TraceScope & operator=(const TraceScope &);
+
+    const char * name;
+    long start;
+};
+
+#endif
@@ -23,7 +23,81 @@ runOneTest() {
   cmp cpp${outSuffix} python${outSuffix} &&
     rm cpp${outSuffix} python${outSuffix}
 
+  reportResult $?
+}
+
+# Compares the output of the C++ implementation given options only it has
+# with that of the C implementation given the options they share.  Lines
+# matching the optional pattern, which the C++ options add, are left out.
+runCppOptionTest() {
+  testId=$1
+  cppOpts=$2
+  cOpts=$3
+  addedLines=${4:-'^$'}
+  outSuffix="_$testId.log"
+  $cppSrcDir/PowerSum $cppOpts 2>&1 |
+    grep -E -v 'Time|Usage:|PowerSum' |
+    grep -E -v "$addedLines" >cpp${outSuffix}
+  $cSrcDir/powersum $cOpts 2>&1 |
+    grep -E -v 'Time|Usage:|powersum' |
+    grep -E -v "$addedLines" >c${outSuffix}
+
+  cmp cpp${outSuffix} c${outSuffix} && rm cpp${outSuffix} c${outSuffix}
+
+  reportResult $?
+}
+
+# Checks that the C++ implementation fails with the given error message
+runErrorTest() {
+  testId=$1
+  testOpts=$2
+  expected=$3
+  outSuffix="_$testId.log"
+  $cppSrcDir/PowerSum $testOpts >/dev/null 2>cpp${outSuffix}
   code=$?
+
+  [ $code -ne 0 ] && [ "`head -1 cpp${outSuffix}`" = "$expected" ] &&
+    rm cpp${outSuffix}
+
+  reportResult $?
+}
+
+# Checks that the C++ implementation verified the given number of formulas
+# and that all of them matched
+runVerifyTest() {
+  testId=$1
+  testOpts=$2
+  numFormulas=$3
+  outSuffix="_$testId.log"
+  $cppSrcDir/PowerSum $testOpts >cpp${outSuffix} 2>&1
+
+  verified=`grep -c '^The sum' cpp${outSuffix}`
+  matched=`grep -c '^The sum matches with' cpp${outSuffix}`
+  [ $verified -eq $numFormulas ] && [ $matched -eq $numFormulas ] &&
+    rm cpp${outSuffix}
+
+  reportResult $?
+}
+
+# Checks that the given number of lines match the pattern in the output of
+# the C++ implementation, or in the file it writes if one is given
+runCountTest() {
+  testId=$1
+  testOpts=$2
+  pattern=$3
+  expected=$4
+  outSuffix="_$testId.log"
+  countFile=${5:-cpp${outSuffix}}
+  $cppSrcDir/PowerSum $testOpts >cpp${outSuffix} 2>&1
+
+  count=`grep -E -c "$pattern" $countFile`
+  [ $count -eq $expected ] && rm -f cpp${outSuffix} $countFile
+
+  reportResult $?
+}
+
+reportResult() {
+  code=$1
   if [ $code -eq 0 ]
   then
     echo "Test Successful :-)"
@@ -122,6 +196,174 @@ runOneTest 15 "-sv -2 10"
 echo "Running test with incorrect terms"
 runOneTest 16 "-sv 15 -3877"
 
+# Tests of options only the C++ implementation has
+
+echo "Running test with series sum using forward differences"
+runCppOptionTest 17 "-sv 36 100000 --series difference" "-sv 36 100000"
+
+echo "Running test with incorrect series method"
+runErrorTest 18 "-sv 5 10 --series product" "Invalid series method: product"
+
+echo "Running test with several threads"
+runCppOptionTest 19 "-sv 36 100000 --threads 3" "-sv 36 100000"
+
+echo "Running test with several threads and forward differences"
+runCppOptionTest 20 "-sv 36 100000 --threads 3 --series difference" \
+  "-sv 36 100000"
+
+echo "Running test with incorrect number of threads"
+runErrorTest 21 "-sv 5 10 --threads 0" "Invalid number of threads: 0"
+
+echo "Running test with series sum using a sieve"
+runCppOptionTest 22 "-sv 36 100000 --series sieve" "-sv 36 100000"
+
+echo "Running test with several threads and series sum using a sieve"
+runCppOptionTest 23 "-sv 36 100000 --threads 3 --series sieve" \
+  "-sv 36 100000"
+
+echo "Running test with series sum modulo primes"
+runVerifyTest 24 "-sv 36 100000 --verify modular" 5
+
+echo "Running test with series sum modulo primes using the scalar kernel"
+runVerifyTest 25 "-sv 36 100000 --verify modular --kernel scalar" 5
+
+echo "Running test with incorrect verification"
+runErrorTest 26 "-sv 5 10 --verify exact" "Invalid verification: exact"
+
+echo "Running test with incorrect kernel"
+runErrorTest 27 "-sv 5 10 --kernel sse" "Invalid kernel: sse"
+
+echo "Running test with modular verification"
+runVerifyTest 28 "-sm 36 10000000 --primes 8 --seed 1" 5
+
+echo "Running test with modular verification and no terms"
+runVerifyTest 29 "-sm 22 0 --seed 1" 5
+
+echo "Running test with incorrect number of primes"
+runErrorTest 30 "-sm 5 10 --primes 0" "Invalid number of primes: 0"
+
+echo "Running test with incorrect seed"
+runErrorTest 31 "-sm 5 10 --seed lucky" "Invalid seed: lucky"
+
+echo "Running test with formulas on threads of their own"
+runCppOptionTest 32 "-sv 36 100000 --concurrent" "-sv 36 100000"
+
+echo "Running test with formulas on threads of their own and several threads"
+runCppOptionTest 33 "-sv 36 100000 --concurrent --threads 3" \
+  "-sv 36 100000"
+
+echo "Running test with formulas on threads of their own and -sm"
+runVerifyTest 34 "-sm 36 100000 --concurrent --seed 1" 5
+
+echo "Running test with a timeout every formula exceeds"
+runCountTest 35 "-s 10000 100000 --timeout 50" '^Cancelled after 50 ms$' 5
+
+echo "Running test with a timeout every formula meets"
+runCppOptionTest 36 "-sv 36 100000 --timeout 600000" "-sv 36 100000"
+
+echo "Running test with incorrect timeout"
+runErrorTest 37 "-sv 5 10 --timeout soon" "Invalid timeout: soon"
+
+echo "Running test with the pool allocator"
+runCppOptionTest 38 "-sv 36 100000 --allocator pool" "-sv 36 100000" \
+  '^Allocator:'
+
+echo "Running test with incorrect allocator"
+runErrorTest 39 "-sv 5 10 --allocator arena" "Invalid allocator: arena"
+
+echo "Running test with measurements of each formula"
+runCppOptionTest 40 "-sv 36 100000 --stats" "-sv 36 100000" \
+  'cpu:wall\)|^Coefficients =|^Result bits|^GMP|^Predicted memory'
+
+echo "Running test with hardware counts of each formula"
+runCppOptionTest 41 "-sv 36 100000 --perf" "-sv 36 100000" \
+  ' cycles = | cache misses = |^Hardware counters not available$'
+
+echo "Running test with a trace of the stages"
+runCppOptionTest 42 "-sv 36 100000 --trace trace_42.json" "-sv 36 100000" &&
+  rm trace_42.json
+
+echo "Running test with a trace of formulas on threads of their own"
+runCountTest 43 "-sv 36 100000 --concurrent --trace trace_43.json" \
+  '"thread_name"' 6 trace_43.json
+
+echo "Running test with missing trace file"
+runErrorTest 44 "-sv 5 10 --trace" "Missing value for option: --trace"
+
+echo "Running test with trace file that cannot be written"
+runErrorTest 45 "-sv 5 10 --trace /nonexistent/trace.json" \
+  "Cannot write trace file: /nonexistent/trace.json"
+
+echo "Running test with the automatic formula"
+runVerifyTest 46 "-sv 36 100000 --auto" 1
+
+echo "Running test with the predicted times of every method"
+runCppOptionTest 47 "-s 36 100000 --explain" "-s 36 100000" \
+  '^Predicted times|^  '
+
+echo "Running test that one method is chosen"
+runCountTest 48 "-s 36 100000 --explain" '^  .* <- chosen$' 1
+
+echo "Running test with some of the formulas"
+runVerifyTest 49 "-sv 36 100000 --engines stirling,euler" 2
+
+echo "Running test with the automatic formula among the others"
+runVerifyTest 50 "-sv 19 7 --engines faulhaber,auto,central" 3
+
+echo "Running test with incorrect engine"
+runErrorTest 51 "-sv 5 10 --engines euler,gauss" "Invalid engine: gauss"
+
+echo "Running test with a memory limit every formula exceeds"
+runCountTest 52 "-s 300 10 --memory-limit 1K" \
+  '^Predicted memory of [0-9]+ bytes exceeds the limit of 1024 bytes$' 5
+
+echo "Running test with a memory limit every formula fits in"
+runCppOptionTest 53 "-sv 36 100000 --memory-limit 1G" "-sv 36 100000"
+
+echo "Running test with a memory limit the automatic formula fits in"
+runVerifyTest 54 "-sm 300 1000 --auto --memory-limit 30K --seed 1" 1
+
+echo "Running test with measurements of formulas on threads of their own"
+runCountTest 55 "-sv 36 100000 --stats --concurrent" '^GMP|^Predicted memory' 5
+
+echo "Running test with incorrect memory limit"
+runErrorTest 56 "-sv 5 10 --memory-limit 12Q" "Invalid memory limit: 12Q"
+
+echo "Running test that a cost model is calibrated and saved"
+rm -f costmodel_57.txt
+runVerifyTest 57 "-sv 300 1000 --auto --cost-model costmodel_57.txt" 1
+
+echo "Running test that a saved cost model is read"
+runCountTest 58 "-sv 300 1000 --auto --cost-model costmodel_57.txt" \
+  '^Calibrating|^The sum matches with Auto' 1 &&
+  rm costmodel_57.txt
+
+echo "Running test with a file that is not a cost model"
+echo "important data" >notamodel_59.txt
+runErrorTest 59 "-s 100 1000 --auto --cost-model notamodel_59.txt" \
+  "Invalid cost model file: notamodel_59.txt" &&
+  grep -q "^important data$" notamodel_59.txt && rm notamodel_59.txt
+
+echo "Running test with a memory limit the coefficients exceed"
+runCountTest 60 "-c 300 --memory-limit 1K" \
+  '^Predicted memory of [0-9]+ bytes exceeds the limit of 1024 bytes$' 5
+
+echo "Running test with a memory limit the sum formulas exceed"
+runCountTest 61 "-f 300 --memory-limit 1K" \
+  '^Predicted memory of [0-9]+ bytes exceeds the limit of 1024 bytes$' 5
+
+echo "Running test with a memory limit the coefficients fit in"
+runCppOptionTest 62 "-c 17 --memory-limit 1G" "-c 17"
+
+# Tests of the C++ library interfaces not reached from the command line
+echo "Running tests of the C++ library"
+if (cd $cppSrcDir; make test)
+then
+  echo "Test Successful :-)"
+else
+  echo "Test failed :-("
+fi
+
 deactivate
 
 # Cleanup
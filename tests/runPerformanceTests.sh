@@ -4,7 +4,9 @@
 # powers and number of terms.  At the end, it plots the results and outputs
 # encapsulated postscript files under the directory "perfTestResults-{language}
 # The plots are for the total time (coefficient initialization + summation),
-# summation time, and coefficient initialization time.
+# summation time, and coefficient initialization time.  For cpp the last plot
+# is of the time PowerSumBench takes to generate all the coefficients, since
+# Bernoulli and Faulhaber generate theirs during the summation.
 postprocess() {
   file="$1"
   prefix="$2"
@@ -140,6 +142,75 @@ postprocess() {
   }'
 }
 
+# Same as postprocess for the CSV written by PowerSumBench, which times every
+# point in the same process over a few runs.  The median is plotted.  The
+# coefficient time is that of the coeff phase, which generates all of them
+# for every formula alike, rather than that of init.
+postprocessBench() {
+  file="$1"
+  prefix="$2"
+  awk -F, -vprefix="$prefix" '
+  BEGIN {
+    ymins_total = "";
+    ymaxs_total = "";
+    ymin_total = 1145346789;
+    ymax_total = 0;
+    ymins_sum = "";
+    ymaxs_sum = "";
+    ymin_sum = 1145346789;
+    ymax_sum = 0;
+  }
+  NR > 1 {
+    engine = $1;
+    power = $2;
+    terms = $3;
+    phase = $4;
+    median = $6;
+    val = median + 0;
+    if (phase == "coeff") {
+      coeffTime[engine] = val;
+      next;
+    }
+    if (phase == "init" || phase == "wall") {
+      next;
+    }
+    if (engine == "series") {
+      print terms " " median >(prefix "_series.csv");
+    } else {
+      print terms " " median >(prefix "_" engine "_" phase ".csv");
+    }
+    if (phase == "total") {
+      if (val < ymin_total) {
+        ymin_total = val;
+        ymins_total = median;
+      }
+      if (val > ymax_total) {
+        ymax_total = val;
+        ymaxs_total = median;
+      }
+    }
+    if (phase == "sum" || engine == "series") {
+      if (val < ymin_sum) {
+        ymin_sum = val;
+        ymins_sum = median;
+      }
+      if (val > ymax_sum) {
+        ymax_sum = val;
+        ymaxs_sum = median;
+      }
+    }
+  }
+  END {
+    if (NR > 1) {
+      for (engine in coeffTime) {
+        printf("%d %d\n", power, int(coeffTime[engine])) \
+          >(prefix "_" engine "_coeff.csv");
+      }
+    }
+    print ymins_total ":" ymaxs_total ";" ymins_sum ":" ymaxs_sum;
+  }' $file
+}
+
 plotTimeVsN() {
   power=$1
   imageDir=$2
@@ -249,10 +320,17 @@ plotTimeVsM() {
   imageDir=$2
   xrange=$3
   yrange=$4
+  # PowerSumBench times the generation of all the coefficients
+  if [ x$lang = "xcpp" ]
+  then
+    coeffLabel="Coeff. generation"
+  else
+    coeffLabel="Coeff. init."
+  fi
   plotFile=$plotDataDir/plotFile_Power
   cat >$plotFile <<EOT
 set xlabel "Power (m)"
-set ylabel "Coeff. init. CPU time (nanoseconds)"
+set ylabel "$coeffLabel CPU time (nanoseconds)"
 set terminal png
 set output '$imageDir/coeffInitTime.png'
 set multiplot
@@ -261,7 +339,7 @@ set xrange [$xrange]
 set yrange [$yrange]
 set logscale x 10
 set logscale y 10
-set title "Coeff. init. time versus power"
+set title "$coeffLabel time versus power"
 set arrow nohead lc rgb "#F748A5" from 5000,810000 to 10000,810000
 set label "Faulhaber" at 12000,810000
 set arrow nohead lc rgb "#000000" from 5000,270000 to 10000,270000
@@ -307,13 +385,11 @@ plotDataDir=$resultsDir/plotData
 mkdir -p $imageDir $plotDataDir
 srcDir=$scriptDir/../src/main/$lang
 case $lang in
-  c|cpp)  (cd $srcDir; make clean; make)
-          if [ x$lang = "xc" ]
-          then
-              command=$srcDir/powersum
-          else
-              command=$srcDir/PowerSum
-          fi
+  c)      (cd $srcDir; make clean; make)
+          command=$srcDir/powersum
+          ;;
+  cpp)    (cd $srcDir; make clean; make all PowerSumBench)
+          command=$srcDir/PowerSumBench
           ;;
   java)   (cd $srcDir; ./build.sh)
           command="java -jar $srcDir/PowerSum.jar"
@@ -330,14 +406,23 @@ case $lang in
 esac
 
 nrange="10:1000000000"
+termsList="10 25 50 75 100 250 500 750 1000 2000 5000 7500 10000 20000 \
+           50000 75000 100000 200000 500000 750000 1000000"
 for power in 0010 0015 0020 0050 0100 0200 0500 1000 2000 3000 4000
 do
-  for terms in 10 25 50 75 100 250 500 750 1000 2000 5000 7500 10000 20000 \
-               50000 75000 100000 200000 500000 750000 1000000
-  do
-     $command -sv $power $terms
-  done  >${power}.log
-  yrange=`postprocess ${power}.log $plotDataDir/$power`
+  if [ x$lang = "xcpp" ]
+  then
+    # Timed in process with repetitions instead of one run per point
+    $command --powers $power --terms `echo $termsList | tr ' ' ','` \
+             --series --format csv >${power}.log
+    yrange=`postprocessBench ${power}.log $plotDataDir/$power`
+  else
+    for terms in $termsList
+    do
+       $command -sv $power $terms
+    done  >${power}.log
+    yrange=`postprocess ${power}.log $plotDataDir/$power`
+  fi
   yrangeTotal=`echo $yrange|sed -e 's/;.*$//'`
   yrangeSum=`echo $yrange|sed -e 's/^.*;//'`
   plotTimeVsN $power $imageDir $plotDataDir $nrange $yrangeTotal $yrangeSum